@@ -19,6 +19,7 @@
 #include "BaseED.h"
 #include "BaseED_support.h"
 #include "BaseED_supportsettings.h"
+#include "BaseED_trace.h"
 #include "SynDefines.h"
 #include "BaseComms.h"
 
@@ -98,12 +99,16 @@ const endPointDesc_t BaseED_epDesc =
  * EXTERNAL VARIABLES
  **************************************************************************************************/
 extern uint8 nv_commissioned_status;
+extern uint8 nv_power_profile;
 extern DeviceInfo_t nv_device_info;
 
 /**************************************************************************************************
  * EXTERNAL FUNCTIONS
  **************************************************************************************************/
 uint8 get_nwk_status(void);
+void set_nwk_status(uint8 status);
+void ProjectSpecific_OtaSensorTraffic(void);
+void ProjectSpecific_PollExchange(void);
 #ifdef DEBUG
 uint16 ProjectSpecific_UartWrite(uint8 port, uint8 *buf, uint16 len);
 void ProjectSpecific_HexDump(uint8 *ptr, uint16 len);
@@ -139,7 +144,10 @@ void BaseED_Init( uint8 task_id )
   ProjSpecific_InitDevice( task_id );  //This will initialize the sensor device
   
   
-  HalLedBlink (HAL_LED_2, 1, HAL_LED_DEFAULT_DUTY_CYCLE, HAL_LED_DEFAULT_FLASH_TIME);
+  if (APP_VERBOSE())
+  {
+    HalLedBlink (HAL_LED_2, 1, HAL_LED_DEFAULT_DUTY_CYCLE, HAL_LED_DEFAULT_FLASH_TIME);
+  }
   // Max asks: why only if DEVICE_ACTIVE?
   
   nwkJoinAttemptCount = 0;
@@ -173,7 +181,10 @@ UINT16 BaseED_ProcessEvent( uint8 task_id, UINT16 events )
         BaseED_NwkState = (devStates_t)(MSGpkt->hdr.status);   
         if (BaseED_NwkState == DEV_END_DEVICE)
         { 
-            HalLedBlink ( HAL_LED_2, 2, 50, 1000 );
+            if (APP_VERBOSE())
+            {
+              HalLedBlink ( HAL_LED_2, 2, 50, 1000 );
+            }
             ProjSpecific_ZDO_state_change( );
             nwk_status = NWK_JOINED;
         }       
@@ -235,6 +246,17 @@ void BaseED_Send(unsigned char clusterID, unsigned char msgTypeID, unsigned char
   ProjectSpecific_HexDump(buffer, bufSize);
 #endif //DEBUG
   
+  if (msgTypeID != END_DEVICE_MESSAGE_TYPE_OTA_MT_RESP)
+  {
+    // Sensor traffic goes first, a background OTA fetch holds back for it
+    ProjectSpecific_OtaSensorTraffic();
+  }
+  else
+  {
+    // Part of an MT exchange with the coordinator, its next frame is on the way
+    ProjectSpecific_PollExchange();
+  }
+  
   #define PREAMBLE_LENGTH 14  // 14 bytes include sync, preamble
   #define CRC_LENGTH 2 
   
@@ -289,10 +311,7 @@ void BaseED_Send(unsigned char clusterID, unsigned char msgTypeID, unsigned char
     {
       asm("nop");
       //osal_set_event(BaseED_TaskID, BaseEDEM_SEND_EVT);      
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "Failed! ", 8);
-      ProjectSpecific_HexDump(&nret, 1);
-      #endif //DEBUG
+      APP_TRACE1(TRC_SEND_FAILED, nret);
     }
     else 
     {
@@ -312,9 +331,7 @@ void BaseED_Send(unsigned char clusterID, unsigned char msgTypeID, unsigned char
   }
   else {
     asm("nop");
-    #if DEBUG > 1
-    ProjectSpecific_UartWrite(ZBC_PORT, "Can't send: NO MEM\r\n", 20);
-    #endif
+    APP_TRACE(TRC_SEND_NO_MEM);
   }
 }
 #ifdef INTER_PAN
@@ -396,10 +413,7 @@ void BaseED_SendInterPan(unsigned char clusterID, unsigned char msgTypeID, unsig
   if (nret != afStatus_SUCCESS)   
   {
     //osal_set_event(BaseED_TaskID, BaseEDEM_SEND_EVT);      
-    #ifdef DEBUG
-    ProjectSpecific_UartWrite(ZBC_PORT, "Failed! ", 8);
-    ProjectSpecific_HexDump(&nret, 1);
-    #endif //DEBUG
+    APP_TRACE1(TRC_SEND_FAILED, nret);
   }
   else 
   {
@@ -497,3 +511,18 @@ uint8 get_nwk_status(void)
 {
   return nwk_status;
 }
+
+/**************************************************************************************************
+ * @fn      set_nwk_status
+ *
+ * @brief   Overrides the network status. Used when the NWK layer is restarted without a
+ *          reset, so that we don't keep reporting NWK_JOINED for the network we just left.
+ *
+ * @param   status - NWK_JOINED or NWK_ORPHAN
+ *          
+ * @return  None
+ **************************************************************************************************/
+void set_nwk_status(uint8 status)
+{
+  nwk_status = status;
+}
@@ -126,6 +126,7 @@ void BaseED_SendInterPan(unsigned char clusterID, unsigned char msgTypeID, unsig
                  uint16 dstPanId, uint16 dstAddr, unsigned char bufSize, unsigned char *buffer);
 #endif //INTER_PAN
 uint8 get_nwk_status(void);
+void set_nwk_status(uint8 status);
 
 /*********************************************************************
 *********************************************************************/
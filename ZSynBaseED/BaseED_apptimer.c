@@ -0,0 +1,287 @@
+/*******************************************************************************
+  Filename:       BaseED_apptimer.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Application timers with a slack tolerance, serviced by a
+                  single OSAL timer so deadlines close to each other cost
+                  one wakeup instead of several.
+*******************************************************************************/
+
+/**************************************************************************************************
+ *                                             INCLUDES
+ **************************************************************************************************/
+#include "OSAL.h"
+#include "OSAL_Clock.h"
+
+#include "BaseED_apptimer.h"
+
+/**************************************************************************************************
+ *                                            TYPEDEFS
+ **************************************************************************************************/
+typedef struct appTimer
+{
+  uint16 event;         // 0 if the slot is free
+  uint32 deadline;      // osal_GetSystemClock() time the timer is due
+  uint32 period;        // reload period, 0 for a one shot timer
+  uint16 slack;         // how late the timer may fire, in ms
+} appTimer_t;
+
+/**************************************************************************************************
+ *                                            LOCAL
+ **************************************************************************************************/
+static appTimer_t appTimers[APP_TIMER_MAX];
+static uint8 appTimerTaskId;
+static uint16 appTimerServiceEvent;
+
+static uint32 appTimerWakeups = 0;
+static uint32 appTimerExpirations = 0;
+static uint32 appTimerStatsSince = 0;
+
+/**************************************************************************************************
+ *                                        FUNCTIONS - Local
+ **************************************************************************************************/
+static uint8 AppTimer_Arm(uint16 event, uint32 delay, uint32 period, uint16 slack);
+static void AppTimer_Reschedule(uint32 now);
+
+/*********************************************************************
+ * @fn      AppTimer_Init
+ *
+ * @brief   Sets up the timers of a task.
+ *
+ * @param   taskId       - task the timer events are set on
+ * @param   serviceEvent - event of that task reserved for the shared
+ *                         OSAL timer, its handler calls AppTimer_Service()
+ *
+ * @return  none
+ */
+void AppTimer_Init( uint8 taskId, uint16 serviceEvent )
+{
+  uint8 i;
+
+  appTimerTaskId = taskId;
+  appTimerServiceEvent = serviceEvent;
+  for (i = 0; i < APP_TIMER_MAX; ++i) {
+    appTimers[i].event = 0;
+  }
+  AppTimer_ClearStats();
+}
+
+/*********************************************************************
+ * @fn      AppTimer_Start
+ *
+ * @brief   Sets event after delay ms, or up to slack ms later if that
+ *          lets it share a wakeup with another timer. Restarts the timer
+ *          if it is already running.
+ *
+ * @param   event - event to set
+ * @param   delay - ms until the timer is due
+ * @param   slack - ms the timer may fire late
+ *
+ * @return  SUCCESS, or NO_TIMER_AVAIL if all APP_TIMER_MAX timers are in use
+ */
+uint8 AppTimer_Start( uint16 event, uint32 delay, uint16 slack )
+{
+  return AppTimer_Arm(event, delay, 0, slack);
+}
+
+/*********************************************************************
+ * @fn      AppTimer_StartReload
+ *
+ * @brief   Like AppTimer_Start(), but the timer keeps firing every period
+ *          ms. Late firings don't accumulate, the schedule stays anchored
+ *          to the first deadline.
+ *
+ * @param   event  - event to set
+ * @param   period - ms between firings
+ * @param   slack  - ms each firing may be late
+ *
+ * @return  SUCCESS, or NO_TIMER_AVAIL if all APP_TIMER_MAX timers are in use
+ */
+uint8 AppTimer_StartReload( uint16 event, uint32 period, uint16 slack )
+{
+  return AppTimer_Arm(event, period, period, slack);
+}
+
+/*********************************************************************
+ * @fn      AppTimer_Stop
+ *
+ * @brief   Stops the timer of event. Like osal_stop_timerEx() this does
+ *          not clear the event if it was already set.
+ *
+ * @param   event - event of the timer to stop
+ *
+ * @return  none
+ */
+void AppTimer_Stop( uint16 event )
+{
+  uint8 i;
+
+  for (i = 0; i < APP_TIMER_MAX; ++i) {
+    if (appTimers[i].event == event) {
+      appTimers[i].event = 0;
+      AppTimer_Reschedule(osal_GetSystemClock());
+      return;
+    }
+  }
+}
+
+/*********************************************************************
+ * @fn      AppTimer_Service
+ *
+ * @brief   Fires every timer that is due and arms the shared OSAL timer
+ *          for the next one. Called from the handler of serviceEvent.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+void AppTimer_Service( void )
+{
+  uint32 now = osal_GetSystemClock();
+  uint8 i;
+
+  ++appTimerWakeups;
+  for (i = 0; i < APP_TIMER_MAX; ++i) {
+    appTimer_t *t = &appTimers[i];
+    if (t->event == 0 || (int32)(t->deadline - now) > 0) {
+      continue;
+    }
+
+    osal_set_event(appTimerTaskId, t->event);
+    ++appTimerExpirations;
+    if (t->period) {
+      t->deadline += t->period;
+      if ((int32)(t->deadline - now) <= 0) {
+        t->deadline = now + t->period;   // fell behind by a whole period
+      }
+    }
+    else {
+      t->event = 0;
+    }
+  }
+  AppTimer_Reschedule(now);
+}
+
+/*********************************************************************
+ * @fn      AppTimer_GetStats
+ *
+ * @brief   Wakeup statistics since they were last cleared.
+ *
+ * @param   stats - filled in
+ *
+ * @return  none
+ */
+void AppTimer_GetStats( appTimerStats_t *stats )
+{
+  stats->wakeups = appTimerWakeups;
+  stats->expirations = appTimerExpirations;
+  stats->elapsed = (osal_GetSystemClock() - appTimerStatsSince) / 1000;
+  if (stats->elapsed == 0) {
+    stats->wakeupsPerHour = 0;
+  }
+  else if (appTimerWakeups < 0xFFFFFFFFUL / 3600) {
+    stats->wakeupsPerHour = (appTimerWakeups * 3600) / stats->elapsed;
+  }
+  else {
+    stats->wakeupsPerHour = appTimerWakeups / stats->elapsed * 3600;
+  }
+}
+
+/*********************************************************************
+ * @fn      AppTimer_ClearStats
+ *
+ * @brief   Starts a new statistics period.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+void AppTimer_ClearStats( void )
+{
+  appTimerWakeups = 0;
+  appTimerExpirations = 0;
+  appTimerStatsSince = osal_GetSystemClock();
+}
+
+/*********************************************************************
+ * @fn      AppTimer_Arm
+ *
+ * @brief   Starts or restarts the timer of event.
+ *
+ * @param   event  - event to set
+ * @param   delay  - ms until the first firing
+ * @param   period - reload period, 0 for one shot
+ * @param   slack  - ms each firing may be late
+ *
+ * @return  SUCCESS or NO_TIMER_AVAIL
+ */
+static uint8 AppTimer_Arm(uint16 event, uint32 delay, uint32 period, uint16 slack)
+{
+  uint32 now = osal_GetSystemClock();
+  appTimer_t *slot = NULL;
+  uint8 i;
+
+  for (i = 0; i < APP_TIMER_MAX; ++i) {
+    if (appTimers[i].event == event) {
+      slot = &appTimers[i];
+      break;
+    }
+    if (slot == NULL && appTimers[i].event == 0) {
+      slot = &appTimers[i];
+    }
+  }
+  if (slot == NULL) {
+    return NO_TIMER_AVAIL;
+  }
+
+  slot->event = event;
+  slot->deadline = now + delay;
+  slot->period = period;
+  slot->slack = slack;
+  AppTimer_Reschedule(now);
+  return SUCCESS;
+}
+
+/*********************************************************************
+ * @fn      AppTimer_Reschedule
+ *
+ * @brief   Arms the shared OSAL timer for the latest moment the most
+ *          urgent timer may fire. Every other timer due by then fires in
+ *          the same wakeup.
+ *
+ * @param   now - current osal_GetSystemClock() time
+ *
+ * @return  none
+ */
+static void AppTimer_Reschedule(uint32 now)
+{
+  uint32 wake = 0;
+  uint8 armed = FALSE;
+  uint8 i;
+
+  for (i = 0; i < APP_TIMER_MAX; ++i) {
+    if (appTimers[i].event) {
+      int32 latest = (int32)(appTimers[i].deadline - now) + appTimers[i].slack;
+      if (latest < 0) {
+        latest = 0;
+      }
+      if (!armed || (uint32)latest < wake) {
+        wake = latest;
+        armed = TRUE;
+      }
+    }
+  }
+
+  if (!armed) {
+    osal_stop_timerEx(appTimerTaskId, appTimerServiceEvent);
+  }
+  else if (wake == 0) {
+    osal_stop_timerEx(appTimerTaskId, appTimerServiceEvent);
+    osal_set_event(appTimerTaskId, appTimerServiceEvent);
+  }
+  else {
+    // OSAL timers are 16 bit, a longer wait just takes an extra wakeup
+    osal_start_timerEx(appTimerTaskId, appTimerServiceEvent, (wake > 0xFFFF) ? 0xFFFF : (uint16)wake);
+  }
+}
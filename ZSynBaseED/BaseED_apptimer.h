@@ -0,0 +1,46 @@
+#ifndef BaseED_APPTIMER_H
+#define BaseED_APPTIMER_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the coalescing application timers. Each timer may fire
+up to its slack later than asked for. All timers of the application
+task share one OSAL timer, which is armed for the earliest deadline
+plus slack; every timer whose deadline has come by then is fired in the
+same wakeup. Expired timers set their event on the task like
+osal_start_timerEx() would, so the event handlers stay the same.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Number of timers that can be running at the same time
+#define APP_TIMER_MAX                       8
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct appTimerStats
+{
+  uint32 wakeups;       // times the shared OSAL timer went off
+  uint32 expirations;   // timers fired, i.e. wakeups without coalescing
+  uint32 elapsed;       // seconds since the statistics were cleared
+  uint32 wakeupsPerHour;
+} appTimerStats_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void AppTimer_Init( uint8 taskId, uint16 serviceEvent );
+uint8 AppTimer_Start( uint16 event, uint32 delay, uint16 slack );
+uint8 AppTimer_StartReload( uint16 event, uint32 period, uint16 slack );
+void AppTimer_Stop( uint16 event );
+void AppTimer_Service( void );
+void AppTimer_GetStats( appTimerStats_t *stats );
+void AppTimer_ClearStats( void );
+
+#endif
@@ -0,0 +1,140 @@
+/*******************************************************************************
+  Filename:       BaseED_backoff.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Exponential retry backoff with decorrelated jitter, seeded
+                  from the IEEE address of the device.
+*******************************************************************************/
+
+#include "BaseED_backoff.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint32 Backoff_Rand( backoff_t *b )
+{
+  uint32 x = b->rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  b->rng = x;
+  return x;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Backoff_Init
+ *
+ * @brief   Clears the backoff and its statistics and seeds the random
+ *          sequence from the IEEE address and the salt.
+ *
+ * @param   b        - backoff to initialize
+ * @param   ieeeAddr - Z_EXTADDR_LEN bytes of IEEE address
+ * @param   salt     - mixed into the seed, e.g. a boot count
+ * @param   base     - smallest delay
+ * @param   cap      - largest delay
+ *
+ * @return  none
+ */
+void Backoff_Init( backoff_t *b, const uint8 *ieeeAddr, uint16 salt, uint32 base, uint32 cap )
+{
+  uint32 seed = 2166136261UL;   // FNV-1a over the address and the salt
+  uint8 i;
+
+  for (i = 0; i < Z_EXTADDR_LEN; ++i) {
+    seed ^= ieeeAddr[i];
+    seed *= 16777619UL;
+  }
+  seed ^= (uint8)salt;
+  seed *= 16777619UL;
+  seed ^= (uint8)(salt >> 8);
+  seed *= 16777619UL;
+
+  b->rng = seed ? seed : 1;
+  b->last = 0;
+  b->attempts = 0;
+  b->maxAttempts = 0;
+  b->successes = 0;
+  b->totalDelay = 0;
+  Backoff_SetLimits(b, base, cap);
+}
+
+/*********************************************************************
+ * @fn      Backoff_SetLimits
+ *
+ * @brief   Changes the delay limits without touching the statistics.
+ *
+ * @param   b    - backoff
+ * @param   base - smallest delay, at least 1
+ * @param   cap  - largest delay, raised to base if smaller
+ *
+ * @return  none
+ */
+void Backoff_SetLimits( backoff_t *b, uint32 base, uint32 cap )
+{
+  b->base = base ? base : 1;
+  b->cap = (cap < b->base) ? b->base : cap;
+}
+
+/*********************************************************************
+ * @fn      Backoff_Next
+ *
+ * @brief   Delay before the next retry. A previous delay below base,
+ *          as after a success, counts as base, so even the first delay
+ *          is jittered.
+ *
+ * @param   b - backoff
+ *
+ * @return  delay, between base and cap
+ */
+uint32 Backoff_Next( backoff_t *b )
+{
+  uint32 last = (b->last < b->base) ? b->base : b->last;
+  uint32 hi;
+  uint32 delay;
+
+  // Three times the previous delay, without overflowing
+  hi = (last > b->cap / 3) ? b->cap : last * 3;
+  if (hi < b->base) {
+    hi = b->base;
+  }
+
+  delay = b->base + Backoff_Rand(b) % (hi - b->base + 1);
+  if (delay > b->cap) {
+    delay = b->cap;
+  }
+
+  b->last = delay;
+  b->totalDelay += delay;
+  if (b->attempts < 0xFFFF) {
+    ++b->attempts;
+  }
+  if (b->attempts > b->maxAttempts) {
+    b->maxAttempts = b->attempts;
+  }
+  return delay;
+}
+
+/*********************************************************************
+ * @fn      Backoff_Success
+ *
+ * @brief   The retried operation worked, start over from base next time.
+ *
+ * @param   b - backoff
+ *
+ * @return  none
+ */
+void Backoff_Success( backoff_t *b )
+{
+  if (b->attempts) {
+    ++b->successes;
+  }
+  b->last = 0;
+  b->attempts = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef BaseED_BACKOFF_H
+#define BaseED_BACKOFF_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the retry backoff shared by the join retry and planned
+restart paths. Delays grow exponentially with decorrelated jitter:
+
+  delay = min(cap, random(base, 3 * previous delay))
+
+The first delay after a success is drawn from base to 3 * base, so
+retries are spread out from the start. The random sequence is seeded
+from the IEEE address and a salt such as a boot count, so a fleet that
+lost its coordinator at the same time spreads its retries out instead
+of retrying in lockstep, and a device draws different delays after
+every boot. Units are up to the caller.
+*********************************************************************/
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct backoff
+{
+  uint32 rng;           // xorshift32 state, never 0
+  uint32 base;          // smallest delay
+  uint32 cap;           // largest delay
+  uint32 last;          // previous delay, 0 after a success, taken as base
+  // Statistics
+  uint16 attempts;      // retries since the last success
+  uint16 maxAttempts;   // longest run of retries seen
+  uint16 successes;     // recoveries, i.e. successes after at least one retry
+  uint32 totalDelay;    // sum of all delays handed out
+} backoff_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Backoff_Init( backoff_t *b, const uint8 *ieeeAddr, uint16 salt, uint32 base, uint32 cap );
+void Backoff_SetLimits( backoff_t *b, uint32 base, uint32 cap );
+uint32 Backoff_Next( backoff_t *b );
+void Backoff_Success( backoff_t *b );
+
+#endif
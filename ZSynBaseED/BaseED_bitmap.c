@@ -0,0 +1,158 @@
+/*******************************************************************************
+  Filename:       BaseED_bitmap.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Word at a time scans of the OTA block bitmap: next missing
+                  block, length of a run of missing blocks, blocks missing.
+*******************************************************************************/
+
+#include "BaseED_bitmap.h"
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// Trailing zeros of a nibble, 4 for 0
+static const uint8 bitmapCtz4[16] = { 4, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+// Zero bits of a nibble
+static const uint8 bitmapZeros4[16] = { 4, 3, 3, 2, 3, 2, 2, 1, 3, 2, 2, 1, 2, 1, 1, 0 };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+// Trailing zeros of a byte, 8 for 0
+static uint8 Bitmap_Ctz8( uint8 v )
+{
+  return (v & 0x0F) ? bitmapCtz4[v & 0x0F] : 4 + bitmapCtz4[v >> 4];
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Bitmap_NextClear
+ *
+ * @brief   Finds the first missing block at or after from.
+ *
+ * @param   bm    - bitmap
+ * @param   total - number of blocks in the bitmap
+ * @param   from  - first block to look at
+ *
+ * @return  block number, or BITMAP_NONE if every block from there on
+ *          has been received
+ */
+uint16 Bitmap_NextClear( const uint8 *bm, uint16 total, uint16 from )
+{
+  uint16 byte;
+  uint16 bytes = (total + 7) >> 3;
+  uint8 v;
+
+  if (from >= total) {
+    return BITMAP_NONE;
+  }
+
+  // The byte from is in, without the blocks before from
+  byte = from >> 3;
+  v = (uint8)~bm[byte] & (uint8)(0xFF << (from & 7));
+
+  for (;;) {
+    if (v) {
+      from = (byte << 3) + Bitmap_Ctz8(v);
+      return (from < total) ? from : BITMAP_NONE;
+    }
+    ++byte;
+    // Skip whole words that are fully received
+    while (byte + 4 <= bytes && (bm[byte] & bm[byte + 1] & bm[byte + 2] & bm[byte + 3]) == 0xFF) {
+      byte += 4;
+    }
+    if (byte >= bytes) {
+      return BITMAP_NONE;
+    }
+    v = (uint8)~bm[byte];
+  }
+}
+
+/*********************************************************************
+ * @fn      Bitmap_ClearRun
+ *
+ * @brief   Length of the run of missing blocks that starts at first, so
+ *          that one request can name all of them.
+ *
+ * @param   bm    - bitmap
+ * @param   total - number of blocks in the bitmap
+ * @param   first - first block of the run, normally a missing one
+ * @param   max   - longest run wanted
+ *
+ * @return  number of consecutive missing blocks, 0 if first was received
+ */
+uint16 Bitmap_ClearRun( const uint8 *bm, uint16 total, uint16 first, uint16 max )
+{
+  uint16 byte;
+  uint16 bytes = (total + 7) >> 3;
+  uint16 end;
+  uint8 v;
+
+  if (first >= total || max == 0) {
+    return 0;
+  }
+
+  // First received block at or after first, the run ends there
+  byte = first >> 3;
+  v = bm[byte] & (uint8)(0xFF << (first & 7));
+  for (;;) {
+    if (v) {
+      end = (byte << 3) + Bitmap_Ctz8(v);
+      break;
+    }
+    ++byte;
+    // Skip whole words that are fully missing
+    while (byte + 4 <= bytes && (bm[byte] | bm[byte + 1] | bm[byte + 2] | bm[byte + 3]) == 0) {
+      byte += 4;
+    }
+    if (byte >= bytes) {
+      end = total;
+      break;
+    }
+    v = bm[byte];
+  }
+
+  if (end > total) {
+    end = total;
+  }
+  return (end - first > max) ? max : end - first;
+}
+
+/*********************************************************************
+ * @fn      Bitmap_CountClear
+ *
+ * @brief   Number of blocks still missing.
+ *
+ * @param   bm    - bitmap
+ * @param   total - number of blocks in the bitmap
+ *
+ * @return  missing blocks
+ */
+uint16 Bitmap_CountClear( const uint8 *bm, uint16 total )
+{
+  uint16 full = total >> 3;
+  uint16 count = 0;
+  uint16 byte;
+  uint16 i;
+
+  for (byte = 0; byte < full; ++byte) {
+    if (bm[byte] != 0xFF) {
+      count += bitmapZeros4[bm[byte] & 0x0F] + bitmapZeros4[bm[byte] >> 4];
+    }
+  }
+  for (i = full << 3; i < total; ++i) {
+    if (!((bm[i >> 3] >> (i & 7)) & 1)) {
+      ++count;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,29 @@
+#ifndef BaseED_BITMAP_H
+#define BaseED_BITMAP_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the OTA bitmap scans. The bitmaps are the ones of
+bitmapfs (BM_ALLOC, BM_SET, BM_TEST): bit i is bit (i & 7) of byte
+i >> 3, set once block i has been received. The scans skip four fully
+received bytes at a time and find the missing bit in a byte with a
+count trailing zeros instead of testing block by block.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// No missing block, returned by Bitmap_NextClear()
+#define BITMAP_NONE                         0xFFFF
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+uint16 Bitmap_NextClear( const uint8 *bm, uint16 total, uint16 from );
+uint16 Bitmap_ClearRun( const uint8 *bm, uint16 total, uint16 first, uint16 max );
+uint16 Bitmap_CountClear( const uint8 *bm, uint16 total );
+
+#endif
@@ -0,0 +1,66 @@
+/*******************************************************************************
+  Filename:       BaseED_crc.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   CRC16-CCITT of OTA blocks.
+*******************************************************************************/
+
+#include "BaseED_crc.h"
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+// CRC of every nibble value shifted in at the top
+static const uint16 crc16Table4[16] =
+{
+  0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+  0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Crc16_Update
+ *
+ * @brief   Runs buf through the CRC.
+ *
+ * @param   crc - CRC so far, CRC16_INIT to start
+ * @param   buf - data
+ * @param   len - bytes of data
+ *
+ * @return  updated CRC
+ */
+uint16 Crc16_Update( uint16 crc, const uint8 *buf, uint16 len )
+{
+  while (len--) {
+    crc ^= (uint16)*buf++ << 8;
+    crc = (crc << 4) ^ crc16Table4[crc >> 12];
+    crc = (crc << 4) ^ crc16Table4[crc >> 12];
+  }
+  return crc;
+}
+
+/*********************************************************************
+ * @fn      Crc16_Block
+ *
+ * @brief   CRC of an OTA block, over its number and its data.
+ *
+ * @param   block - block number
+ * @param   buf   - block data
+ * @param   len   - bytes of block data
+ *
+ * @return  CRC
+ */
+uint16 Crc16_Block( uint16 block, const uint8 *buf, uint16 len )
+{
+  uint8 num[2];
+
+  num[0] = (uint8)(block & 0xFF);
+  num[1] = (uint8)(block >> 8);
+  return Crc16_Update(Crc16_Update(CRC16_INIT, num, 2), buf, len);
+}
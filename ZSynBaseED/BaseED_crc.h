@@ -0,0 +1,27 @@
+#ifndef BaseED_CRC_H
+#define BaseED_CRC_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the CRC16-CCITT of OTA blocks: polynomial 0x1021,
+initial value CRC16_INIT, no reflection, no final XOR. The CRC of a
+block covers its block number, least significant byte first, followed
+by its data, so a block stored at the wrong place doesn't check out
+either. Four bits are done at a time from a 16 entry table.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define CRC16_INIT                          0xFFFF
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+uint16 Crc16_Update( uint16 crc, const uint8 *buf, uint16 len );
+uint16 Crc16_Block( uint16 block, const uint8 *buf, uint16 len );
+
+#endif
@@ -0,0 +1,187 @@
+/*******************************************************************************
+  Filename:       BaseED_delta.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Streaming application of a delta OTA image against the
+                  running image.
+*******************************************************************************/
+
+#include "BaseED_delta.h"
+
+
+/*********************************************************************
+ * LOCAL CONSTANTS
+ */
+
+// delta_t.state
+#define DELTA_STATE_OP                      0
+#define DELTA_STATE_COPY_LEN                1
+#define DELTA_STATE_COPY_SRC                2
+#define DELTA_STATE_COPY                    3
+#define DELTA_STATE_INSERT                  4
+#define DELTA_STATE_FAILED                  5
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Delta_Init
+ *
+ * @brief   Starts applying a new patch.
+ *
+ * @param   d      - patch state to initialize
+ * @param   oldLen - bytes of the running image, copies stay within them
+ * @param   newLen - bytes of the new image the patch announces
+ *
+ * @return  none
+ */
+void Delta_Init( delta_t *d, uint32 oldLen, uint32 newLen )
+{
+  d->state = DELTA_STATE_OP;
+  d->have = 0;
+  d->remaining = 0;
+  d->src = 0;
+  d->out = 0;
+  d->oldLen = oldLen;
+  d->newLen = newLen;
+}
+
+/*********************************************************************
+ * @fn      Delta_Apply
+ *
+ * @brief   Produces as much of the new image from in as fits into out.
+ *          Call again with the rest of the input, if any, once out has
+ *          been written away; with inLen 0 it finishes a copy still in
+ *          progress. A failed patch produces nothing, see Delta_Failed().
+ *
+ * @param   d       - patch state
+ * @param   in      - patch data
+ * @param   inLen   - bytes of patch data
+ * @param   used    - set to the bytes of patch data consumed
+ * @param   out     - new image data
+ * @param   outMax  - room in out
+ * @param   readOld - reads the running image
+ *
+ * @return  bytes written to out
+ */
+uint16 Delta_Apply( delta_t *d, const uint8 *in, uint16 inLen, uint16 *used,
+                    uint8 *out, uint16 outMax, deltaReadOld_t readOld )
+{
+  uint16 n = 0;
+  uint16 i = 0;
+  uint16 chunk;
+  uint8 c;
+
+  for (;;) {
+    if (d->state == DELTA_STATE_FAILED) {
+      break;
+    }
+    // Copies need no input, finish the one in progress first
+    if (d->state == DELTA_STATE_COPY) {
+      chunk = outMax - n;
+      if (chunk > d->remaining) {
+        chunk = d->remaining;
+      }
+      if (chunk) {
+        readOld(d->src, out + n, chunk);
+        d->src += chunk;
+        d->remaining -= chunk;
+        n += chunk;
+      }
+      if (d->remaining) {
+        break;
+      }
+      d->state = DELTA_STATE_OP;
+    }
+    if (n >= outMax || i >= inLen) {
+      break;
+    }
+
+    c = in[i++];
+    switch (d->state) {
+      case DELTA_STATE_OP:
+        if (c & DELTA_OP_INSERT) {
+          d->remaining = (c & 0x7F) + 1;
+          d->state = (d->remaining > d->newLen - d->out - n) ? DELTA_STATE_FAILED : DELTA_STATE_INSERT;
+        }
+        else {
+          d->remaining = (uint16)c << 8;
+          d->state = DELTA_STATE_COPY_LEN;
+        }
+        break;
+
+      case DELTA_STATE_COPY_LEN:
+        d->remaining = (d->remaining | c) + 1;
+        d->src = 0;
+        d->have = 0;
+        d->state = (d->remaining > d->newLen - d->out - n) ? DELTA_STATE_FAILED : DELTA_STATE_COPY_SRC;
+        break;
+
+      case DELTA_STATE_COPY_SRC:
+        d->src |= (uint32)c << (8 * d->have);
+        if (++d->have == 3) {
+          d->state = (d->src > d->oldLen || d->remaining > d->oldLen - d->src) ?
+                     DELTA_STATE_FAILED : DELTA_STATE_COPY;
+        }
+        break;
+
+      case DELTA_STATE_INSERT:
+        out[n++] = c;
+        if (--d->remaining == 0) {
+          d->state = DELTA_STATE_OP;
+        }
+        break;
+    }
+  }
+
+  d->out += n;
+  *used = i;
+  return n;
+}
+
+/*********************************************************************
+ * @fn      Delta_Idle
+ *
+ * @brief   Whether the patch is between operations, which is where a
+ *          complete patch ends.
+ *
+ * @param   d - patch state
+ *
+ * @return  TRUE if no operation is partly applied
+ */
+uint8 Delta_Idle( const delta_t *d )
+{
+  return (d->state == DELTA_STATE_OP);
+}
+
+/*********************************************************************
+ * @fn      Delta_Failed
+ *
+ * @brief   Whether the patch copied from outside the running image or
+ *          ran past the size of the new image.
+ *
+ * @param   d - patch state
+ *
+ * @return  TRUE if the patch failed
+ */
+uint8 Delta_Failed( const delta_t *d )
+{
+  return (d->state == DELTA_STATE_FAILED);
+}
+
+/*********************************************************************
+ * @fn      Delta_Complete
+ *
+ * @brief   Whether the patch ended where a complete one ends, between
+ *          operations and with all of the new image produced.
+ *
+ * @param   d - patch state
+ *
+ * @return  TRUE if the new image is complete
+ */
+uint8 Delta_Complete( const delta_t *d )
+{
+  return (d->state == DELTA_STATE_OP && d->out == d->newLen);
+}
@@ -0,0 +1,64 @@
+#ifndef BaseED_DELTA_H
+#define BaseED_DELTA_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for applying a delta OTA image. A delta is a patch against
+the image that is running: a sequence of operations that either copy a
+range of the running image or insert bytes carried in the patch, in the
+order of the new image.
+
+  insert  0x80 | (n - 1), then n bytes            n = 1..DELTA_INSERT_MAX
+  copy    (n - 1) >> 8, (n - 1) & 0xFF, offset    n = 1..DELTA_COPY_MAX
+          with offset three bytes, least significant first, into the
+          running image
+
+The patch can be fed in pieces of any size, as blocks arrive; an
+operation split across two pieces carries over. A copy from outside the
+running image, or an operation that would take the new image past its
+announced size, fails the patch and nothing more is produced. Reading
+the running image is up to the caller. tools/delta_patch.c writes this
+format.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define DELTA_OP_INSERT                     0x80
+
+// Longest insert and copy of one operation
+#define DELTA_INSERT_MAX                    128
+#define DELTA_COPY_MAX                      0x8000
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Reads len bytes of the running image at offset into buf
+typedef void (*deltaReadOld_t)( uint32 offset, uint8 *buf, uint16 len );
+
+typedef struct delta
+{
+  uint8  state;         // part of the operation expected next
+  uint8  have;          // bytes of the copy offset read so far
+  uint16 remaining;     // bytes of the insert or copy left
+  uint32 src;           // offset of the copy in the running image
+  uint32 out;           // bytes of the new image produced so far
+  uint32 oldLen;        // bytes of the running image
+  uint32 newLen;        // bytes of the new image
+} delta_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Delta_Init( delta_t *d, uint32 oldLen, uint32 newLen );
+uint16 Delta_Apply( delta_t *d, const uint8 *in, uint16 inLen, uint16 *used,
+                    uint8 *out, uint16 outMax, deltaReadOld_t readOld );
+uint8 Delta_Idle( const delta_t *d );
+uint8 Delta_Failed( const delta_t *d );
+uint8 Delta_Complete( const delta_t *d );
+
+#endif
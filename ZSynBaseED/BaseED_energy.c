@@ -0,0 +1,221 @@
+/*******************************************************************************
+  Filename:       BaseED_energy.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Energy ledger: radio on time, sleep time, polls, frames
+                  and NV writes per application phase, and the charge they
+                  are estimated to cost. Kept free of OSAL calls so it can
+                  also be built on the host.
+*******************************************************************************/
+
+#include "BaseED_energy.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint32 Energy_AddSat( uint32 a, uint32 b )
+{
+  return (a + b < a) ? 0xFFFFFFFFUL : a + b;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Energy_Init
+ *
+ * @brief   Clears the ledger and sets the state accounting starts from.
+ *
+ * @param   l        - ledger
+ * @param   now      - current time in ms
+ * @param   phase    - deviceState_t or ENERGY_PHASE_OTA
+ * @param   rxOn     - ZMacRxOnIdle
+ * @param   pollRate - poll interval in ms, 0 if not polling
+ *
+ * @return  none
+ */
+void Energy_Init( energyLedger_t *l, uint32 now, uint8 phase, uint8 rxOn, uint16 pollRate )
+{
+  Energy_Clear(l, now);
+  l->current = (phase < ENERGY_PHASES) ? phase : NON_COMMISSIONED;
+  l->rxOn = rxOn;
+  l->pollRate = pollRate;
+}
+
+/*********************************************************************
+ * @fn      Energy_Clear
+ *
+ * @brief   Zeroes all phases, the current state is kept.
+ *
+ * @param   l   - ledger
+ * @param   now - current time in ms
+ *
+ * @return  none
+ */
+void Energy_Clear( energyLedger_t *l, uint32 now )
+{
+  uint8 i;
+
+  for (i = 0; i < ENERGY_PHASES; ++i) {
+    l->phase[i].rxOnMs = 0;
+    l->phase[i].rxOffMs = 0;
+    l->phase[i].polls = 0;
+    l->phase[i].tx = 0;
+    l->phase[i].nvWrites = 0;
+  }
+  l->last = now;
+  l->pollCarry = 0;
+}
+
+/*********************************************************************
+ * @fn      Energy_Settle
+ *
+ * @brief   Charges the time since the last call to the current phase and
+ *          radio state. Called before every state change, and before the
+ *          ledger is read.
+ *
+ * @param   l   - ledger
+ * @param   now - current time in ms
+ *
+ * @return  none
+ */
+void Energy_Settle( energyLedger_t *l, uint32 now )
+{
+  energyPhase_t *p = &l->phase[l->current];
+  uint32 elapsed = now - l->last;
+
+  l->last = now;
+  if (l->rxOn) {
+    p->rxOnMs = Energy_AddSat(p->rxOnMs, elapsed);
+    return;
+  }
+
+  p->rxOffMs = Energy_AddSat(p->rxOffMs, elapsed);
+  if (l->pollRate) {
+    elapsed += l->pollCarry;
+    p->polls = Energy_AddSat(p->polls, elapsed / l->pollRate);
+    l->pollCarry = (uint16)(elapsed % l->pollRate);
+  }
+}
+
+/*********************************************************************
+ * @fn      Energy_SetPhase
+ *
+ * @brief   The application moved to another phase.
+ *
+ * @param   l     - ledger
+ * @param   now   - current time in ms
+ * @param   phase - deviceState_t or ENERGY_PHASE_OTA
+ *
+ * @return  none
+ */
+void Energy_SetPhase( energyLedger_t *l, uint32 now, uint8 phase )
+{
+  if (phase >= ENERGY_PHASES || phase == l->current) {
+    return;
+  }
+  Energy_Settle(l, now);
+  l->current = phase;
+}
+
+/*********************************************************************
+ * @fn      Energy_SetRxOnIdle
+ *
+ * @brief   The receiver was switched on or off while idle.
+ *
+ * @param   l    - ledger
+ * @param   now  - current time in ms
+ * @param   rxOn - new ZMacRxOnIdle
+ *
+ * @return  none
+ */
+void Energy_SetRxOnIdle( energyLedger_t *l, uint32 now, uint8 rxOn )
+{
+  rxOn = rxOn ? TRUE : FALSE;
+  if (rxOn == l->rxOn) {
+    return;
+  }
+  Energy_Settle(l, now);
+  l->rxOn = rxOn;
+}
+
+/*********************************************************************
+ * @fn      Energy_SetPollRate
+ *
+ * @brief   The poll interval changed.
+ *
+ * @param   l        - ledger
+ * @param   now      - current time in ms
+ * @param   pollRate - new poll interval in ms, 0 if not polling
+ *
+ * @return  none
+ */
+void Energy_SetPollRate( energyLedger_t *l, uint32 now, uint16 pollRate )
+{
+  if (pollRate == l->pollRate) {
+    return;
+  }
+  Energy_Settle(l, now);
+  l->pollRate = pollRate;
+  l->pollCarry = 0;
+}
+
+/*********************************************************************
+ * @fn      Energy_Tx
+ *
+ * @brief   A frame was sent.
+ *
+ * @param   l - ledger
+ *
+ * @return  none
+ */
+void Energy_Tx( energyLedger_t *l )
+{
+  if (l->phase[l->current].tx < 0xFFFF) {
+    ++l->phase[l->current].tx;
+  }
+}
+
+/*********************************************************************
+ * @fn      Energy_NvWrite
+ *
+ * @brief   An NV item was written.
+ *
+ * @param   l - ledger
+ *
+ * @return  none
+ */
+void Energy_NvWrite( energyLedger_t *l )
+{
+  if (l->phase[l->current].nvWrites < 0xFFFF) {
+    ++l->phase[l->current].nvWrites;
+  }
+}
+
+/*********************************************************************
+ * @fn      Energy_Charge
+ *
+ * @brief   Estimated charge a phase has cost so far.
+ *
+ * @param   p - phase
+ *
+ * @return  charge in uC, saturates at 0xFFFFFFFF (about 1.2 Ah)
+ */
+uint32 Energy_Charge( const energyPhase_t *p )
+{
+  uint32 charge = 0;
+
+  if (p->rxOnMs > 0xFFFFFFFFUL / ENERGY_RX_CURRENT_MA) {
+    return 0xFFFFFFFFUL;
+  }
+  charge = Energy_AddSat(charge, p->rxOnMs * ENERGY_RX_CURRENT_MA);
+  charge = Energy_AddSat(charge, (p->rxOffMs / 1000) * ENERGY_SLEEP_CURRENT_UA);
+  charge = Energy_AddSat(charge, p->polls * ENERGY_POLL_CHARGE_UC);
+  charge = Energy_AddSat(charge, (uint32)p->tx * ENERGY_TX_CHARGE_UC);
+  charge = Energy_AddSat(charge, (uint32)p->nvWrites * ENERGY_NV_WRITE_CHARGE_UC);
+  return charge;
+}
@@ -0,0 +1,76 @@
+#ifndef BaseED_ENERGY_H
+#define BaseED_ENERGY_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the energy ledger. Radio on time, radio off (sleep)
+time, polls, transmissions and NV writes are accounted to the phase the
+application is in: one per deviceState_t plus one for OTA. The caller
+reports every change of ZMacRxOnIdle, of the poll rate and of the phase
+along with the current time in ms; the ledger charges the time since
+the previous change to the state that held until then.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define ENERGY_PHASE_OTA                  (DEVICE_ACTIVE + 1)
+#define ENERGY_PHASES                     (ENERGY_PHASE_OTA + 1)
+
+// Charge estimates for a CC2530 end device, override them per board
+#ifndef ENERGY_RX_CURRENT_MA
+#define ENERGY_RX_CURRENT_MA              24    // receiver on
+#endif
+#ifndef ENERGY_SLEEP_CURRENT_UA
+#define ENERGY_SLEEP_CURRENT_UA           3     // PM2 between polls
+#endif
+#ifndef ENERGY_POLL_CHARGE_UC
+#define ENERGY_POLL_CHARGE_UC             60    // data request, ack and receive window
+#endif
+#ifndef ENERGY_TX_CHARGE_UC
+#define ENERGY_TX_CHARGE_UC               120   // CSMA, frame and ack
+#endif
+#ifndef ENERGY_NV_WRITE_CHARGE_UC
+#define ENERGY_NV_WRITE_CHARGE_UC         150   // flash write, now and then a page compaction
+#endif
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct energyPhase
+{
+  uint32 rxOnMs;        // time with the receiver on
+  uint32 rxOffMs;       // time asleep between polls
+  uint32 polls;         // estimated from rxOffMs and the poll rate
+  uint16 tx;            // frames sent
+  uint16 nvWrites;      // NV items written, application and stack
+} energyPhase_t;
+
+typedef struct energyLedger
+{
+  energyPhase_t phase[ENERGY_PHASES];
+  uint32 last;          // time the ledger was last settled
+  uint16 pollRate;      // poll interval in ms, 0 if not polling
+  uint16 pollCarry;     // rx off ms not yet worth a whole poll
+  uint8  rxOn;          // ZMacRxOnIdle
+  uint8  current;       // phase being accounted
+} energyLedger_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Energy_Init( energyLedger_t *l, uint32 now, uint8 phase, uint8 rxOn, uint16 pollRate );
+void Energy_Clear( energyLedger_t *l, uint32 now );
+void Energy_Settle( energyLedger_t *l, uint32 now );
+void Energy_SetPhase( energyLedger_t *l, uint32 now, uint8 phase );
+void Energy_SetRxOnIdle( energyLedger_t *l, uint32 now, uint8 rxOn );
+void Energy_SetPollRate( energyLedger_t *l, uint32 now, uint16 pollRate );
+void Energy_Tx( energyLedger_t *l );
+void Energy_NvWrite( energyLedger_t *l );
+uint32 Energy_Charge( const energyPhase_t *p );
+
+#endif
@@ -0,0 +1,354 @@
+/*******************************************************************************
+  Filename:       BaseED_interpan.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Windowed inter-PAN 'init' queries to the coordinators found
+                  by the commissioning scan. Commissioning time scales with
+                  the number of channels instead of the number of PANs.
+*******************************************************************************/
+
+/**************************************************************************************************
+ *                                             INCLUDES
+ **************************************************************************************************/
+#include "OSAL.h"
+#include "OSAL_Clock.h"
+#include "OSAL_Nv.h"
+#include "AF.h"
+#include "ZDApp.h"
+
+#include "BaseED.h"
+#include "BaseED_support.h"
+#include "BaseED_interpan.h"
+#include "BaseED_trace.h"
+
+#include "MT_UART.h"
+#include "MT_RPC.h"
+#include "stub_aps.h"
+
+/**************************************************************************************************
+ *                                            CONSTANTS
+ **************************************************************************************************/
+#define INTERPAN_QUERY_PENDING      0
+#define INTERPAN_QUERY_OUTSTANDING  1
+#define INTERPAN_QUERY_DONE         2   // timed out
+#define INTERPAN_QUERY_ANSWERED     3
+
+/**************************************************************************************************
+ *                                            LOCAL
+ **************************************************************************************************/
+static const NWInfo_t *queryPans;
+static uint8 queryCount = 0;
+
+// PAN table indices in the order they are queried, grouped by channel
+static uint8 queryOrder[MAX_PANS_SCANNED];
+static uint8 queryState[MAX_PANS_SCANNED];
+static uint32 querySentAt[MAX_PANS_SCANNED];
+
+// The channel group currently being queried is queryOrder[groupStart..groupEnd)
+static uint8 groupStart;
+static uint8 groupEnd;
+static uint8 queryBusy = FALSE;
+
+extern const endPointDesc_t BaseED_epDesc;
+
+/**************************************************************************************************
+ *                                        FUNCTIONS - Local
+ **************************************************************************************************/
+static uint8 InterPanQuery_ChannelNumber(uint32 channelBit);
+static void InterPanQuery_OpenGroup(void);
+static void InterPanQuery_SendInitReq(uint8 idx);
+
+/*********************************************************************
+ * @fn      InterPanQuery_Start
+ *
+ * @brief   Starts querying every PAN in the table for its coordinator
+ *          info. Call InterPanQuery_Process() after the returned delay.
+ *
+ * @param   pans  - PAN table (nv_pan_info_array), must stay valid until done
+ * @param   count - number of valid entries in pans
+ *
+ * @return  worst case duration of the whole query in ms, to be used as
+ *          the gather timeout
+ */
+uint16 InterPanQuery_Start( const NWInfo_t *pans, uint8 count )
+{
+  uint16 worstCase = 0;
+  uint8 groupSize = 0;
+  uint8 i, j;
+
+  if (count > MAX_PANS_SCANNED) {
+    count = MAX_PANS_SCANNED;
+  }
+  queryPans = pans;
+  queryCount = count;
+
+  // Insertion sort on the channel keeps the scan (LQI) order within a channel
+  for (i = 0; i < count; ++i) {
+    uint8 idx = i;
+    j = i;
+    while (j > 0 && pans[queryOrder[j - 1]].channel > pans[idx].channel) {
+      queryOrder[j] = queryOrder[j - 1];
+      --j;
+    }
+    queryOrder[j] = idx;
+    queryState[i] = INTERPAN_QUERY_PENDING;
+  }
+
+  // Each channel costs one request spacing per PAN plus a timeout for every
+  // window that may go unanswered
+  for (i = 0; i < count; ++i) {
+    ++groupSize;
+    if (i + 1 == count || pans[queryOrder[i + 1]].channel != pans[queryOrder[i]].channel) {
+      worstCase += groupSize * INTERPAN_QUERY_SPACING;
+      worstCase += ((groupSize + INTERPAN_QUERY_WINDOW - 1) / INTERPAN_QUERY_WINDOW) * INTERPAN_QUERY_TIMEOUT;
+      groupSize = 0;
+    }
+  }
+
+  StubAPS_RegisterApp((endPointDesc_t *)&BaseED_epDesc);
+
+  groupStart = groupEnd = 0;
+  queryBusy = (count > 0);
+  return worstCase + PRESENCE_SEND_INTER_PAN_INIT_TIMER;
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_Process
+ *
+ * @brief   Advances the query: times out silent coordinators, sends the
+ *          next requests of the current channel and moves on to the next
+ *          channel once every PAN on this one is done.
+ *
+ * @param   none
+ *
+ * @return  ms until InterPanQuery_Process() wants to run again, 0 when
+ *          all PANs have been queried
+ */
+uint16 InterPanQuery_Process( void )
+{
+  uint32 now = osal_GetSystemClock();
+  uint32 nextTimeout = INTERPAN_QUERY_TIMEOUT;
+  uint8 outstanding = 0;
+  uint8 pending = 0;
+  uint8 i;
+
+  if (!queryBusy) {
+    return 0;
+  }
+
+  for (;;) {
+    if (groupStart == groupEnd) {
+      if (groupEnd == queryCount) {
+        #ifdef INTER_PAN
+        StubAPS_SetIntraPanChannel();
+        #endif //INTER_PAN
+        queryBusy = FALSE;
+        return 0;
+      }
+      InterPanQuery_OpenGroup();
+    }
+
+    outstanding = pending = 0;
+    for (i = groupStart; i < groupEnd; ++i) {
+      uint8 idx = queryOrder[i];
+      if (queryState[idx] == INTERPAN_QUERY_OUTSTANDING) {
+        uint32 elapsed = now - querySentAt[idx];
+        if (elapsed >= INTERPAN_QUERY_TIMEOUT) {
+          queryState[idx] = INTERPAN_QUERY_DONE;
+          APP_TRACE1(TRC_INTERPAN_TIMEOUT, queryPans[idx].panID);
+        }
+        else {
+          ++outstanding;
+          if (INTERPAN_QUERY_TIMEOUT - elapsed < nextTimeout) {
+            nextTimeout = INTERPAN_QUERY_TIMEOUT - elapsed;
+          }
+        }
+      }
+      else if (queryState[idx] == INTERPAN_QUERY_PENDING) {
+        ++pending;
+      }
+    }
+
+    if (outstanding == 0 && pending == 0) {
+      // Channel finished, go straight on with the next one
+      groupStart = groupEnd;
+      continue;
+    }
+    break;
+  }
+
+  if (pending > 0 && outstanding < INTERPAN_QUERY_WINDOW) {
+    for (i = groupStart; i < groupEnd; ++i) {
+      uint8 idx = queryOrder[i];
+      if (queryState[idx] == INTERPAN_QUERY_PENDING) {
+        InterPanQuery_SendInitReq(idx);
+        queryState[idx] = INTERPAN_QUERY_OUTSTANDING;
+        querySentAt[idx] = now;
+        break;
+      }
+    }
+    return INTERPAN_QUERY_SPACING;
+  }
+
+  return (nextTimeout > 0) ? (uint16)nextTimeout : 1;
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_ResponseReceived
+ *
+ * @brief   Marks the query to panid as answered.
+ *
+ * @param   panid - PAN id the coordinator info came from
+ *
+ * @return  TRUE if it answered an outstanding query, in which case
+ *          InterPanQuery_Process() should be run right away
+ */
+uint8 InterPanQuery_ResponseReceived( uint16 panid )
+{
+  uint8 i;
+
+  if (!queryBusy) {
+    return FALSE;
+  }
+
+  for (i = groupStart; i < groupEnd; ++i) {
+    uint8 idx = queryOrder[i];
+    if (queryPans[idx].panID == panid && queryState[idx] == INTERPAN_QUERY_OUTSTANDING) {
+      queryState[idx] = INTERPAN_QUERY_ANSWERED;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_Answered
+ *
+ * @brief   Tells whether the coordinator of a PAN answered the last query,
+ *          valid until the next InterPanQuery_Start().
+ *
+ * @param   idx - PAN table index
+ *
+ * @return  TRUE if it answered
+ */
+uint8 InterPanQuery_Answered( uint8 idx )
+{
+  return (idx < queryCount && queryState[idx] == INTERPAN_QUERY_ANSWERED);
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_Busy
+ *
+ * @brief   Tells whether a query is running. The frames sent meanwhile
+ *          go to the coordinators of other PANs, and the radio may be on
+ *          another channel than our parent's.
+ *
+ * @param   none
+ *
+ * @return  TRUE from InterPanQuery_Start() until the last PAN is done
+ *          or InterPanQuery_Stop()
+ */
+uint8 InterPanQuery_Busy( void )
+{
+  return queryBusy;
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_Stop
+ *
+ * @brief   Gives up on the coordinators that haven't answered yet and
+ *          puts the radio back on our own PAN channel.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+void InterPanQuery_Stop( void )
+{
+  if (queryBusy) {
+    #ifdef INTER_PAN
+    StubAPS_SetIntraPanChannel();
+    #endif //INTER_PAN
+    queryBusy = FALSE;
+  }
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_ChannelNumber
+ *
+ * @brief   We store channel using a bit in a 32 bit field, StubAPS
+ *          requires it as an 8 bit integer.
+ *
+ * @param   channelBit - channel mask
+ *
+ * @return  channel number
+ */
+static uint8 InterPanQuery_ChannelNumber(uint32 channelBit)
+{
+  uint8 channel = 0;
+  while (channelBit & 0xFFFFFFFE) {
+    channelBit = channelBit >> 1;
+    ++channel;
+  }
+  return channel;
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_OpenGroup
+ *
+ * @brief   Extends the current group over all PANs sharing the channel
+ *          at groupStart and switches the radio to that channel.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void InterPanQuery_OpenGroup(void)
+{
+  uint32 channelBit = queryPans[queryOrder[groupStart]].channel;
+
+  groupEnd = groupStart;
+  while (groupEnd < queryCount && queryPans[queryOrder[groupEnd]].channel == channelBit) {
+    ++groupEnd;
+  }
+
+  ZStatus_t chanResult = StubAPS_SetInterPanChannel(InterPanQuery_ChannelNumber(channelBit));
+  APP_TRACE1(TRC_CHANNEL_CHANGE, chanResult);
+}
+
+/*********************************************************************
+ * @fn      InterPanQuery_SendInitReq
+ *
+ * @brief   Asks the coordinator of queryPans[idx] to send us its 'info'
+ *          packet. Which is nothing but a UD-MT packet.
+ *
+ * @param   idx - PAN table index
+ *
+ * @return  none
+ */
+static void InterPanQuery_SendInitReq(uint8 idx)
+{
+  uint16 devicePan;
+  osal_nv_read( ZCD_NV_PANID, 0, sizeof( devicePan ), &devicePan );
+
+  uint8 initreq[7];
+  initreq[0] = MT_SOF;
+  initreq[1] = 0x02;
+  initreq[2] = 0x2B;
+  initreq[3] = 0x08;
+  initreq[4] = LO_UINT16(devicePan);
+  initreq[5] = HI_UINT16(devicePan);
+  initreq[6] = CalcFCS(initreq+1, MT_UD_HDR_LEN + 2);
+
+  APP_TRACE1(TRC_INTERPAN_INIT, queryPans[idx].panID);
+
+  #ifdef INTER_PAN
+  BaseED_SendInterPan(CORECOMMS_CLUSTER, END_DEVICE_MESSAGE_TYPE_OTA_MT_REQ,
+              0,
+              queryPans[idx].panID,
+              queryPans[idx].address,
+              7,
+              initreq);
+  #endif //INTER_PAN
+}
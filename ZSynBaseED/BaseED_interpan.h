@@ -0,0 +1,35 @@
+#ifndef BaseED_INTERPAN_H
+#define BaseED_INTERPAN_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the windowed inter-PAN coordinator info queries sent
+while commissioning. The PANs found by the scan are grouped by channel
+so the radio only hops once per channel, and up to
+INTERPAN_QUERY_WINDOW 'init' requests are kept outstanding on it.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Number of 'init' requests outstanding at the same time on a channel
+#define INTERPAN_QUERY_WINDOW               4
+// Spacing between two requests so we don't flood the MAC queue, in ms
+#define INTERPAN_QUERY_SPACING              20
+// A coordinator that hasn't answered within this many ms is given up on
+#define INTERPAN_QUERY_TIMEOUT              1500
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+uint16 InterPanQuery_Start( const NWInfo_t *pans, uint8 count );
+uint16 InterPanQuery_Process( void );
+uint8 InterPanQuery_ResponseReceived( uint16 panid );
+uint8 InterPanQuery_Answered( uint8 idx );
+uint8 InterPanQuery_Busy( void );
+void InterPanQuery_Stop( void );
+
+#endif
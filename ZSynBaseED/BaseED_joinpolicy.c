@@ -0,0 +1,104 @@
+/*******************************************************************************
+  Filename:       BaseED_joinpolicy.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Weighted scoring of the PANs found during commissioning.
+                  Kept free of OSAL calls so it can also be built on the host.
+*******************************************************************************/
+
+#include "BaseED_joinpolicy.h"
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      JoinPolicy_ChannelOccupancy
+ *
+ * @brief   How busy the channel of pans[idx] looks, counted as the number
+ *          of other discovered PANs sharing that channel plus one for every
+ *          JOIN_POLICY_ENERGY_PER_PAN of energy detected on it.
+ *
+ * @param   pans  - PAN table (nv_pan_info_array)
+ * @param   count - number of valid entries in pans
+ * @param   idx   - entry to compute the occupancy for
+ *
+ * @return  occupancy metric
+ */
+uint16 JoinPolicy_ChannelOccupancy( const NWInfo_t *pans, uint8 count, uint8 idx )
+{
+  uint16 occupancy = pans[idx].energy / JOIN_POLICY_ENERGY_PER_PAN;
+  uint8 i;
+
+  for (i = 0; i < count; ++i) {
+    if (i != idx && pans[i].panID != 0 && pans[i].channel == pans[idx].channel) {
+      ++occupancy;
+    }
+  }
+  return occupancy;
+}
+
+/*********************************************************************
+ * @fn      JoinPolicy_Score
+ *
+ * @brief   Weighted score of pans[idx]. Higher is better.
+ *
+ * @param   weights - weights to apply
+ * @param   pans    - PAN table
+ * @param   count   - number of valid entries in pans
+ * @param   idx     - entry to score
+ *
+ * @return  score, at least JOIN_POLICY_MIN_SCORE if only LQI and
+ *          associated devices are weighted
+ */
+int32 JoinPolicy_Score( const joinPolicyWeights_t *weights, const NWInfo_t *pans, uint8 count, uint8 idx )
+{
+  const NWInfo_t *pan = &pans[idx];
+  int32 score;
+
+  score  = (int32)weights->lqi    * pan->lqi;
+  score += (int32)weights->rssi   * pan->rssi;
+  score += (int32)weights->nassoc * pan->nassoc;
+  score += (int32)weights->drate  * pan->drate;
+  score += (int32)weights->chanOcc * JoinPolicy_ChannelOccupancy(pans, count, idx);
+
+  if (weights->rssi == 0 && weights->drate == 0 && weights->chanOcc == 0 &&
+      score < JOIN_POLICY_MIN_SCORE) {
+    return JOIN_POLICY_MIN_SCORE;
+  }
+  return score;
+}
+
+/*********************************************************************
+ * @fn      JoinPolicy_SelectPan
+ *
+ * @brief   Picks the best scoring PAN. On a tie the earlier entry wins,
+ *          which is the one with the higher LQI since the table is sorted.
+ *
+ * @param   weights - weights to apply
+ * @param   pans    - PAN table
+ * @param   count   - number of valid entries in pans
+ *
+ * @return  index of the chosen PAN, JOIN_POLICY_NO_PAN if there is none
+ */
+uint8 JoinPolicy_SelectPan( const joinPolicyWeights_t *weights, const NWInfo_t *pans, uint8 count )
+{
+  uint8 best = JOIN_POLICY_NO_PAN;
+  int32 bestScore = 0;
+  uint8 i;
+
+  for (i = 0; i < count; ++i) {
+    if (pans[i].panID == 0) {
+      continue;
+    }
+
+    int32 score = JoinPolicy_Score(weights, pans, count, i);
+    if (best == JOIN_POLICY_NO_PAN || score > bestScore) {
+      best = i;
+      bestScore = score;
+    }
+  }
+  return best;
+}
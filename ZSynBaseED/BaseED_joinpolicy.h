@@ -0,0 +1,58 @@
+#ifndef BaseED_JOINPOLICY_H
+#define BaseED_JOINPOLICY_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the weighted join policy. The scoring code has no OSAL
+dependencies so that tools/joinpolicy_eval.c can replay recorded scan
+tables through exactly the same arithmetic as the end device.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Returned by JoinPolicy_SelectPan() when no usable PAN is in the table
+#define JOIN_POLICY_NO_PAN                0xFF
+
+// Lowest score of the original two term "lqi - nassoc * 4" form, which
+// clamped at 1 so that PANs whose costs outweigh their LQI tie and the
+// one with the higher LQI wins. Other weights, such as RSSI in negative
+// dBm, rank on the whole range.
+#define JOIN_POLICY_MIN_SCORE             1
+
+// Energy detected on a channel counts as one more PAN on it per this much
+#define JOIN_POLICY_ENERGY_PER_PAN        32
+
+// Default weights reproduce the original "lqi - nassoc * 4" policy
+#define JOIN_POLICY_WEIGHT_LQI_DEFAULT      1
+#define JOIN_POLICY_WEIGHT_RSSI_DEFAULT     0
+#define JOIN_POLICY_WEIGHT_NASSOC_DEFAULT  -4
+#define JOIN_POLICY_WEIGHT_DRATE_DEFAULT    0
+#define JOIN_POLICY_WEIGHT_CHANOCC_DEFAULT  0
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Every candidate PAN gets score = sum(weight * metric). Costs such as the
+// number of associated devices are expressed with negative weights.
+typedef struct joinPolicyWeights
+{
+  int16 lqi;        // per unit of beacon LQI
+  int16 rssi;       // per dBm reported by the coordinator
+  int16 nassoc;     // per device already associated with the coordinator
+  int16 drate;      // per byte/sample of coordinator data rate
+  int16 chanOcc;    // per unit of channel occupancy, see JoinPolicy_ChannelOccupancy()
+} joinPolicyWeights_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+uint16 JoinPolicy_ChannelOccupancy( const NWInfo_t *pans, uint8 count, uint8 idx );
+int32 JoinPolicy_Score( const joinPolicyWeights_t *weights, const NWInfo_t *pans, uint8 count, uint8 idx );
+uint8 JoinPolicy_SelectPan( const joinPolicyWeights_t *weights, const NWInfo_t *pans, uint8 count );
+
+#endif
@@ -0,0 +1,125 @@
+/*******************************************************************************
+  Filename:       BaseED_lzss.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Streaming LZSS decoder for compressed OTA images.
+*******************************************************************************/
+
+#include "BaseED_lzss.h"
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Lzss_Init
+ *
+ * @brief   Starts decoding a new stream.
+ *
+ * @param   z - decoder to initialize
+ *
+ * @return  none
+ */
+void Lzss_Init( lzss_t *z )
+{
+  uint16 i;
+
+  // The packer never refers back before the start, zero it all the same
+  for (i = 0; i < LZSS_WINDOW; ++i) {
+    z->window[i] = 0;
+  }
+  z->pos = 0;
+  z->flags = 0;
+  z->flagBits = 0;
+  z->lo = 0;
+  z->haveLo = FALSE;
+  z->matchDist = 0;
+  z->matchLen = 0;
+  z->out = 0;
+}
+
+/*********************************************************************
+ * @fn      Lzss_Decode
+ *
+ * @brief   Decodes as much of in as fits into out. Call again with the
+ *          rest of the input, if any, once out has been written away;
+ *          with inLen 0 it finishes a back reference still being copied.
+ *
+ * @param   z      - decoder
+ * @param   in     - compressed input
+ * @param   inLen  - bytes of input
+ * @param   used   - set to the bytes of input consumed
+ * @param   out    - decoded output
+ * @param   outMax - room in out
+ *
+ * @return  bytes written to out
+ */
+uint16 Lzss_Decode( lzss_t *z, const uint8 *in, uint16 inLen, uint16 *used, uint8 *out, uint16 outMax )
+{
+  uint16 n = 0;
+  uint16 i = 0;
+  uint8 c;
+
+  for (;;) {
+    // Copy out the back reference in progress first
+    while (z->matchLen && n < outMax) {
+      c = z->window[(z->pos - z->matchDist) & (LZSS_WINDOW - 1)];
+      z->window[z->pos] = c;
+      z->pos = (z->pos + 1) & (LZSS_WINDOW - 1);
+      out[n++] = c;
+      --z->matchLen;
+    }
+    if (z->matchLen || n >= outMax || i >= inLen) {
+      break;
+    }
+
+    if (z->flagBits == 0) {
+      z->flags = in[i++];
+      z->flagBits = 8;
+      continue;
+    }
+
+    if (z->haveLo) {
+      c = in[i++];
+      z->haveLo = FALSE;
+      z->matchDist = (((uint16)(c & 0x80) << 1) | z->lo) + 1;
+      z->matchLen = (c & 0x7F) + LZSS_MIN_MATCH;
+      z->flags >>= 1;
+      --z->flagBits;
+    }
+    else if (z->flags & 1) {
+      c = in[i++];
+      z->window[z->pos] = c;
+      z->pos = (z->pos + 1) & (LZSS_WINDOW - 1);
+      out[n++] = c;
+      z->flags >>= 1;
+      --z->flagBits;
+    }
+    else {
+      z->lo = in[i++];
+      z->haveLo = TRUE;
+    }
+  }
+
+  z->out += n;
+  *used = i;
+  return n;
+}
+
+/*********************************************************************
+ * @fn      Lzss_Idle
+ *
+ * @brief   Whether the decoder is between items, which is where a
+ *          complete stream ends. Unused flag bits of the last flag
+ *          byte don't count.
+ *
+ * @param   z - decoder
+ *
+ * @return  TRUE if no item is partly decoded
+ */
+uint8 Lzss_Idle( const lzss_t *z )
+{
+  return (!z->haveLo && z->matchLen == 0);
+}
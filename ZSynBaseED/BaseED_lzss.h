@@ -0,0 +1,54 @@
+#ifndef BaseED_LZSS_H
+#define BaseED_LZSS_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the streaming LZSS decoder of compressed OTA images.
+The stream is a flag byte followed by up to eight items, one per flag
+bit starting with the least significant: a set bit is a literal byte, a
+clear bit a back reference of two bytes. The low byte and the top bit
+of the second byte give the distance back into the output less one,
+the other seven bits the length less LZSS_MIN_MATCH. The window is
+LZSS_WINDOW bytes, so decoding needs that much RAM and nothing more.
+Input can be fed in pieces of any size, as blocks arrive; a token split
+across two pieces carries over. tools/lzss_pack.c writes this format.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Back references reach this far, fixed by the nine bit distance
+#define LZSS_WINDOW                         512
+
+// Shortest and longest back reference
+#define LZSS_MIN_MATCH                      3
+#define LZSS_MAX_MATCH                      (LZSS_MIN_MATCH + 0x7F)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct lzss
+{
+  uint8  window[LZSS_WINDOW];
+  uint16 pos;           // where the next output byte goes in window
+  uint8  flags;         // flag byte being worked through
+  uint8  flagBits;      // items left under flags
+  uint8  lo;            // first byte of a back reference, if haveLo
+  uint8  haveLo;
+  uint16 matchDist;     // back reference being copied out
+  uint8  matchLen;      // bytes of it left to copy
+  uint32 out;           // bytes decoded so far
+} lzss_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Lzss_Init( lzss_t *z );
+uint16 Lzss_Decode( lzss_t *z, const uint8 *in, uint16 inLen, uint16 *used, uint8 *out, uint16 outMax );
+uint8 Lzss_Idle( const lzss_t *z );
+
+#endif
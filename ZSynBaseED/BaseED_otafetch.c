@@ -0,0 +1,309 @@
+/*******************************************************************************
+  Filename:       BaseED_otafetch.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Windowed OTA block fetch: several block requests in flight,
+                  a deadline per request and a window that adapts to loss.
+*******************************************************************************/
+
+#include "BaseED_otafetch.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint8 OtaFetch_IsOutstanding( const otaFetch_t *f, uint16 block )
+{
+  uint8 i;
+
+  for (i = 0; i < OTA_FETCH_WINDOW_MAX; ++i) {
+    if (f->slot[i].block != OTA_FETCH_NONE &&
+        block >= f->slot[i].block && block - f->slot[i].block < f->slot[i].count) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Frees the slot of the request for the block starting at block
+static uint8 OtaFetch_Free( otaFetch_t *f, uint16 block )
+{
+  uint8 i;
+
+  for (i = 0; i < OTA_FETCH_WINDOW_MAX; ++i) {
+    if (f->slot[i].block == block) {
+      f->slot[i].block = OTA_FETCH_NONE;
+      --f->outstanding;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      OtaFetch_Init
+ *
+ * @brief   Starts a fetch with nothing outstanding. The window starts
+ *          small and opens up as blocks come in.
+ *
+ * @param   f         - fetch to initialize
+ * @param   windowMax - most requests outstanding, up to OTA_FETCH_WINDOW_MAX
+ * @param   timeout   - ms to wait for a block before requesting it again
+ * @param   now       - current time in ms
+ *
+ * @return  none
+ */
+void OtaFetch_Init( otaFetch_t *f, uint8 windowMax, uint16 timeout, uint32 now )
+{
+  uint8 i;
+
+  for (i = 0; i < OTA_FETCH_WINDOW_MAX; ++i) {
+    f->slot[i].block = OTA_FETCH_NONE;
+  }
+  if (windowMax == 0) {
+    windowMax = 1;
+  }
+  f->windowMax = (windowMax > OTA_FETCH_WINDOW_MAX) ? OTA_FETCH_WINDOW_MAX : windowMax;
+  f->window = (f->windowMax < 2) ? f->windowMax : 2;
+  f->timeout = timeout ? timeout : 1;
+  f->cursor = 0;
+  f->outstanding = 0;
+  f->credit = 0;
+  f->units = 1;
+  f->unitsMax = 1;
+  f->link = OTA_FETCH_LINK_FAIR;
+  f->lastProgress = now;
+  f->requests = 0;
+  f->received = 0;
+  f->timeouts = 0;
+  f->corrupt = 0;
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_SetUnits
+ *
+ * @brief   Sets the block size the fetch starts with, and how large
+ *          blocks may get.
+ *
+ * @param   f        - fetch
+ * @param   units    - units per block to start with
+ * @param   unitsMax - most units per block
+ *
+ * @return  none
+ */
+void OtaFetch_SetUnits( otaFetch_t *f, uint8 units, uint8 unitsMax )
+{
+  f->unitsMax = unitsMax ? unitsMax : 1;
+  f->units = (units == 0) ? 1 : (units > f->unitsMax) ? f->unitsMax : units;
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_SetLink
+ *
+ * @brief   Tells the fetch how the link looks. Blocks only grow on a
+ *          good link; a poor one gets single unit blocks right away.
+ *
+ * @param   f    - fetch
+ * @param   link - OTA_FETCH_LINK_POOR, OTA_FETCH_LINK_FAIR or
+ *                 OTA_FETCH_LINK_GOOD
+ *
+ * @return  none
+ */
+void OtaFetch_SetLink( otaFetch_t *f, uint8 link )
+{
+  f->link = link;
+  if (link == OTA_FETCH_LINK_POOR) {
+    f->units = 1;
+  }
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_Next
+ *
+ * @brief   Picks the next block to request if the window has room. The
+ *          search carries on after the last block requested and wraps
+ *          around, so blocks whose request timed out come up again.
+ *
+ * @param   f           - fetch
+ * @param   now         - current time in ms
+ * @param   nextMissing - finds the missing units
+ * @param   count       - set to the units of the block, up to f->units
+ *                        missing units that aren't requested yet
+ *
+ * @return  first unit of the block to request now, OTA_FETCH_NONE if
+ *          the window is full or every missing unit is already requested
+ */
+uint16 OtaFetch_Next( otaFetch_t *f, uint32 now, otaFetchNextMissing_t nextMissing, uint8 *count )
+{
+  uint16 start = f->cursor;
+  uint16 from = start;
+  uint8 wrapped = FALSE;
+  uint16 block;
+  uint8 i;
+
+  if (f->outstanding >= f->window) {
+    return OTA_FETCH_NONE;
+  }
+
+  for (;;) {
+    block = nextMissing(from);
+    if (wrapped && (block == OTA_FETCH_NONE || block >= start)) {
+      return OTA_FETCH_NONE;
+    }
+    if (block == OTA_FETCH_NONE) {
+      if (start == 0) {
+        return OTA_FETCH_NONE;
+      }
+      wrapped = TRUE;
+      from = 0;
+      continue;
+    }
+    if (!OtaFetch_IsOutstanding(f, block)) {
+      break;
+    }
+    from = block + 1;
+  }
+
+  // The block takes in the missing units that follow, as far as allowed
+  *count = 1;
+  while (*count < f->units && block + *count < OTA_FETCH_NONE &&
+         nextMissing(block + *count) == block + *count &&
+         !OtaFetch_IsOutstanding(f, block + *count)) {
+    ++*count;
+  }
+
+  for (i = 0; f->slot[i].block != OTA_FETCH_NONE; ++i)
+    ;
+  f->slot[i].block = block;
+  f->slot[i].count = *count;
+  f->slot[i].deadline = now + f->timeout;
+  ++f->outstanding;
+  ++f->requests;
+  f->cursor = block + *count;
+  return block;
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_Received
+ *
+ * @brief   A block came in. Frees its slot and opens the window by one
+ *          for every window's worth of blocks received; once the window
+ *          is fully open, and the link is good, blocks get a unit larger
+ *          instead. Only blocks still outstanding count, a late answer to
+ *          a request that already timed out or a multicast block nobody
+ *          asked for says nothing about what the window can carry.
+ *
+ * @param   f     - fetch
+ * @param   block - first unit of the block received
+ * @param   now   - current time in ms
+ *
+ * @return  TRUE if the block had been requested and was still outstanding
+ */
+uint8 OtaFetch_Received( otaFetch_t *f, uint16 block, uint32 now )
+{
+  ++f->received;
+  f->lastProgress = now;
+  if (!OtaFetch_Free(f, block)) {
+    return FALSE;
+  }
+  if (++f->credit >= f->window) {
+    f->credit = 0;
+    if (f->window < f->windowMax) {
+      ++f->window;
+    }
+    else if (f->link == OTA_FETCH_LINK_GOOD && f->units < f->unitsMax) {
+      ++f->units;
+    }
+  }
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_Corrupt
+ *
+ * @brief   A block came in damaged. Frees its slot and has the next
+ *          search start at it, so it is requested again straight away
+ *          instead of after its deadline. The link did deliver, so the
+ *          window stays as it is.
+ *
+ * @param   f     - fetch
+ * @param   block - first unit of the block that failed its check
+ *
+ * @return  TRUE if the block had been requested and was still outstanding
+ */
+uint8 OtaFetch_Corrupt( otaFetch_t *f, uint16 block )
+{
+  ++f->corrupt;
+  f->cursor = block;
+  return OtaFetch_Free(f, block);
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_Expire
+ *
+ * @brief   Gives up on the requests past their deadline, their blocks
+ *          are still missing and get requested again. Any loss halves
+ *          the window and the block size.
+ *
+ * @param   f   - fetch
+ * @param   now - current time in ms
+ *
+ * @return  number of requests that timed out
+ */
+uint8 OtaFetch_Expire( otaFetch_t *f, uint32 now )
+{
+  uint8 expired = 0;
+  uint8 i;
+
+  for (i = 0; i < OTA_FETCH_WINDOW_MAX; ++i) {
+    if (f->slot[i].block != OTA_FETCH_NONE && (int32)(f->slot[i].deadline - now) <= 0) {
+      f->slot[i].block = OTA_FETCH_NONE;
+      --f->outstanding;
+      ++expired;
+    }
+  }
+
+  if (expired) {
+    f->timeouts += expired;
+    f->window = (f->window > 1) ? f->window / 2 : 1;
+    f->units = (f->units > 1) ? f->units / 2 : 1;
+    f->credit = 0;
+  }
+  return expired;
+}
+
+/*********************************************************************
+ * @fn      OtaFetch_TimeToDeadline
+ *
+ * @brief   Time until the first outstanding request expires.
+ *
+ * @param   f   - fetch
+ * @param   now - current time in ms
+ *
+ * @return  ms, 0 if a request is already due, 0xFFFFFFFF if nothing is
+ *          outstanding
+ */
+uint32 OtaFetch_TimeToDeadline( const otaFetch_t *f, uint32 now )
+{
+  uint32 wait = 0xFFFFFFFFUL;
+  uint8 i;
+
+  for (i = 0; i < OTA_FETCH_WINDOW_MAX; ++i) {
+    if (f->slot[i].block != OTA_FETCH_NONE) {
+      int32 left = (int32)(f->slot[i].deadline - now);
+      if (left <= 0) {
+        return 0;
+      }
+      if ((uint32)left < wait) {
+        wait = left;
+      }
+    }
+  }
+  return wait;
+}
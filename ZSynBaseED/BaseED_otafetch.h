@@ -0,0 +1,85 @@
+#ifndef BaseED_OTAFETCH_H
+#define BaseED_OTAFETCH_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the windowed OTA block fetch. Up to a window of block
+requests are kept outstanding, each with its own deadline; a block that
+arrives frees its slot straight away so the next request can go out.
+The window grows by one for every window's worth of blocks received and
+is halved when requests time out, so it settles at what the link can
+carry. Which blocks are still missing is up to the caller.
+
+Blocks are counted in units of the bitmap, one bit each. A request can
+ask for a block of several units, up to units at a time: the block size
+grows by a unit for every window's worth of blocks received once the
+window is fully open and the caller reports a good link, is halved
+when requests time out and drops to a single unit on a poor link. Which
+units make up a block never changes, so the bitmap stays the same
+whatever the block size.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Most requests that can be outstanding at the same time
+#define OTA_FETCH_WINDOW_MAX                8
+
+// No block, returned by OtaFetch_Next() and otaFetchNextMissing_t
+#define OTA_FETCH_NONE                      0xFFFF
+
+// Link quality as seen by the caller, see OtaFetch_SetLink()
+#define OTA_FETCH_LINK_POOR                 0
+#define OTA_FETCH_LINK_FAIR                 1
+#define OTA_FETCH_LINK_GOOD                 2
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Returns the first missing block at or after from, or OTA_FETCH_NONE
+typedef uint16 (*otaFetchNextMissing_t)( uint16 from );
+
+typedef struct otaFetchSlot
+{
+  uint16 block;         // first unit, OTA_FETCH_NONE if the slot is free
+  uint8  count;         // units requested
+  uint32 deadline;      // time the request is given up on
+} otaFetchSlot_t;
+
+typedef struct otaFetch
+{
+  otaFetchSlot_t slot[OTA_FETCH_WINDOW_MAX];
+  uint16 cursor;        // where the search for the next missing block starts
+  uint16 timeout;       // ms a request may stay outstanding
+  uint8  window;        // requests allowed outstanding now
+  uint8  windowMax;
+  uint8  outstanding;
+  uint8  credit;        // blocks received since the window last grew
+  uint8  units;         // units per block requested now
+  uint8  unitsMax;
+  uint8  link;          // OTA_FETCH_LINK_POOR ... OTA_FETCH_LINK_GOOD
+  uint32 lastProgress;  // time the last block arrived
+  // Statistics
+  uint32 requests;
+  uint32 received;
+  uint32 timeouts;
+  uint32 corrupt;
+} otaFetch_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void OtaFetch_Init( otaFetch_t *f, uint8 windowMax, uint16 timeout, uint32 now );
+void OtaFetch_SetUnits( otaFetch_t *f, uint8 units, uint8 unitsMax );
+void OtaFetch_SetLink( otaFetch_t *f, uint8 link );
+uint16 OtaFetch_Next( otaFetch_t *f, uint32 now, otaFetchNextMissing_t nextMissing, uint8 *count );
+uint8 OtaFetch_Received( otaFetch_t *f, uint16 block, uint32 now );
+uint8 OtaFetch_Corrupt( otaFetch_t *f, uint16 block );
+uint8 OtaFetch_Expire( otaFetch_t *f, uint32 now );
+uint32 OtaFetch_TimeToDeadline( const otaFetch_t *f, uint32 now );
+
+#endif
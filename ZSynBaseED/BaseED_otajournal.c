@@ -0,0 +1,183 @@
+/*******************************************************************************
+  Filename:       BaseED_otajournal.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   OTA progress journal: received block runs appended as small
+                  records, compacted into the block bitmap now and then and
+                  replayed on top of it at resume.
+*******************************************************************************/
+
+#include "BaseED_otajournal.h"
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      OtaJournal_Init
+ *
+ * @brief   Starts an empty journal. The bitmap must have been written
+ *          out before, the journal only records what came after it.
+ *
+ * @param   j       - journal to initialize
+ * @param   session - session number of the records, see
+ *                    OtaJournal_NextSession()
+ *
+ * @return  none
+ */
+void OtaJournal_Init( otaJournal_t *j, uint8 session )
+{
+  j->session = (session == OTA_JOURNAL_ERASED) ? 0 : session;
+  j->next = 0;
+  j->pendFirst = 0;
+  j->pendCount = 0;
+  j->records = 0;
+  j->compactions = 0;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_Add
+ *
+ * @brief   A block was received. Consecutive blocks are collected into
+ *          one run; a run is handed out for writing once it is
+ *          OTA_JOURNAL_RUN_MAX blocks long or the next block doesn't
+ *          follow on.
+ *
+ * @param   j     - journal
+ * @param   block - block received, not received before
+ * @param   rec   - filled in with the record to write, if any
+ *
+ * @return  slot to write rec to, OTA_JOURNAL_NONE if there is nothing
+ *          to write yet
+ */
+uint8 OtaJournal_Add( otaJournal_t *j, uint16 block, otaJournalRecord_t *rec )
+{
+  uint8 slot;
+
+  if (j->pendCount && block == j->pendFirst + j->pendCount) {
+    if (++j->pendCount < OTA_JOURNAL_RUN_MAX) {
+      return OTA_JOURNAL_NONE;
+    }
+    return OtaJournal_Flush(j, rec);
+  }
+
+  // The run held back so far ends here, the block starts a new one
+  slot = OtaJournal_Flush(j, rec);
+  j->pendFirst = block;
+  j->pendCount = 1;
+  return slot;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_Flush
+ *
+ * @brief   Hands out the run held back, if any, for writing.
+ *
+ * @param   j   - journal
+ * @param   rec - filled in with the record to write, if any
+ *
+ * @return  slot to write rec to, OTA_JOURNAL_NONE if nothing was held back
+ */
+uint8 OtaJournal_Flush( otaJournal_t *j, otaJournalRecord_t *rec )
+{
+  if (j->pendCount == 0 || j->next >= OTA_JOURNAL_RECORDS) {
+    return OTA_JOURNAL_NONE;
+  }
+  rec->first = j->pendFirst;
+  rec->count = j->pendCount;
+  rec->session = j->session;
+  j->pendCount = 0;
+  ++j->records;
+  return j->next++;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_Compacted
+ *
+ * @brief   The whole bitmap, including any run held back, has been
+ *          written out. Starts over at the first slot in a new session.
+ *          The caller must store the new session before writing records
+ *          to the journal again.
+ *
+ * @param   j - journal
+ *
+ * @return  none
+ */
+void OtaJournal_Compacted( otaJournal_t *j )
+{
+  j->session = OtaJournal_NextSession(j->session);
+  j->next = 0;
+  j->pendCount = 0;
+  ++j->compactions;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_NextSession
+ *
+ * @brief   Session number following session, skipping the one that
+ *          reads back from erased flash.
+ *
+ * @param   session - current session
+ *
+ * @return  next session
+ */
+uint8 OtaJournal_NextSession( uint8 session )
+{
+  ++session;
+  return (session == OTA_JOURNAL_ERASED) ? 0 : session;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_Replay
+ *
+ * @brief   Marks the blocks of a record read back from the journal as
+ *          received. Records are replayed in slot order until the first
+ *          one that doesn't belong to the session, which is where the
+ *          journal ends.
+ *
+ * @param   rec     - record read back
+ * @param   session - session stored at the last compaction
+ * @param   bm      - bitmap read back, bit i of block i set if received
+ * @param   total   - number of blocks in the bitmap
+ *
+ * @return  TRUE if the record was part of the journal, FALSE at its end
+ */
+uint8 OtaJournal_Replay( const otaJournalRecord_t *rec, uint8 session, uint8 *bm, uint16 total )
+{
+  uint16 block;
+  uint8 n;
+
+  if (rec->session != session || session == OTA_JOURNAL_ERASED ||
+      rec->count == 0 || rec->count > OTA_JOURNAL_RUN_MAX ||
+      rec->first >= total || rec->count > total - rec->first) {
+    return FALSE;
+  }
+  for (block = rec->first, n = rec->count; n; ++block, --n) {
+    bm[block >> 3] |= (uint8)(1 << (block & 7));
+  }
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      OtaJournal_SameImage
+ *
+ * @brief   Whether the journal stored in NV is open for an image: one
+ *          of the same size, in the same place, announced with the same
+ *          length and digest. The session doesn't take part.
+ *
+ * @param   nv    - journal as stored in NV
+ * @param   image - the image, session and all else ignored
+ *
+ * @return  TRUE if the journal's records belong to the image
+ */
+uint8 OtaJournal_SameImage( const otaJournalNv_t *nv, const otaJournalNv_t *image )
+{
+  return (nv->totalpackets != 0 &&
+          nv->totalpackets == image->totalpackets &&
+          nv->imgarea == image->imgarea &&
+          nv->imgtype == image->imgtype &&
+          nv->imageLen == image->imageLen &&
+          nv->digest == image->digest);
+}
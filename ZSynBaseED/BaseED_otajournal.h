@@ -0,0 +1,73 @@
+#ifndef BaseED_OTAJOURNAL_H
+#define BaseED_OTAJOURNAL_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the OTA progress journal. Rewriting the whole block
+bitmap in XNV for every block received costs BM_MAX_BYTES per block, so
+received blocks are appended to a journal instead: a fixed size record
+per run of consecutive blocks, written to the next free slot. Every
+OTA_JOURNAL_RECORDS records the bitmap is written out once (compacted)
+and the journal starts over under a new session number, which makes the
+records of the old session stale without having to erase them. At
+resume the bitmap is read back and the records of the current session
+are replayed on top of it. A run is held back until it is
+OTA_JOURNAL_RUN_MAX blocks long or broken, so a reset loses at most that
+many blocks, which are simply fetched again. Where the records go is up
+to the caller. The journal belongs to one image, see OtaJournal_SameImage();
+its records are never replayed onto the bitmap of another.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Longest run of blocks held back before its record is written
+#define OTA_JOURNAL_RUN_MAX                 4
+
+// Records written between compactions
+#define OTA_JOURNAL_RECORDS                 32
+
+// Session byte of an erased record, never used as a session
+#define OTA_JOURNAL_ERASED                  0xFF
+
+// No record to write, returned by OtaJournal_Add() and OtaJournal_Flush()
+#define OTA_JOURNAL_NONE                    0xFF
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// One journal record, OTA_JOURNAL_RECORDS of them make up the journal
+typedef struct otaJournalRecord
+{
+  uint16 first;         // first block of the run
+  uint8  count;         // blocks in the run
+  uint8  session;       // otaJournal_t.session the record was written in
+} otaJournalRecord_t;
+
+typedef struct otaJournal
+{
+  uint8  session;       // session of the records being written
+  uint8  next;          // slot of the next record
+  uint16 pendFirst;     // run not written yet
+  uint8  pendCount;
+  // Statistics
+  uint32 records;
+  uint32 compactions;
+} otaJournal_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void OtaJournal_Init( otaJournal_t *j, uint8 session );
+uint8 OtaJournal_Add( otaJournal_t *j, uint16 block, otaJournalRecord_t *rec );
+uint8 OtaJournal_Flush( otaJournal_t *j, otaJournalRecord_t *rec );
+void OtaJournal_Compacted( otaJournal_t *j );
+uint8 OtaJournal_NextSession( uint8 session );
+uint8 OtaJournal_Replay( const otaJournalRecord_t *rec, uint8 session, uint8 *bm, uint16 total );
+uint8 OtaJournal_SameImage( const otaJournalNv_t *nv, const otaJournalNv_t *image );
+
+#endif
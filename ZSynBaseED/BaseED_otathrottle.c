@@ -0,0 +1,134 @@
+/*******************************************************************************
+  Filename:       BaseED_otathrottle.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Duty cycle budget and quiet window of the background OTA
+                  fetch.
+*******************************************************************************/
+
+#include "BaseED_otathrottle.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+// Brings the budget up to date: it fills at dutyPct all the time and
+// drains while the fetch runs
+static void OtaThrottle_Update( otaThrottle_t *t, const otaThrottleCfg_t *cfg, uint32 now )
+{
+  uint32 dt = now - t->lastUpdate;
+
+  t->lastUpdate = now;
+  t->budget += (int32)(dt / 100 * cfg->dutyPct + dt % 100 * cfg->dutyPct / 100);
+  if (t->running) {
+    t->budget -= (int32)dt;
+    t->runMs += dt;
+  }
+  else {
+    t->pauseMs += dt;
+  }
+  if (t->budget > (int32)cfg->burstMs) {
+    t->budget = cfg->burstMs;
+  }
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      OtaThrottle_Init
+ *
+ * @brief   Starts a fetch with a full burst of budget.
+ *
+ * @param   t   - throttle to initialize
+ * @param   cfg - budget and quiet window
+ * @param   now - current time in ms
+ *
+ * @return  none
+ */
+void OtaThrottle_Init( otaThrottle_t *t, const otaThrottleCfg_t *cfg, uint32 now )
+{
+  t->budget = cfg->burstMs;
+  t->lastUpdate = now;
+  t->lastTraffic = now;
+  t->trafficSeen = FALSE;
+  t->running = TRUE;
+  t->pauses = 0;
+  t->runMs = 0;
+  t->pauseMs = 0;
+}
+
+/*********************************************************************
+ * @fn      OtaThrottle_Traffic
+ *
+ * @brief   Sensor traffic went out, the fetch makes way for it.
+ *
+ * @param   t   - throttle
+ * @param   now - current time in ms
+ *
+ * @return  none
+ */
+void OtaThrottle_Traffic( otaThrottle_t *t, uint32 now )
+{
+  t->lastTraffic = now;
+  t->trafficSeen = TRUE;
+}
+
+/*********************************************************************
+ * @fn      OtaThrottle_Check
+ *
+ * @brief   Whether the fetch may run now.
+ *
+ * @param   t   - throttle
+ * @param   cfg - budget and quiet window
+ * @param   now - current time in ms
+ *
+ * @return  0 if it may, else ms until it may run again
+ */
+uint32 OtaThrottle_Check( otaThrottle_t *t, const otaThrottleCfg_t *cfg, uint32 now )
+{
+  uint8 limited = (cfg->dutyPct > 0 && cfg->dutyPct < 100);
+  int32 resume = cfg->burstMs / 2;
+  uint32 quietLeft = 0;
+  uint32 wait;
+
+  if (!limited && cfg->quietMs == 0) {
+    t->running = TRUE;
+    return 0;
+  }
+
+  OtaThrottle_Update(t, cfg, now);
+  if (t->trafficSeen) {
+    if (now - t->lastTraffic < cfg->quietMs) {
+      quietLeft = cfg->quietMs - (now - t->lastTraffic);
+    }
+    else {
+      t->trafficSeen = FALSE;
+    }
+  }
+
+  if (t->running) {
+    if (quietLeft || (limited && t->budget <= 0)) {
+      t->running = FALSE;
+      ++t->pauses;
+    }
+  }
+  else if (!quietLeft && (!limited || t->budget >= resume)) {
+    t->running = TRUE;
+  }
+  if (t->running) {
+    return 0;
+  }
+
+  wait = quietLeft;
+  if (limited && t->budget < resume) {
+    uint32 refill = ((uint32)(resume - t->budget) * 100 + cfg->dutyPct - 1) / cfg->dutyPct;
+    if (refill > wait) {
+      wait = refill;
+    }
+  }
+  return wait ? wait : 1;
+}
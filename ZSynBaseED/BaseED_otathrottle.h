@@ -0,0 +1,42 @@
+#ifndef BaseED_OTATHROTTLE_H
+#define BaseED_OTATHROTTLE_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the background OTA throttle. The windowed fetch keeps
+the radio on and polls fast only while the throttle lets it run. The
+budget fills at otaThrottleCfg_t.dutyPct of the time, up to one burst,
+and the time spent fetching comes out of it.
+A fetch pauses when the budget runs out and resumes once half a burst
+has built up again, so it runs in bursts instead of flapping. Sensor
+traffic pauses it as well, until nothing was sent for quietMs. A duty
+cycle of 100% and a quiet window of 0 let the fetch run freely.
+*********************************************************************/
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct otaThrottle
+{
+  int32  budget;        // ms of fetching left
+  uint32 lastUpdate;    // time budget was brought up to date
+  uint32 lastTraffic;   // time sensor traffic was last sent
+  uint8  trafficSeen;   // lastTraffic is valid
+  uint8  running;       // fetching, rather than pausing
+  // Statistics
+  uint16 pauses;
+  uint32 runMs;
+  uint32 pauseMs;
+} otaThrottle_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void OtaThrottle_Init( otaThrottle_t *t, const otaThrottleCfg_t *cfg, uint32 now );
+void OtaThrottle_Traffic( otaThrottle_t *t, uint32 now );
+uint32 OtaThrottle_Check( otaThrottle_t *t, const otaThrottleCfg_t *cfg, uint32 now );
+
+#endif
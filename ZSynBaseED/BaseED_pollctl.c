@@ -0,0 +1,109 @@
+/*******************************************************************************
+  Filename:       BaseED_pollctl.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Poll rate controller: fast polling while there is downlink
+                  traffic, exponentially slower polling while the link is idle.
+*******************************************************************************/
+
+#include "BaseED_pollctl.h"
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      PollCtl_Init
+ *
+ * @brief   Starts the controller off at the given interval.
+ *
+ * @param   p    - controller to initialize
+ * @param   rate - current poll interval in ms
+ * @param   cfg  - bounds
+ *
+ * @return  none
+ */
+void PollCtl_Init( pollCtl_t *p, uint16 rate, const pollRateCfg_t *cfg )
+{
+  p->rate = rate;
+  p->idleCount = 0;
+  p->active = FALSE;
+  p->speedUps = 0;
+  PollCtl_SetLimits(p, cfg);
+}
+
+/*********************************************************************
+ * @fn      PollCtl_SetLimits
+ *
+ * @brief   Changes the bounds and clamps the current interval to them.
+ *
+ * @param   p   - controller
+ * @param   cfg - bounds
+ *
+ * @return  none
+ */
+void PollCtl_SetLimits( pollCtl_t *p, const pollRateCfg_t *cfg )
+{
+  p->minRate = cfg->minRate ? cfg->minRate : 1;
+  p->maxRate = (cfg->maxRate < p->minRate) ? p->minRate : cfg->maxRate;
+  p->idleTicks = cfg->idleTicks ? cfg->idleTicks : 1;
+
+  if (p->rate < p->minRate) {
+    p->rate = p->minRate;
+  }
+  if (p->rate > p->maxRate) {
+    p->rate = p->maxRate;
+  }
+}
+
+/*********************************************************************
+ * @fn      PollCtl_Activity
+ *
+ * @brief   Frame received from the parent, or sent and possibly waiting
+ *          for an answer.
+ *
+ * @param   p - controller
+ *
+ * @return  TRUE if the interval changed and should be applied now
+ */
+uint8 PollCtl_Activity( pollCtl_t *p )
+{
+  p->active = TRUE;
+  p->idleCount = 0;
+  if (p->rate == p->minRate) {
+    return FALSE;
+  }
+  p->rate = p->minRate;
+  ++p->speedUps;
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      PollCtl_Tick
+ *
+ * @brief   Periodic update. Doubles the interval after idleTicks ticks
+ *          without traffic.
+ *
+ * @param   p - controller
+ *
+ * @return  TRUE if the interval changed and should be applied now
+ */
+uint8 PollCtl_Tick( pollCtl_t *p )
+{
+  uint32 rate;
+
+  if (p->active) {
+    p->active = FALSE;
+    return FALSE;
+  }
+  if (p->rate >= p->maxRate || ++p->idleCount < p->idleTicks) {
+    return FALSE;
+  }
+
+  p->idleCount = 0;
+  rate = (uint32)p->rate * 2;
+  p->rate = (rate > p->maxRate) ? p->maxRate : (uint16)rate;
+  return TRUE;
+}
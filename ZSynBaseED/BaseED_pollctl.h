@@ -0,0 +1,39 @@
+#ifndef BaseED_POLLCTL_H
+#define BaseED_POLLCTL_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the poll rate controller of an active end device.
+Downlink traffic, or an uplink frame that may be answered, drops the
+poll interval to its minimum. Every stretch of idle ticks after that
+doubles it, up to the maximum. The caller hands the rate to
+NLME_SetPollRate().
+*********************************************************************/
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct pollCtl
+{
+  uint16 rate;          // current poll interval in ms
+  uint16 minRate;       // interval while there is traffic
+  uint16 maxRate;       // interval the idle link backs off to
+  uint8  idleTicks;     // idle ticks per doubling of the interval
+  uint8  idleCount;     // idle ticks since the last doubling
+  uint8  active;        // traffic seen since the last tick
+  // Statistics
+  uint16 speedUps;      // times the interval was dropped back to minRate
+} pollCtl_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void PollCtl_Init( pollCtl_t *p, uint16 rate, const pollRateCfg_t *cfg );
+void PollCtl_SetLimits( pollCtl_t *p, const pollRateCfg_t *cfg );
+uint8 PollCtl_Activity( pollCtl_t *p );
+uint8 PollCtl_Tick( pollCtl_t *p );
+
+#endif
@@ -0,0 +1,217 @@
+/*******************************************************************************
+  Filename:       BaseED_roaming.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Link quality monitor that moves an active end device to a
+                  better PAN before its parent link drops. Kept free of OSAL
+                  calls so it can also be built on the host.
+*******************************************************************************/
+
+#include "BaseED_roaming.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static int16 Roaming_Ewma( int16 avg, int16 sample )
+{
+  return (int16)(avg + (((int32)sample - avg) >> ROAMING_EWMA_SHIFT));
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Roaming_Reset
+ *
+ * @brief   Forgets everything learnt about the current link, e.g. after
+ *          joining a new parent. The statistics are kept.
+ *
+ * @param   m - monitor to reset
+ *
+ * @return  none
+ */
+void Roaming_Reset( roamingMonitor_t *m )
+{
+  m->lqiAvg = 0;
+  m->rssiAvg = 0;
+  m->failAvg = 0;
+  m->rxPrimed = FALSE;
+  m->txPrimed = FALSE;
+  m->poorTicks = 0;
+  m->holdoff = 0;
+  m->degraded = FALSE;
+}
+
+/*********************************************************************
+ * @fn      Roaming_RxSample
+ *
+ * @brief   Feeds the link quality of a frame received from the parent.
+ *
+ * @param   m    - monitor
+ * @param   lqi  - LQI of the frame
+ * @param   rssi - RSSI of the frame in dBm
+ *
+ * @return  none
+ */
+void Roaming_RxSample( roamingMonitor_t *m, uint8 lqi, int8 rssi )
+{
+  int16 lqiSample = (int16)lqi << ROAMING_LQI_FRAC;
+  int16 rssiSample = (int16)rssi * (1 << ROAMING_LQI_FRAC);
+
+  if (!m->rxPrimed) {
+    m->lqiAvg = lqiSample;
+    m->rssiAvg = rssiSample;
+    m->rxPrimed = TRUE;
+    return;
+  }
+  m->lqiAvg = (uint16)Roaming_Ewma((int16)m->lqiAvg, lqiSample);
+  m->rssiAvg = Roaming_Ewma(m->rssiAvg, rssiSample);
+}
+
+/*********************************************************************
+ * @fn      Roaming_TxConfirm
+ *
+ * @brief   Feeds the outcome of an AF data request.
+ *
+ * @param   m       - monitor
+ * @param   success - TRUE if the confirm reported ZSuccess
+ *
+ * @return  none
+ */
+void Roaming_TxConfirm( roamingMonitor_t *m, uint8 success )
+{
+  int16 sample = success ? 0 : (100 << ROAMING_FAIL_FRAC);
+
+  if (!m->txPrimed) {
+    m->failAvg = sample;
+    m->txPrimed = TRUE;
+    return;
+  }
+  m->failAvg = (uint16)Roaming_Ewma((int16)m->failAvg, sample);
+}
+
+/*********************************************************************
+ * @fn      Roaming_Evaluate
+ *
+ * @brief   Periodic check of the averages. The link turns degraded once
+ *          it has been poor for cfg->holdTicks evaluations in a row and
+ *          only recovers when it is good again, readings in between the
+ *          low and high thresholds change nothing.
+ *
+ * @param   m   - monitor
+ * @param   cfg - thresholds
+ *
+ * @return  TRUE if a candidate search should be started now
+ */
+uint8 Roaming_Evaluate( roamingMonitor_t *m, const roamingCfg_t *cfg )
+{
+  uint8 lqi = (uint8)(m->lqiAvg >> ROAMING_LQI_FRAC);
+  uint8 fail = (uint8)(m->failAvg >> ROAMING_FAIL_FRAC);
+  uint8 poor, good;
+
+  if (cfg->holdTicks == 0) {
+    return FALSE;   // roaming disabled
+  }
+
+  poor = (m->rxPrimed && lqi < cfg->lqiLow) || (m->txPrimed && fail > cfg->failHigh);
+  good = (!m->rxPrimed || lqi >= cfg->lqiHigh) && (!m->txPrimed || fail <= cfg->failLow);
+
+  if (poor) {
+    if (m->poorTicks < 0xFF) {
+      ++m->poorTicks;
+    }
+    if (m->poorTicks >= cfg->holdTicks) {
+      m->degraded = TRUE;
+    }
+  }
+  else if (good) {
+    m->poorTicks = 0;
+    m->degraded = FALSE;
+    m->holdoff = 0;
+  }
+
+  if (m->holdoff) {
+    --m->holdoff;
+    return FALSE;
+  }
+  if (m->degraded) {
+    ++m->searches;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/*********************************************************************
+ * @fn      Roaming_SearchDone
+ *
+ * @brief   Records the outcome of a candidate search. If we stay put the
+ *          next search waits cfg->retryTicks evaluations.
+ *
+ * @param   m      - monitor
+ * @param   cfg    - thresholds
+ * @param   roamed - TRUE if we are moving to another PAN
+ *
+ * @return  none
+ */
+void Roaming_SearchDone( roamingMonitor_t *m, const roamingCfg_t *cfg, uint8 roamed )
+{
+  if (roamed) {
+    ++m->roams;
+    Roaming_Reset(m);
+  }
+  else {
+    m->holdoff = cfg->retryTicks;
+  }
+}
+
+/*********************************************************************
+ * @fn      Roaming_SelectCandidate
+ *
+ * @brief   Picks the PAN to move to. Only coordinators that answered the
+ *          search are considered, our own PAN never is, and a candidate
+ *          must have been heard at least cfg->lqiMargin better than the
+ *          current parent. The LQI of a PAN is the one its answer was
+ *          received with, the caller stores it in pans. The rest is up to
+ *          the join policy weights.
+ *
+ * @param   m          - monitor
+ * @param   cfg        - thresholds
+ * @param   weights    - join policy weights
+ * @param   pans       - PAN table (nv_pan_info_array)
+ * @param   count      - number of valid entries in pans
+ * @param   currentPan - PAN id we are on
+ * @param   answered   - bit i set if pans[i] answered the search
+ *
+ * @return  index of the PAN to move to, ROAMING_NO_CANDIDATE if none
+ */
+uint8 Roaming_SelectCandidate( const roamingMonitor_t *m, const roamingCfg_t *cfg,
+                               const joinPolicyWeights_t *weights, const NWInfo_t *pans,
+                               uint8 count, uint16 currentPan, uint32 answered )
+{
+  uint16 minLqi = 0;
+  uint8 best = ROAMING_NO_CANDIDATE;
+  int32 bestScore = 0;
+  uint8 i;
+
+  if (m->rxPrimed) {
+    minLqi = (m->lqiAvg >> ROAMING_LQI_FRAC) + cfg->lqiMargin;
+  }
+
+  for (i = 0; i < count && i < 32; ++i) {
+    if (pans[i].panID == 0 || pans[i].panID == currentPan ||
+        !(answered & ((uint32)1 << i)) || pans[i].lqi < minLqi) {
+      continue;
+    }
+
+    int32 score = JoinPolicy_Score(weights, pans, count, i);
+    if (best == ROAMING_NO_CANDIDATE || score > bestScore) {
+      best = i;
+      bestScore = score;
+    }
+  }
+  return best;
+}
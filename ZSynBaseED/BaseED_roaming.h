@@ -0,0 +1,60 @@
+#ifndef BaseED_ROAMING_H
+#define BaseED_ROAMING_H
+
+#include "BaseED_supportsettings.h"
+#include "BaseED_joinpolicy.h"
+
+/*********************************************************************
+Header file for the roaming monitor. It keeps exponentially weighted
+averages of the LQI/RSSI of the frames we receive from our parent and
+of the AF data confirm failures, and decides when the link has been
+poor for long enough to look for a better PAN in nv_pan_info_array.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Averages move by 1/2^ROAMING_EWMA_SHIFT of the difference per sample
+#define ROAMING_EWMA_SHIFT                3
+
+// Averages are kept with this many fraction bits
+#define ROAMING_LQI_FRAC                  4
+#define ROAMING_FAIL_FRAC                 8
+
+// Returned by Roaming_SelectCandidate() when no PAN is worth moving to
+#define ROAMING_NO_CANDIDATE              JOIN_POLICY_NO_PAN
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct roamingMonitor
+{
+  uint16 lqiAvg;        // received LQI, ROAMING_LQI_FRAC fraction bits
+  int16  rssiAvg;       // received RSSI in dBm, ROAMING_LQI_FRAC fraction bits
+  uint16 failAvg;       // AF confirm failures in percent, ROAMING_FAIL_FRAC fraction bits
+  uint8  rxPrimed;      // lqiAvg/rssiAvg hold at least one sample
+  uint8  txPrimed;      // failAvg holds at least one sample
+  uint8  poorTicks;     // consecutive evaluations the link was poor
+  uint8  holdoff;       // evaluations left before the next candidate search
+  uint8  degraded;      // poor for cfg->holdTicks and not good since
+  // Statistics
+  uint16 searches;      // candidate searches started
+  uint16 roams;         // searches that ended on another PAN
+} roamingMonitor_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Roaming_Reset( roamingMonitor_t *m );
+void Roaming_RxSample( roamingMonitor_t *m, uint8 lqi, int8 rssi );
+void Roaming_TxConfirm( roamingMonitor_t *m, uint8 success );
+uint8 Roaming_Evaluate( roamingMonitor_t *m, const roamingCfg_t *cfg );
+void Roaming_SearchDone( roamingMonitor_t *m, const roamingCfg_t *cfg, uint8 roamed );
+uint8 Roaming_SelectCandidate( const roamingMonitor_t *m, const roamingCfg_t *cfg,
+                               const joinPolicyWeights_t *weights, const NWInfo_t *pans,
+                               uint8 count, uint16 currentPan, uint32 answered );
+
+#endif
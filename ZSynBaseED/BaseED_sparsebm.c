@@ -0,0 +1,313 @@
+/*******************************************************************************
+  Filename:       BaseED_sparsebm.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Two level OTA bitmap: per group summary bits in RAM, the
+                  bits of partly received groups in a few leaves cached
+                  from a backing store.
+*******************************************************************************/
+
+#include "BaseED_sparsebm.h"
+#include "BaseED_bitmap.h"
+
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+#define SPARSEBM_TEST(b, i)   (((b)[(i) >> 3] >> ((i) & 7)) & 1)
+#define SPARSEBM_SET(b, i)    ((b)[(i) >> 3] |= (uint8)(1 << ((i) & 7)))
+
+// Units in group, only the last one can be short
+static uint8 SparseBm_Units( const sparseBm_t *s, uint16 group )
+{
+  uint16 left = s->total - group * SPARSEBM_GROUP_UNITS;
+
+  return (left < SPARSEBM_GROUP_UNITS) ? (uint8)left : SPARSEBM_GROUP_UNITS;
+}
+
+// Leaf of a partly received or untouched group, read in if need be. When
+// every leaf is in use the one under the hand is written back and reused.
+static sparseBmLeaf_t *SparseBm_Leaf( sparseBm_t *s, uint16 group )
+{
+  sparseBmLeaf_t *leaf;
+  uint8 free = SPARSEBM_LEAVES;
+  uint8 i;
+
+  for (i = 0; i < SPARSEBM_LEAVES; ++i) {
+    if (s->leaf[i].group == group) {
+      return &s->leaf[i];
+    }
+    if (free == SPARSEBM_LEAVES && s->leaf[i].group == SPARSEBM_NONE) {
+      free = i;
+    }
+  }
+
+  if (free < SPARSEBM_LEAVES) {
+    leaf = &s->leaf[free];
+  }
+  else {
+    leaf = &s->leaf[s->hand];
+    s->hand = (s->hand + 1 < SPARSEBM_LEAVES) ? s->hand + 1 : 0;
+    if (leaf->dirty) {
+      s->write(leaf->group, leaf->bits);
+    }
+    ++s->evictions;
+  }
+
+  leaf->group = group;
+  leaf->dirty = FALSE;
+  for (i = 0; i < SPARSEBM_LEAF_BYTES; ++i) {
+    leaf->bits[i] = 0;
+  }
+  if (SPARSEBM_TEST(s->touched, group)) {
+    s->read(group, leaf->bits);
+    ++s->loads;
+  }
+  return leaf;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      SparseBm_Init
+ *
+ * @brief   Starts a bitmap with every unit missing.
+ *
+ * @param   s       - bitmap to initialize
+ * @param   total   - number of units
+ * @param   summary - 2 x SPARSEBM_SUMMARY_BYTES(total) bytes for the
+ *                    summary
+ * @param   read    - reads a leaf from the backing store
+ * @param   write   - writes a leaf to the backing store
+ *
+ * @return  none
+ */
+void SparseBm_Init( sparseBm_t *s, uint16 total, uint8 *summary,
+                    sparseBmLeafIO_t read, sparseBmLeafIO_t write )
+{
+  uint16 bytes = SPARSEBM_SUMMARY_BYTES(total);
+  uint16 i;
+
+  s->full = summary;
+  s->touched = summary + bytes;
+  for (i = 0; i < 2 * bytes; ++i) {
+    summary[i] = 0;
+  }
+  for (i = 0; i < SPARSEBM_LEAVES; ++i) {
+    s->leaf[i].group = SPARSEBM_NONE;
+    s->leaf[i].dirty = FALSE;
+  }
+  s->total = total;
+  s->groups = (uint16)SPARSEBM_GROUPS(total);
+  s->missing = total;
+  s->hand = 0;
+  s->read = read;
+  s->write = write;
+  s->loads = 0;
+  s->evictions = 0;
+}
+
+/*********************************************************************
+ * @fn      SparseBm_Load
+ *
+ * @brief   Builds the summary from the leaves in the backing store, e.g.
+ *          the bitmap in XNV at resume. Reads every leaf once; none of
+ *          them stay in RAM.
+ *
+ * @param   s - bitmap
+ *
+ * @return  none
+ */
+void SparseBm_Load( sparseBm_t *s )
+{
+  uint8 bits[SPARSEBM_LEAF_BYTES];
+  uint16 group;
+  uint8 units;
+  uint8 clear;
+  uint8 i;
+
+  s->missing = 0;
+  for (group = 0; group < s->groups; ++group) {
+    for (i = 0; i < SPARSEBM_LEAF_BYTES; ++i) {
+      bits[i] = 0;
+    }
+    s->read(group, bits);
+    units = SparseBm_Units(s, group);
+    clear = (uint8)Bitmap_CountClear(bits, units);
+    s->missing += clear;
+    if (clear == 0) {
+      SPARSEBM_SET(s->full, group);
+    }
+    if (clear < units) {
+      SPARSEBM_SET(s->touched, group);
+    }
+  }
+}
+
+/*********************************************************************
+ * @fn      SparseBm_Test
+ *
+ * @brief   Whether a unit has been received.
+ *
+ * @param   s    - bitmap
+ * @param   unit - unit to test
+ *
+ * @return  TRUE if it has
+ */
+uint8 SparseBm_Test( sparseBm_t *s, uint16 unit )
+{
+  uint16 group = unit / SPARSEBM_GROUP_UNITS;
+
+  if (unit >= s->total || SPARSEBM_TEST(s->full, group)) {
+    return TRUE;
+  }
+  if (!SPARSEBM_TEST(s->touched, group)) {
+    return FALSE;
+  }
+  return SPARSEBM_TEST(SparseBm_Leaf(s, group)->bits, unit % SPARSEBM_GROUP_UNITS);
+}
+
+/*********************************************************************
+ * @fn      SparseBm_Set
+ *
+ * @brief   Marks a unit received. A group that is complete goes to the
+ *          backing store and gives up its leaf.
+ *
+ * @param   s    - bitmap
+ * @param   unit - unit received
+ *
+ * @return  TRUE if the unit hadn't been received before
+ */
+uint8 SparseBm_Set( sparseBm_t *s, uint16 unit )
+{
+  uint16 group = unit / SPARSEBM_GROUP_UNITS;
+  sparseBmLeaf_t *leaf;
+  uint8 bit = unit % SPARSEBM_GROUP_UNITS;
+
+  if (unit >= s->total || SPARSEBM_TEST(s->full, group)) {
+    return FALSE;
+  }
+  leaf = SparseBm_Leaf(s, group);
+  if (SPARSEBM_TEST(leaf->bits, bit)) {
+    return FALSE;
+  }
+  SPARSEBM_SET(leaf->bits, bit);
+  SPARSEBM_SET(s->touched, group);
+  leaf->dirty = TRUE;
+  --s->missing;
+
+  if (Bitmap_NextClear(leaf->bits, SparseBm_Units(s, group), 0) == BITMAP_NONE) {
+    SPARSEBM_SET(s->full, group);
+    s->write(group, leaf->bits);
+    leaf->group = SPARSEBM_NONE;
+    leaf->dirty = FALSE;
+  }
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      SparseBm_NextClear
+ *
+ * @brief   Finds the first missing unit at or after from.
+ *
+ * @param   s    - bitmap
+ * @param   from - first unit to look at
+ *
+ * @return  unit, or SPARSEBM_NONE if every unit from there on has been
+ *          received
+ */
+uint16 SparseBm_NextClear( sparseBm_t *s, uint16 from )
+{
+  uint16 group;
+  uint16 bit;
+
+  while (from < s->total) {
+    group = Bitmap_NextClear(s->full, s->groups, from / SPARSEBM_GROUP_UNITS);
+    if (group == BITMAP_NONE) {
+      break;
+    }
+    if (group != from / SPARSEBM_GROUP_UNITS) {
+      from = group * SPARSEBM_GROUP_UNITS;
+    }
+    if (!SPARSEBM_TEST(s->touched, group)) {
+      return from;
+    }
+    bit = Bitmap_NextClear(SparseBm_Leaf(s, group)->bits, SparseBm_Units(s, group),
+                           from % SPARSEBM_GROUP_UNITS);
+    if (bit != BITMAP_NONE) {
+      return group * SPARSEBM_GROUP_UNITS + bit;
+    }
+    if (group + 1 >= s->groups) {
+      break;
+    }
+    from = (group + 1) * SPARSEBM_GROUP_UNITS;
+  }
+  return SPARSEBM_NONE;
+}
+
+/*********************************************************************
+ * @fn      SparseBm_ClearRun
+ *
+ * @brief   Length of the run of missing units that starts at first.
+ *
+ * @param   s     - bitmap
+ * @param   first - first unit of the run, normally a missing one
+ * @param   max   - longest run wanted
+ *
+ * @return  number of consecutive missing units, 0 if first was received
+ */
+uint16 SparseBm_ClearRun( sparseBm_t *s, uint16 first, uint16 max )
+{
+  uint16 run = 0;
+  uint16 group;
+  uint16 bit;
+  uint16 units;
+  uint16 n;
+
+  while (run < max && first < s->total) {
+    group = first / SPARSEBM_GROUP_UNITS;
+    bit = first % SPARSEBM_GROUP_UNITS;
+    units = SparseBm_Units(s, group);
+    if (SPARSEBM_TEST(s->full, group)) {
+      break;
+    }
+    if (!SPARSEBM_TEST(s->touched, group)) {
+      n = units - bit;
+    }
+    else {
+      n = Bitmap_ClearRun(SparseBm_Leaf(s, group)->bits, units, bit, units);
+    }
+    run += n;
+    if (bit + n < units) {
+      break;
+    }
+    first += n;
+  }
+  return (run > max) ? max : run;
+}
+
+/*********************************************************************
+ * @fn      SparseBm_Flush
+ *
+ * @brief   Writes the leaves changed since they were read back to the
+ *          backing store. They stay in RAM.
+ *
+ * @param   s - bitmap
+ *
+ * @return  none
+ */
+void SparseBm_Flush( sparseBm_t *s )
+{
+  uint8 i;
+
+  for (i = 0; i < SPARSEBM_LEAVES; ++i) {
+    if (s->leaf[i].group != SPARSEBM_NONE && s->leaf[i].dirty) {
+      s->write(s->leaf[i].group, s->leaf[i].bits);
+      s->leaf[i].dirty = FALSE;
+    }
+  }
+}
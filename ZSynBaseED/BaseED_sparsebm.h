@@ -0,0 +1,82 @@
+#ifndef BaseED_SPARSEBM_H
+#define BaseED_SPARSEBM_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the two level OTA bitmap. Units are grouped
+SPARSEBM_GROUP_UNITS at a time. The summary has two bits per group:
+every unit received, and any unit received. Only groups that are partly
+received need their leaf, the group's bits of the flat bitmap. At most
+SPARSEBM_LEAVES leaves are kept in RAM, the rest are read from and
+written back to a backing store by the caller, so RAM is bounded by the
+summary of the largest image plus the leaves. Leaves have the layout of
+the flat bitmap (see BaseED_bitmap.h), so the backing store can be the
+bitmap in XNV itself. Scans skip received groups in the summary a word
+at a time and only look at the leaves of partial groups.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Units per group, one leaf
+#define SPARSEBM_GROUP_UNITS                64
+#define SPARSEBM_LEAF_BYTES                 (SPARSEBM_GROUP_UNITS / 8)
+
+// Leaves kept in RAM
+#ifndef SPARSEBM_LEAVES
+#define SPARSEBM_LEAVES                     8
+#endif
+
+// Groups of an image of n units, and bytes of one summary level
+#define SPARSEBM_GROUPS(n)                  (((uint32)(n) + SPARSEBM_GROUP_UNITS - 1) / SPARSEBM_GROUP_UNITS)
+#define SPARSEBM_SUMMARY_BYTES(n)           ((uint16)((SPARSEBM_GROUPS(n) + 7) >> 3))
+
+// No unit, returned by SparseBm_NextClear()
+#define SPARSEBM_NONE                       0xFFFF
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Reads or writes the leaf of a group in the backing store
+typedef void (*sparseBmLeafIO_t)( uint16 group, uint8 *leaf );
+
+typedef struct sparseBmLeaf
+{
+  uint16 group;         // SPARSEBM_NONE if the leaf is free
+  uint8  dirty;         // changed since read from the backing store
+  uint8  bits[SPARSEBM_LEAF_BYTES];
+} sparseBmLeaf_t;
+
+typedef struct sparseBm
+{
+  uint8  *full;         // summary: every unit of the group received
+  uint8  *touched;      // summary: some unit of the group received
+  sparseBmLeaf_t leaf[SPARSEBM_LEAVES];
+  uint16 total;         // units
+  uint16 groups;
+  uint16 missing;       // units not received yet
+  uint8  hand;          // next leaf to give up when all are in use
+  sparseBmLeafIO_t read;
+  sparseBmLeafIO_t write;
+  // Statistics
+  uint16 loads;
+  uint16 evictions;
+} sparseBm_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void SparseBm_Init( sparseBm_t *s, uint16 total, uint8 *summary,
+                    sparseBmLeafIO_t read, sparseBmLeafIO_t write );
+void SparseBm_Load( sparseBm_t *s );
+uint8 SparseBm_Test( sparseBm_t *s, uint16 unit );
+uint8 SparseBm_Set( sparseBm_t *s, uint16 unit );
+uint16 SparseBm_NextClear( sparseBm_t *s, uint16 from );
+uint16 SparseBm_ClearRun( sparseBm_t *s, uint16 first, uint16 max );
+void SparseBm_Flush( sparseBm_t *s );
+
+#endif
@@ -22,6 +22,23 @@
 #include "BaseED.h"
 #include "BaseED_support.h"
 #include "BaseED_supportsettings.h"
+#include "BaseED_joinpolicy.h"
+#include "BaseED_interpan.h"
+#include "BaseED_backoff.h"
+#include "BaseED_roaming.h"
+#include "BaseED_pollctl.h"
+#include "BaseED_apptimer.h"
+#include "BaseED_energy.h"
+#include "BaseED_otafetch.h"
+#include "BaseED_bitmap.h"
+#include "BaseED_sparsebm.h"
+#include "BaseED_txring.h"
+#include "BaseED_otajournal.h"
+#include "BaseED_lzss.h"
+#include "BaseED_delta.h"
+#include "BaseED_crc.h"
+#include "BaseED_otathrottle.h"
+#include "BaseED_trace.h"
 
 #include "DebugTrace.h"
 
@@ -46,6 +63,7 @@
 #include "ota_common.h"
 #include "bitmapfs.h"
 #include "stub_aps.h"
+#include "aps_groups.h"
 
 /**************************************************************************************************
  *                                            GLOBAL
@@ -117,13 +135,74 @@ At any point, therefore we can revert back to the default value.
 #define APP_NV_CLEAN_ALL_NV_ITEMS_DEFAULT  false         //By default, we never clean our NV items at powerup
 #define APP_NV_LAST_STARTUP_SLEEP_COUNT_DEFAULT    1
 
-#define NUM_LQI_PARTITION_LVLS          4
-#define NUM_DEVS_PER_LQI_PARTITION      5
-
 
 #define RADIO_SLEEP_TIMER_DEFAULT                  15000
 #define RADIO_SLEEP_TIMER_CNT_DEFAULT              1
 
+// The join retry used to wait a fixed BaseED_NWK_JOIN_RETRY_REPEAT_COUNT * 15 seconds. The
+// first delay is drawn from base to 3 * base, half that as base keeps it on average.
+#define JOIN_BACKOFF_BASE_DEFAULT                  (BaseED_NWK_JOIN_RETRY_REPEAT_COUNT * (BaseED_NWK_JOIN_RETRY_TIMEOUT / 1000) / 2)
+#define JOIN_BACKOFF_CAP_DEFAULT                   (4 * BaseED_NWK_JOIN_RETRY_REPEAT_COUNT * (BaseED_NWK_JOIN_RETRY_TIMEOUT / 1000))
+#define RESTART_BACKOFF_CAP_DEFAULT                MAX_STARTUP_SLEEP_COUNT
+#define RESTART_BACKOFF_BASE                       2     // the old doubling also started out at 2 cycles
+
+// Roam after 30 s of a poor link, retry the search every 5 min while it stays poor
+#define ROAMING_LQI_LOW_DEFAULT                    60
+#define ROAMING_LQI_HIGH_DEFAULT                   90
+#define ROAMING_FAIL_HIGH_DEFAULT                  30
+#define ROAMING_FAIL_LOW_DEFAULT                   10
+#define ROAMING_HOLD_TICKS_DEFAULT                 (30000 / PRESENCE_DATARATE_SAMPLE_TIMER)
+#define ROAMING_LQI_MARGIN_DEFAULT                 20
+#define ROAMING_RETRY_TICKS_DEFAULT                (300000 / PRESENCE_DATARATE_SAMPLE_TIMER)
+
+// Parent loss thresholds for device types missing from parentLossThresholdTable
+#define PARENT_LOSS_CONFIRM_FAILURES_DEFAULT       4
+#define PARENT_LOSS_POLL_FAILURES_DEFAULT          2
+
+// Poll once a second while there is traffic, back off to every 30 s when idle
+#define POLL_RATE_MIN_DEFAULT                      1000
+#define POLL_RATE_MAX_DEFAULT                      30000
+#define POLL_RATE_IDLE_TICKS_DEFAULT               1
+
+// Production builds keep quiet unless switched to debug over MT
+#ifndef POWER_PROFILE_DEFAULT
+#ifdef DEBUG
+#define POWER_PROFILE_DEFAULT                      POWER_PROFILE_DEBUG
+#else
+#define POWER_PROFILE_DEFAULT                      POWER_PROFILE_BATTERY
+#endif
+#endif
+
+// The OTA fetch makes way for sensor traffic for 2 s, but otherwise runs
+// flat out
+#define OTA_THROTTLE_DUTY_DEFAULT                  100
+#define OTA_THROTTLE_BURST_DEFAULT                 10000
+#define OTA_THROTTLE_QUIET_DEFAULT                 2000
+
+// Serial output that doesn't fit the transmit ring is dropped rather than
+// overwriting what is queued, so MT frames go out whole
+#ifndef UART_TX_POLICY
+#define UART_TX_POLICY                             TXRING_DROP
+#endif
+
+// Most bytes handed to HalUARTWrite() at a time. The driver takes a write
+// whole or not at all, one larger than the free space of its transmit
+// buffer would never go out.
+#ifndef UART_TX_CHUNK
+#define UART_TX_CHUNK                              32
+#endif
+
+// Largest OTA block of several units, in bytes. It must fit an AF frame
+// without fragmentation, along with the MT framing.
+#ifndef OTA_BLOCK_BYTES_MAX
+#define OTA_BLOCK_BYTES_MAX                        80
+#endif
+
+// XNV image type the OTA progress journal is kept in, next to the bitmap
+#ifndef FLASH_IMAGE_TYPE_OTA_JOURNAL
+#define FLASH_IMAGE_TYPE_OTA_JOURNAL               (FLASH_IMAGE_TYPE_OTA_BITMAP + 1)
+#endif
+
 // Variables for default values. These will go into the default table - update for step 2
 const uint16 app_nv_unit_timer_value_default       = APP_NV_UNIT_TIMER_VALUE_DEFAULT;
 const uint16 app_nv_repeat_count_value_default     = APP_NV_REPEAT_COUNT_VALUE_DEFAULT;
@@ -140,6 +219,44 @@ const uint16 nv_xnv_ota_repeat_count_value_default = APP_NV_XNV_OTA_REPEAT_COUNT
 const uint16 nv_clean_all_nv_items_default         = APP_NV_CLEAN_ALL_NV_ITEMS_DEFAULT;
 const uint16 nv_radio_sleep_timer_cnt_default      = RADIO_SLEEP_TIMER_CNT_DEFAULT;
 const uint16 nv_last_startup_sleep_count_default   = APP_NV_LAST_STARTUP_SLEEP_COUNT_DEFAULT;
+const joinPolicyWeights_t nv_join_policy_weights_default = {
+  JOIN_POLICY_WEIGHT_LQI_DEFAULT,
+  JOIN_POLICY_WEIGHT_RSSI_DEFAULT,
+  JOIN_POLICY_WEIGHT_NASSOC_DEFAULT,
+  JOIN_POLICY_WEIGHT_DRATE_DEFAULT,
+  JOIN_POLICY_WEIGHT_CHANOCC_DEFAULT
+};
+const nwkFingerprint_t nv_nwk_fingerprint_default = {
+  0, 0, {0, 0, 0, 0, 0, 0, 0, 0}, NON_COMMISSIONED
+};
+const retryBackoffCfg_t nv_retry_backoff_default = {
+  JOIN_BACKOFF_BASE_DEFAULT,
+  JOIN_BACKOFF_CAP_DEFAULT,
+  RESTART_BACKOFF_CAP_DEFAULT
+};
+const roamingCfg_t nv_roaming_cfg_default = {
+  ROAMING_LQI_LOW_DEFAULT,
+  ROAMING_LQI_HIGH_DEFAULT,
+  ROAMING_FAIL_HIGH_DEFAULT,
+  ROAMING_FAIL_LOW_DEFAULT,
+  ROAMING_HOLD_TICKS_DEFAULT,
+  ROAMING_LQI_MARGIN_DEFAULT,
+  ROAMING_RETRY_TICKS_DEFAULT
+};
+const pollRateCfg_t nv_poll_rate_cfg_default = {
+  POLL_RATE_MIN_DEFAULT,
+  POLL_RATE_MAX_DEFAULT,
+  POLL_RATE_IDLE_TICKS_DEFAULT
+};
+const uint8  nv_power_profile_default              = POWER_PROFILE_DEFAULT;
+const uint16 nv_boot_count_default                 = 0;
+const uint8  nv_ota_stream_default                 = 0;
+const otaJournalNv_t nv_ota_journal_default = { 0, 0, 0, 0, 0, 0 };
+const otaThrottleCfg_t nv_ota_throttle_cfg_default = {
+  OTA_THROTTLE_DUTY_DEFAULT,
+  OTA_THROTTLE_BURST_DEFAULT,
+  OTA_THROTTLE_QUIET_DEFAULT
+};
 
 // Statically defining the default pan info array
 // NOTE: update this as new members like RSSI, LQI are added into the NWInfo_t definition
@@ -197,6 +314,44 @@ uint16 nv_xnv_ota_repeat_count_value = APP_NV_XNV_OTA_REPEAT_COUNT_VALUE_DEFAULT
 uint16 nv_clean_all_nv_items         = APP_NV_CLEAN_ALL_NV_ITEMS_DEFAULT;
 uint16 nv_radio_sleep_timer_cnt      = RADIO_SLEEP_TIMER_CNT_DEFAULT;
 uint16 nv_last_startup_sleep_count   = APP_NV_LAST_STARTUP_SLEEP_COUNT_DEFAULT;
+joinPolicyWeights_t nv_join_policy_weights = {
+  JOIN_POLICY_WEIGHT_LQI_DEFAULT,
+  JOIN_POLICY_WEIGHT_RSSI_DEFAULT,
+  JOIN_POLICY_WEIGHT_NASSOC_DEFAULT,
+  JOIN_POLICY_WEIGHT_DRATE_DEFAULT,
+  JOIN_POLICY_WEIGHT_CHANOCC_DEFAULT
+};
+nwkFingerprint_t nv_nwk_fingerprint = {
+  0, 0, {0, 0, 0, 0, 0, 0, 0, 0}, NON_COMMISSIONED
+};
+retryBackoffCfg_t nv_retry_backoff = {
+  JOIN_BACKOFF_BASE_DEFAULT,
+  JOIN_BACKOFF_CAP_DEFAULT,
+  RESTART_BACKOFF_CAP_DEFAULT
+};
+roamingCfg_t nv_roaming_cfg = {
+  ROAMING_LQI_LOW_DEFAULT,
+  ROAMING_LQI_HIGH_DEFAULT,
+  ROAMING_FAIL_HIGH_DEFAULT,
+  ROAMING_FAIL_LOW_DEFAULT,
+  ROAMING_HOLD_TICKS_DEFAULT,
+  ROAMING_LQI_MARGIN_DEFAULT,
+  ROAMING_RETRY_TICKS_DEFAULT
+};
+pollRateCfg_t nv_poll_rate_cfg = {
+  POLL_RATE_MIN_DEFAULT,
+  POLL_RATE_MAX_DEFAULT,
+  POLL_RATE_IDLE_TICKS_DEFAULT
+};
+uint8  nv_power_profile              = POWER_PROFILE_DEFAULT;
+uint16 nv_boot_count                 = 0;
+uint8  nv_ota_stream                 = 0;
+otaJournalNv_t nv_ota_journal = { 0, 0, 0, 0, 0, 0 };
+otaThrottleCfg_t nv_ota_throttle_cfg = {
+  OTA_THROTTLE_DUTY_DEFAULT,
+  OTA_THROTTLE_BURST_DEFAULT,
+  OTA_THROTTLE_QUIET_DEFAULT
+};
 
 static appInstance_t appInstance_default;
 
@@ -258,7 +413,7 @@ const appNVItemDefaultValues_t appNVItemDefaultValuesTable[] =
     APP_NV_PANLIST_IDX, sizeof(app_nv_panlist_idx_default), &app_nv_panlist_idx_default
   },
   {
-    APP_NV_PANINFO_STRUCT, sizeof(NWInfo_t) * MAX_PANS_SCANNED, nv_pan_info_default_array
+    APP_NV_PAN_INFO, sizeof(NWInfo_t) * MAX_PANS_SCANNED, nv_pan_info_default_array
   },
   {
     APP_NV_GET_COORD_PARMS_FLAG, sizeof(nv_get_coord_parms_flag_default), &nv_get_coord_parms_flag_default
@@ -299,6 +454,36 @@ const appNVItemDefaultValues_t appNVItemDefaultValuesTable[] =
   {
     APP_NV_APP_INSTANCE, sizeof( appInstance_default ), &appInstance_default
   },
+  {
+    APP_NV_JOIN_POLICY_WEIGHTS, sizeof( nv_join_policy_weights_default ), &nv_join_policy_weights_default
+  },
+  {
+    APP_NV_NWK_FINGERPRINT, sizeof( nv_nwk_fingerprint_default ), &nv_nwk_fingerprint_default
+  },
+  {
+    APP_NV_RETRY_BACKOFF, sizeof( nv_retry_backoff_default ), &nv_retry_backoff_default
+  },
+  {
+    APP_NV_ROAMING_CFG, sizeof( nv_roaming_cfg_default ), &nv_roaming_cfg_default
+  },
+  {
+    APP_NV_POLL_RATE_CFG, sizeof( nv_poll_rate_cfg_default ), &nv_poll_rate_cfg_default
+  },
+  {
+    APP_NV_POWER_PROFILE, sizeof( nv_power_profile_default ), &nv_power_profile_default
+  },
+  {
+    APP_NV_BOOT_COUNT, sizeof( nv_boot_count_default ), &nv_boot_count_default
+  },
+  {
+    APP_NV_OTA_STREAM, sizeof( nv_ota_stream_default ), &nv_ota_stream_default
+  },
+  {
+    APP_NV_OTA_JOURNAL, sizeof( nv_ota_journal_default ), &nv_ota_journal_default
+  },
+  {
+    APP_NV_OTA_THROTTLE_CFG, sizeof( nv_ota_throttle_cfg_default ), &nv_ota_throttle_cfg_default
+  },
   // Last item -- DO NOT MOVE IT!
   {
     0x00, 0, NULL
@@ -322,7 +507,7 @@ const appNVItemTab_t appNVItemTable[] =
     APP_NV_PANLIST_IDX, sizeof(nv_panlist_idx), &nv_panlist_idx
   },
   {
-    APP_NV_PANINFO_STRUCT, sizeof(NWInfo_t) * MAX_PANS_SCANNED, nv_pan_info_array
+    APP_NV_PAN_INFO, sizeof(NWInfo_t) * MAX_PANS_SCANNED, nv_pan_info_array
   },
   {
     APP_NV_GET_COORD_PARMS_FLAG, sizeof(nv_get_coord_parms_flag), &nv_get_coord_parms_flag
@@ -363,6 +548,36 @@ const appNVItemTab_t appNVItemTable[] =
   {
     APP_NV_APP_INSTANCE, sizeof( appInstance ), &appInstance
   },
+  {
+    APP_NV_JOIN_POLICY_WEIGHTS, sizeof( nv_join_policy_weights ), &nv_join_policy_weights
+  },
+  {
+    APP_NV_NWK_FINGERPRINT, sizeof( nv_nwk_fingerprint ), &nv_nwk_fingerprint
+  },
+  {
+    APP_NV_RETRY_BACKOFF, sizeof( nv_retry_backoff ), &nv_retry_backoff
+  },
+  {
+    APP_NV_ROAMING_CFG, sizeof( nv_roaming_cfg ), &nv_roaming_cfg
+  },
+  {
+    APP_NV_POLL_RATE_CFG, sizeof( nv_poll_rate_cfg ), &nv_poll_rate_cfg
+  },
+  {
+    APP_NV_POWER_PROFILE, sizeof( nv_power_profile ), &nv_power_profile
+  },
+  {
+    APP_NV_BOOT_COUNT, sizeof( nv_boot_count ), &nv_boot_count
+  },
+  {
+    APP_NV_OTA_STREAM, sizeof( nv_ota_stream ), &nv_ota_stream
+  },
+  {
+    APP_NV_OTA_JOURNAL, sizeof( nv_ota_journal ), &nv_ota_journal
+  },
+  {
+    APP_NV_OTA_THROTTLE_CFG, sizeof( nv_ota_throttle_cfg ), &nv_ota_throttle_cfg
+  },
   // Last item -- DO NOT MOVE IT!
   {
     0x00, 0, NULL
@@ -387,13 +602,116 @@ const CODE otaCrc_t OTA_CRC =
  **************************************************************************************************/
 byte PresenceSensor_TaskID; 
 
-static uint8 sleepCount = 0;
+// Join retries wait out joinRetryRemaining ms, handed out by joinBackoff
+static backoff_t joinBackoff;
+static uint32 joinRetryRemaining = 0;
+static backoff_t restartBackoff;
+
+// How quickly each device type gives up on its parent. Sensors that report
+// on every change lose data with every missed frame and give up sooner. The
+// last entry applies to every device type not listed.
+static const parentLossThresholds_t parentLossThresholdTable[] = {
+  { SYNERGY_OCCUPANCY_SENSOR, 3, 2 },
+  { SYNERGY_TESTBED_DEVICE,   6, 4 },
+  { SYNERGY_INVALID_DEVICE,   PARENT_LOSS_CONFIRM_FAILURES_DEFAULT, PARENT_LOSS_POLL_FAILURES_DEFAULT }
+};
+static const parentLossThresholds_t *parentLoss;
+static uint8 confirmFailures = 0;
+
+// Link quality of the current parent, see ProjectSpecific_CheckRoaming()
+static roamingMonitor_t roamMonitor;
+static uint8 roamingSearch = FALSE;
+
+// Poll rate of an active device, overridden while pollBurst is set by
+// ProjectSpecific_TurnUpPolling()
+static pollCtl_t pollCtl;
+static uint8 pollBurst = FALSE;
+
+// Radio on time, polls, frames and NV writes per deviceState_t and OTA, see
+// ProjectSpecific_SetRxOnIdle(), ProjectSpecific_SetPollRate() and
+// ProjectSpecific_NvWrite()
+static energyLedger_t energyLedger;
+static uint8 otaMode = FALSE;
+
+// Deep sleep without a reset, see ProjectSpecific_EnterHold(). RAM is kept
+// in PM2/PM3, so unlike APP_NV_RADIO_SLEEP_TIMER this needs no NV writes.
+static uint8 holdMode = FALSE;
+static uint16 holdCycles = 0;
+static uint8 zdoInitComplete = FALSE;
+
+// Windowed fetch of the missing OTA blocks, started by APP_MT_OTA_FETCH_START.
+// Without it the missing blocks are fetched one per OTA timer tick.
+static otaFetch_t otaFetch;
+static uint8 otaFetchActive = FALSE;
+static uint8 otaBlockSize = 0;
+
+// Units received during the windowed fetch. gpacketbitmap goes back to
+// the heap for the fetch, the bitmap in XNV holds the leaves instead.
+static sparseBm_t otaBitmap;
+static uint8 *otaBitmapSummary = NULL;
+
+// Blocks of the windowed fetch are journaled rather than written to the
+// bitmap in XNV one by one, see ProjectSpecific_OtaJournalBlock()
+static otaJournal_t otaJournal;
+
+// Decoders of a compressed or delta image, allocated for the fetch only,
+// how much of the image area they have written and how much they are to
+// write. A stream that would go past that has failed. The digest only
+// covers what was transferred; the CRC of the decoded image is kept up as
+// it is written and checked against otaStreamCrc once it is complete.
+static lzss_t *otaLzss = NULL;
+static delta_t *otaDelta = NULL;
+static uint32 otaStreamOffset = 0;
+static uint32 otaStreamLen = 0;
+static uint16 otaStreamCrc = 0;
+static uint16 otaStreamOutCrc = CRC16_INIT;
+static uint8 otaStreamFailed = FALSE;
+
+// Blocks carry a CRC, see OTA_FETCH_BLOCK_CRC. otaDigest sums the CRCs of
+// the blocks received so that the image checks out against the digest the
+// coordinator sent without reading it back.
+static uint8 otaBlockCrc = FALSE;
+static uint16 otaDigest = 0;
+static uint16 otaDigestExpected = 0;
+
+// Duty cycle budget of the fetch and the quiet window after sensor traffic.
+// While otaPaused is set the radio is back to the normal poll rate.
+static otaThrottle_t otaThrottle;
+static uint8 otaPaused = FALSE;
+
+// Multicast OTA, see OTA_FETCH_MULTICAST. No unicast requests go out
+// until nothing was broadcast to otaMcastGroup for otaMcastHold ms.
+static uint8 otaMcast = FALSE;
+static uint16 otaMcastGroup = 0;
+static uint16 otaMcastHold = 0;
+static uint32 otaMcastLast = 0;
+static uint16 otaMcastUnits = 0;
+
+// Serial output waiting for the UART driver, see ProjectSpecific_UartQueue()
+static txRing_t uartTx;
+
+// Latest trace records, see ProjectSpecific_Trace()
+static trace_t trace;
+
+// Energy detect pre-scan, see ProjSpecific_ScanforNetworks()
+static uint8 edScanDone = FALSE;
+static uint32 activeScanChannels = PRESENCE_SCAN_CANDIDATE_CHANNELS;
+static uint32 quietScanChannels = 0;
+static uint8 channelEnergy[SCAN_CHANNEL_LAST + 1];
+static void (*edScanSavedCB)( NLME_EDScanConfirm_t *EDScanConfirm ) = NULL;
 static uint16 elapsedTurns = 0;
 static uint8 rfShutdownCount = 0;
-static uint8 coordInfoResponses = 0;
 static uint8 BaseED_rf_shutdown_count = BaseED_RF_SHUTDOWN_REPEAT_COUNT;
 static uint8 check_network_status_count;
 static uint8 check_network_status_repeats;
+static uint8 rejoinInProgress = FALSE;
+
+// Set while we try to rejoin the fingerprinted network after a reset, along
+// with the network settings it replaced in case it doesn't work out
+static uint8 fingerprintRejoin = FALSE;
+static uint16 fingerprintSavedPanID;
+static uint32 fingerprintSavedChanList;
+static uint8 fingerprintSavedExtPanID[Z_EXTADDR_LEN];
 
 uint16 numbytes = 0;
 uint16 num_pkts = 0;
@@ -402,7 +720,6 @@ uint16 totalLQI = 0;
 int16 totalRSSI = 0;
 
 static uint8 laps = 0;
-static uint8 interPanMsgIndex = 0;
 
 uint16 currentDataRate = 0x00;
 uint8 currentLQIAvg = 0x00;
@@ -423,6 +740,7 @@ void BaseCoordinator_TestXNVMemory(void);
 void ProjSpecific_InitNvItems(void);
 void ProjSpecific_InitNvItemsToDefault(void);
 void ProjSpecific_CleanAllNVItems(void);
+static void ProjSpecific_MigratePanInfo(void);
 uint8 APPNVItemInit(uint16 id, uint16 len, void *buf, uint8 setDefault);
 uint8 SetAppNVItem(uint16 id, uint16 offset, void *buf);
 uint8 GetAppNVItem(uint16 id, void *buf);
@@ -430,27 +748,88 @@ int FindNVItemIndex(uint16 id);
 
 void ProjectSpecific_ProcessMTResp(mtOSALSerialData_t *MSGpkt);
 void ProjectSpecific_ProcessAppSpecificMTReq(uint8 *mt_buffer, uint8 mt_packet_len, uint16 shortAddr);
+uint8 ProjectSpecific_ProcessAppMTCmd(mtOSALSerialData_t *MSGpkt);
+static uint8 ProjectSpecific_ProcessAppMTCfg(uint8 cmd, uint8 *data, uint8 len, uint8 *rsp);
+static void ProjectSpecific_ApplyBackoffCfg(void);
+static uint8 ProjectSpecific_CheckPollCfg(const void *cfg);
+static void ProjectSpecific_ApplyPollCfg(void);
+static uint8 ProjectSpecific_CheckThrottleCfg(const void *cfg);
+static void ProjectSpecific_SendAppMTResp(uint8 cmd1, uint8 *payload, uint8 len, uint8 isOTA);
 void AppUDMT_SendMTRespWrapper(uint8 *mtbuff, uint8 mtbufflen, uint8 respType, bool isOTA);
 void ProjSpecific_ScanforNetworks(void);
+void ProjSpecific_EDScanConfirmCB(NLME_EDScanConfirm_t *EDScanConfirm);
 void *ZDO_NwkDiscCB(void *pBuff);
 void *ZDO_NwkLeaveCB(void *pBuff);
-void ProjectSpecific_PowerUpRadio(uint8 init, uint8 repeat);
+void ProjectSpecific_PowerUpRadio(uint8 init, uint16 repeat);
 void ProjectSpecific_PowerDownRadio(uint8 hold);
 void ProjectSpecific_PowerDownRadioTimer(void);
 void ProjectSpecific_TurnDownPolling(void);
 void ProjectSpecific_TurnUpPolling(void);
 void ProjSpecific_InitializePanList(void);
 void ProjectSpecific_PlannedRestart(void);
+void ProjectSpecific_EnterHold(uint16 cycles);
 void ProjectSpecific_StartCheckNwStatusEvt(uint8 delay);
 void ProjectSpecific_CheckNetworkStatus(void);
 void ProjectSpecific_JoinNextNw(void);
-void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen);
+uint8 ProjectSpecific_RejoinPan(uint16 panid, uint32 chanlist);
+void ProjectSpecific_ApplyNwkFingerprint(void);
+void ProjectSpecific_DropNwkFingerprint(void);
+void ProjectSpecific_SaveNwkFingerprint(void);
+void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen, uint8 linkQuality);
 void ProjectSpecific_ApplyJoinPolicy(void);
 void PresenceSensor_HandleNwkStatusCheck(void);
+void ProjectSpecific_InitRetryBackoff(void);
+void ProjectSpecific_ScheduleJoinRetry(void);
+void ProjectSpecific_CheckRoaming(void);
+void ProjectSpecific_InitParentLossDetector(void);
+void ProjectSpecific_ParentLost(uint8 orphanScan);
+void ProjectSpecific_ApplyPollRate(void);
+void ProjectSpecific_PollExchange(void);
+void ProjectSpecific_FinishRoamingSearch(void);
+void ProjectSpecific_SetRxOnIdle(uint8 rxOnIdle);
+void ProjectSpecific_SetPollRate(uint16 pollRate);
+uint8 ProjectSpecific_NvWrite(uint16 id, uint16 offset, uint16 len, void *buf);
+void ProjectSpecific_UpdateEnergyPhase(void);
+uint8 ProjectSpecific_SetPowerProfile(uint8 profile);
+static uint16 ProjectSpecific_OtaNextMissing(uint16 from);
+static uint16 ProjectSpecific_OtaMissingRun(uint16 first);
+static uint8 ProjectSpecific_OtaBitmapStart(void);
+static void ProjectSpecific_OtaBitmapEnd(void);
+static void ProjectSpecific_OtaBitmapClear(void);
+static void ProjectSpecific_OtaLeafRead(uint16 group, uint8 *leaf);
+static void ProjectSpecific_OtaLeafWrite(uint16 group, uint8 *leaf);
+void ProjectSpecific_OtaFetchService(void);
+static void ProjectSpecific_OtaPause(uint8 pause);
+void ProjectSpecific_OtaSensorTraffic(void);
+static uint8 ProjectSpecific_OtaMcastJoin(uint16 group, uint16 hold);
+static void ProjectSpecific_OtaMcastLeave(void);
+void ProjectSpecific_OtaBlockReceived(uint16 block, uint16 crc, uint8 *buf, uint8 len, uint8 mcast);
+uint16 ProjectSpecific_OtaSeedDigest(uint32 imageLen);
+uint8 ProjectSpecific_OtaLinkState(void);
+void ProjectSpecific_OtaNegotiateUnits(void);
+void ProjectSpecific_AbortOtaFill(void);
+void ProjectSpecific_OtaJournalStart(uint32 imageLen, uint16 digest);
+void ProjectSpecific_OtaJournalBlock(uint16 block);
+void ProjectSpecific_OtaJournalFlush(void);
+void ProjectSpecific_OtaJournalClose(void);
+void ProjectSpecific_OtaJournalReplay(void);
+static void ProjectSpecific_OtaJournalWrite(uint8 slot, otaJournalRecord_t *rec);
+static void ProjectSpecific_OtaJournalCompact(void);
+uint8 ProjectSpecific_OtaStartStream(uint8 flags, uint32 imageLen, uint16 imageCrc);
+void ProjectSpecific_OtaEndStream(void);
+uint8 ProjectSpecific_OtaStreamComplete(void);
+uint8 ProjectSpecific_OtaStreamFailed(void);
+static void ProjectSpecific_OtaStreamBlock(uint8 *buf, uint8 len);
+static void ProjectSpecific_OtaPatch(uint8 *buf, uint16 len);
+static void ProjectSpecific_ReadRunningImage(uint32 offset, uint8 *buf, uint16 len);
+static uint32 ProjectSpecific_RunningImageLen(void);
 static void ProjectSpecific_CallBack(uint8 port, uint8 event);
 uint8 ProjectSpecific_GetCommissionStatus(void);
 void ProjectSpecific_SendLeaveReq(void);
 uint16 ProjectSpecific_UartWrite(uint8 port, uint8 *buf, uint16 len);
+static uint16 ProjectSpecific_UartQueue(uint8 port, uint8 *buf, uint16 len);
+static void ProjectSpecific_UartDrain(void);
+static uint16 ProjectSpecific_UartTxWrite(uint8 *buf, uint16 len);
 void ProjectSpecific_HexDump(uint8 *ptr, uint16 len);
 static void ParseSerialCommand(void);
 void ProjectSpecific_SendMTResp(uint8 *mtbuff, uint8 mtbufflen, uint8 respType);
@@ -477,10 +856,11 @@ void ProjSpecific_InitDevice( uint8 task_id )
  
   // Record TaskID
   PresenceSensor_TaskID = task_id;
+  AppTimer_Init(task_id, APP_TIMER_EVT);
   
   // Turn off IDLE receive
   uint8 RxOnIdle = TRUE;
-  ZMacSetReq( ZMacRxOnIdle, &RxOnIdle );
+  ProjectSpecific_SetRxOnIdle(RxOnIdle);
   
   uartConfig.configured           = TRUE;              // 2x30 don't care - see uart driver.
   uartConfig.baudRate             = HAL_UART_BR_57600; //HAL_UART_BR_38400; //HAL_UART_BR_115200;
@@ -491,6 +871,8 @@ void ProjSpecific_InitDevice( uint8 task_id )
   uartConfig.idleTimeout          = 6;                 // 2x30 don't care - see uart driver.
   uartConfig.intEnable            = TRUE;              // 2x30 don't care - see uart driver.
   uartConfig.callBackFunc         = ProjectSpecific_CallBack;
+  TxRing_Init(&uartTx, UART_TX_POLICY);
+  Trace_Init(&trace);
   HalUARTOpen (ZBC_PORT, &uartConfig);
 
   //SProjectSpecific_UartWrite(ZBC_PORT, (unsigned char *)MSG0, MSG0_LEN); 
@@ -506,7 +888,7 @@ void ProjSpecific_InitDevice( uint8 task_id )
   GetAppNVItem(APP_NV_CLEAN_ALL_NV_ITEMS, &cleanflag);
   if (cleanflag == true)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "NTC\n\r", 5); 
+    APP_TRACE(TRC_NV_CLEANED);
     // Means we have set this flag to tell ourselves to clean all NV items
     ProjSpecific_CleanAllNVItems();
     
@@ -516,23 +898,33 @@ void ProjSpecific_InitDevice( uint8 task_id )
     
     // Need to reset security key here too so that the commissioning key is used
     uint8 commissioning_key[] = DEFAULT_KEY;
-    osal_nv_write(ZCD_NV_PRECFGKEY, 0, SEC_KEY_LEN, commissioning_key);
+    ProjectSpecific_NvWrite(ZCD_NV_PRECFGKEY, 0, SEC_KEY_LEN, commissioning_key);
     // Need to reset the PAN to commissioning PAN here
     uint16 cpan = COMMISSIONING_PAN;
-    osal_nv_write(ZCD_NV_PANID, 0, osal_nv_item_len(ZCD_NV_PANID), &cpan);
+    ProjectSpecific_NvWrite(ZCD_NV_PANID, 0, osal_nv_item_len(ZCD_NV_PANID), &cpan);
       
     // The device will now powereup as a non-commissionined device. 
     osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, 5000);
   }
   else
   {
-    // "NNTC" = Non Need To Clean
-    ProjectSpecific_UartWrite(ZBC_PORT, "NNTC\n\r", 6); 
+    APP_TRACE(TRC_NV_KEPT);
   }
   
   //Init the app instance structure
   ProjectSpecific_InitAppInstance(task_id);
   
+  // Needs the IEEE address from the app instance to seed the jitter
+  ProjectSpecific_InitRetryBackoff();
+  ProjectSpecific_InitParentLossDetector();
+  PollCtl_Init(&pollCtl, zgPollRate, &nv_poll_rate_cfg);
+  {
+    uint8 rxOnIdle = FALSE;
+    ZMacGetReq( ZMacRxOnIdle, &rxOnIdle );
+    Energy_Init(&energyLedger, osal_GetSystemClock(), nv_commissioned_status, rxOnIdle, zgPollRate);
+    ProjectSpecific_UpdateEnergyPhase();
+  }
+  
   MT_RegisterAppTaskId(task_id); //Register our task ID with MT_TASK
   ANALED1_OFF();
   ANALED2_OFF();
@@ -546,14 +938,23 @@ void ProjSpecific_InitDevice( uint8 task_id )
   // and joins the PAN with the highest LQI
   if(nv_commissioned_status == DEVICE_COMMISSIONED)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "DC\n\r", 4); 
+    APP_TRACE(TRC_DEVICE_COMMISSIONED);
     // Start timer that will initiate scanning of nearby PANs. But do this only if we have been already 
     // device commissioned. Without being device commissioned, the node will try to attach itself to the commissioning PAN.
 #if RFD_RCVC_ALWAYS_ON==FALSE
     if (nv_coord_reset != COORD_RESET_PLANNED)
 #endif
     {
-      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT, PRESENCE_SCAN_NETWORKS_TIMER);
+      if (nv_nwk_fingerprint.commStatus != NON_COMMISSIONED) {
+        // We were happily joined before the reset; try to get straight back onto that
+        // network and only scan if it hasn't worked out by the time the timer fires
+        APP_TRACE(TRC_FINGERPRINT_REJOIN);
+        ProjectSpecific_ApplyNwkFingerprint();
+        osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT, PRESENCE_FINGERPRINT_REJOIN_TIMER);
+      }
+      else {
+        osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT, PRESENCE_SCAN_NETWORKS_TIMER);
+      }
     }
   }
 
@@ -563,7 +964,7 @@ void ProjSpecific_InitDevice( uint8 task_id )
   // data statistics (should probably change this so it doesn't happen every time)
   else if(nv_commissioned_status == NETWORK_COMMISSIONING_IN_PROGRESS)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "CIP\n\r", 5);
+    APP_TRACE(TRC_COMMISSIONING);
     uint8 comm_flag = NETWORK_COMMISSIONED;
     SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_flag);
   }
@@ -579,13 +980,13 @@ void ProjSpecific_InitDevice( uint8 task_id )
   // Deprecated for now... figure out a way to work it back in
   else if(nv_commissioned_status == NETWORK_COMMISSIONING_COMPLETED)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "CC\n\r", 4); 
+    APP_TRACE(TRC_COMMISSIONING_DONE);
     // Since network commissioning is completed, mark the device as 'ACTIVE' so that
     // it can do whatever it was destined to do
     uint8 comm_stat = DEVICE_ACTIVE;
     SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_stat);
     // This timer is needed only when the device is active, so we are setting this up after we know we are active
-    osal_start_reload_timer(PresenceSensor_TaskID, PRESENCE_DATARATE_CALC_EVT, PRESENCE_DATARATE_SAMPLE_TIMER);
+    AppTimer_StartReload(PRESENCE_DATARATE_CALC_EVT, PRESENCE_DATARATE_SAMPLE_TIMER, PRESENCE_DATARATE_SLACK);
   }
   
   /**********************
@@ -595,12 +996,14 @@ void ProjSpecific_InitDevice( uint8 task_id )
   if(nv_commissioned_status == DEVICE_ACTIVE)
   {
       osal_start_timerEx(task_id, BaseED_NWK_JOIN_STATUS_EVT, BaseED_NWK_JOIN_STATUS_TIMEOUT);
+      // Also drives the roaming monitor, so it has to run after every boot
+      AppTimer_StartReload(PRESENCE_DATARATE_CALC_EVT, PRESENCE_DATARATE_SAMPLE_TIMER, PRESENCE_DATARATE_SLACK);
   }
   #if RFD_RCVC_ALWAYS_ON==FALSE
   else if (nv_commissioned_status == NON_COMMISSIONED || nv_coord_reset == COORD_RESET_PLANNED) {
     devState = DEV_HOLD;
     uint8 RxOnIdle = FALSE;
-    ZMacSetReq( ZMacRxOnIdle, &RxOnIdle );
+    ProjectSpecific_SetRxOnIdle(RxOnIdle);
     
     // There is probably already a timer set to start network initialization
     // Turn it off before it starts the scanning process
@@ -615,27 +1018,19 @@ void ProjSpecific_InitDevice( uint8 task_id )
    */
   if (nv_commissioned_status != NON_COMMISSIONED) {
     if (nv_coord_reset == COORD_RESET_PLANNED) {
-      #ifdef DEBUG
-      //ProjectSpecific_UartWrite(ZBC_PORT, "Planned Rst\r\n", 13);
-      ProjectSpecific_UartWrite(ZBC_PORT, "Sleeping for: ", 14);
-      ProjectSpecific_HexDump((uint8*) &nv_radio_sleep_timer_cnt, 2);
-      #endif
+      APP_TRACE1(TRC_PLANNED_RESET_SLEEP, nv_radio_sleep_timer_cnt);
       
       //Set event to turn radio on after time specified by nv radio off timer length.      
       #if RFD_RCVC_ALWAYS_ON==FALSE
-      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RADIO_ON_EVT, RADIO_SLEEP_TIMER_DEFAULT );
+      AppTimer_Start(PRESENCE_RADIO_ON_EVT, RADIO_SLEEP_TIMER_DEFAULT, PRESENCE_HOLD_SLACK);
       #endif
     }
     else if (nv_coord_reset == COORD_RESET_NORMAL) {
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "Normal Rst\r\n", 12);
-      #endif
+      APP_TRACE(TRC_RESET_NORMAL);
       ProjectSpecific_StartCheckNwStatusEvt(PRESENCE_NORMAL_RESET_DELAY);
     }
     else {
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "Immediate Rst\r\n", 15);
-      #endif
+      APP_TRACE(TRC_RESET_IMMEDIATE);
       ProjectSpecific_StartCheckNwStatusEvt(0);
     }
   }
@@ -644,15 +1039,7 @@ void ProjSpecific_InitDevice( uint8 task_id )
   uint8 rst = APP_NV_COORD_RESET_DEFAULT;
   SetAppNVItem(APP_NV_COORD_RESET, 0, &rst);
 
-  {
-  uint16 pan = 0;
-  uint8 strbuff[6] = {0};
-  pan = zgConfigPANID;
-  _itoa(pan, strbuff, 16);
-  ProjectSpecific_UartWrite(ZBC_PORT, "\n\r****\n\r", 8); 
-  ProjectSpecific_UartWrite(ZBC_PORT, strbuff, 4); 
-  ProjectSpecific_UartWrite(ZBC_PORT, "\n\r****\n\r", 8); 
-  }
+  APP_TRACE1(TRC_PAN, zgConfigPANID);
 
   //Hack for now
   /*if(nv_commissioned_status == DEVICE_ACTIVE)
@@ -668,7 +1055,9 @@ void ProjSpecific_InitDevice( uint8 task_id )
 
 void ProjectSpecific_CheckNetworkStatus() {
   if (get_nwk_status() != NWK_JOINED) {
-    ProjectSpecific_UartWrite(ZBC_PORT, "Not joined!\r\n", 13);
+    APP_TRACE(TRC_NOT_JOINED);
+    // Whatever rejoin was under way didn't make it
+    rejoinInProgress = FALSE;
     uint8 comm_flag;
     if (nv_get_coord_parms_flag) {
       comm_flag = NETWORK_COMMISSIONING_IN_PROGRESS;
@@ -681,7 +1070,7 @@ void ProjectSpecific_CheckNetworkStatus() {
     osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT, PRESENCE_GATHER_NW_PARMS_TIMER);
   }
   else {
-    ProjectSpecific_UartWrite(ZBC_PORT, "Still joined!\r\n", 15); 
+    APP_TRACE(TRC_STILL_JOINED);
   }
 }
 
@@ -690,7 +1079,7 @@ void ProjectSpecific_StartCheckNwStatusEvt(uint8 delay) {
   check_network_status_count = 0;
   if (delay) {
     check_network_status_repeats = delay;
-    osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_CHECK_NETWORK_STATUS_EVT, PRESENCE_CHECK_NETWORK_STATUS_TIMER);
+    AppTimer_Start(PRESENCE_CHECK_NETWORK_STATUS_EVT, PRESENCE_CHECK_NETWORK_STATUS_TIMER, PRESENCE_CHECK_NETWORK_STATUS_SLACK);
   }
   else {
     check_network_status_repeats = 0;
@@ -708,10 +1097,51 @@ void ProjSpecific_ZDO_state_change( void )
 {
   //uint8 status = 0;
   //uint16 newval = 2;
-  static uint16 sA = 0;
-  uint8 strbuff[6] = {0};
   
-  ProjectSpecific_UartWrite(ZBC_PORT, "SChange\n\r", 9);
+  APP_TRACE1(TRC_STATE_CHANGE, devState);
+  
+  // Joined, the next failure starts backing off from scratch
+  Backoff_Success(&joinBackoff);
+  
+  // Whatever we knew about the link belonged to the previous parent
+  Roaming_Reset(&roamMonitor);
+  roamingSearch = FALSE;
+  
+  // In-place rejoin, roam or wake from a hold made it, the fallback reset
+  // is no longer needed and neither is the RF shutdown, which would only
+  // put the device back into a hold. An active device turns the receiver
+  // back off and polls.
+  if (rejoinInProgress) {
+    rejoinInProgress = FALSE;
+    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT);
+    AppTimer_Stop(BaseED_RF_SHUTDOWN_EVT);
+    #if RFD_RCVC_ALWAYS_ON==FALSE
+    if (nv_commissioned_status == DEVICE_ACTIVE && !otaMode) {
+      ProjectSpecific_PowerDownRadio(0);
+    }
+    #endif
+  }
+  
+  // Back on the fingerprinted network: skip the discovery and pick up where we left off
+  if (fingerprintRejoin) {
+    fingerprintRejoin = FALSE;
+    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT);
+    uint8 parmsFlag = 0;
+    SetAppNVItem(APP_NV_GET_COORD_PARMS_FLAG, 0, &parmsFlag);
+    SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &nv_nwk_fingerprint.commStatus);
+    APP_TRACE(TRC_FINGERPRINT_JOINED);
+    // Boot saw DEVICE_COMMISSIONED and left the timers of an active device alone
+    if (nv_commissioned_status == DEVICE_ACTIVE) {
+      osal_start_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_STATUS_EVT, BaseED_NWK_JOIN_STATUS_TIMEOUT);
+      AppTimer_StartReload(PRESENCE_DATARATE_CALC_EVT, PRESENCE_DATARATE_SAMPLE_TIMER, PRESENCE_DATARATE_SLACK);
+    }
+  }
+  
+  // Remember this network if we mean to stay on it
+  if (nv_commissioned_status == DEVICE_ACTIVE ||
+      (nv_commissioned_status == NETWORK_COMMISSIONED && !nv_get_coord_parms_flag)) {
+    ProjectSpecific_SaveNwkFingerprint();
+  }
   
 #ifdef TESTBED_ANAREN_DEVICE
   osal_start_timerEx(PresenceSensor_TaskID, BaseED_TESTBED_PERIODIC_PACKET_EVT, nv_unit_timer_value);
@@ -722,11 +1152,13 @@ void ProjSpecific_ZDO_state_change( void )
   {
     //Turn on the LED to indicate that it has associated
 
-    osal_stop_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT);
-    osal_stop_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT);
+    AppTimer_Stop(BaseED_RF_SHUTDOWN_EVT);
+    AppTimer_Stop(BaseED_TOGGLE_LED_EVT);
     uint8 rxOnIdle = TRUE;
-    ZMacSetReq( ZMacRxOnIdle, &rxOnIdle );
-    HAL_TURN_ON_LED_PRESENCE();
+    ProjectSpecific_SetRxOnIdle(rxOnIdle);
+    if (APP_VERBOSE()) {
+      HAL_TURN_ON_LED_PRESENCE();
+    }
     ProjectSpecific_PowerDownRadioTimer();
   }
   uint16 count = 1;
@@ -739,13 +1171,7 @@ void ProjSpecific_ZDO_state_change( void )
   if (nv_commissioned_status == DEVICE_ACTIVE)
   {
    ANALED2_ON();
-   ProjectSpecific_UartWrite(ZBC_PORT, "ACT\n\r", 5);
-   
-   sA = nv_unit_timer_value;
-   _itoa(sA, strbuff, 10);
-   ProjectSpecific_UartWrite(ZBC_PORT, "\n\rXXX\n\r", 8); 
-   ProjectSpecific_UartWrite(ZBC_PORT, strbuff, 4); 
-   ProjectSpecific_UartWrite(ZBC_PORT, "\n\rXXX\n\r", 8); 
+   APP_TRACE1(TRC_ACTIVE, nv_unit_timer_value);
    
    // Also start the timer to send out the device announce packet
    osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_DEV_ANNOUNCE_EVT, 3000);
@@ -757,18 +1183,36 @@ void ProjSpecific_ZDO_state_change( void )
     uint16 initJitter = Onboard_rand() | PRESENCE_SEND_COORD_INIT_PACKET_TIMER;
     osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_COORD_INIT_PACKET_EVT, initJitter);
     ANALED2_ON();
-    ProjectSpecific_UartWrite(ZBC_PORT, "INP\n\r", 5);
+    APP_TRACE(TRC_SEND_INIT);
   }
   else if (appInstance.otaStatus != NOT_IN_PROGRESS) { 
     if (appInstance.panid == pan) {
-      if (gpacketbitmap)
+      // A rejoin in the middle of a windowed fetch carries on with the two
+      // level bitmap it has, the flat one is only for the one by one fill
+      if (!otaFetchActive)
+      {
+        if (gpacketbitmap)
+        {
+            BM_FREE(gpacketbitmap);
+            gpacketbitmap = NULL;
+        }
+        gtotalpackets = appInstance.totalpackets;
+        gpacketbitmap = BM_ALLOC(appInstance.totalpackets);
+        XNV_Read(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, gpacketbitmap, 0, BM_MAX_BYTES(appInstance.totalpackets));
+        // Blocks received since the bitmap was last written out
+        ProjectSpecific_OtaJournalReplay();
+      }
+      if (nv_ota_stream && !otaFetchActive)
+      {
+        // The decoders of a compressed or delta stream went with the reset and
+        // the one by one fill would store its coded bytes as they are. The
+        // coordinator starts the stream over from its first unit.
+        ProjectSpecific_AbortOtaFill();
+      }
+      else if (otaFetchActive && !ProjectSpecific_OtaBitmapStart())
       {
-          BM_FREE(gpacketbitmap);
-          gpacketbitmap = NULL;
+        ProjectSpecific_AbortOtaFill();
       }
-      gtotalpackets = appInstance.totalpackets;
-      gpacketbitmap = BM_ALLOC(appInstance.totalpackets);
-      XNV_Read(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, gpacketbitmap, 0, BM_MAX_BYTES(appInstance.totalpackets));
     
       switch (appInstance.otaStatus) {
         case IN_PROGRESS:
@@ -811,7 +1255,13 @@ void ProjSpecific_ZDO_state_change( void )
  */
 UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
 {
-    
+  // Sets the events of all application timers that are due
+  if (events & APP_TIMER_EVT)
+  {
+    AppTimer_Service();
+    return (events ^ APP_TIMER_EVT);
+  }
+  
   if(events & PRESENCE_TIMER_DEV_ANNOUNCE_EVT)
   {
     AppUDMT_SendDeviceAnnounceCmd(true);  //this sends out the device announce packet
@@ -826,24 +1276,45 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   
   if (events & PRESENCE_RADIO_ON_EVT)
   {
-    GetAppNVItem(APP_NV_RADIO_SLEEP_TIMER, &nv_radio_sleep_timer_cnt );
+    // A hold sleeps all its cycles off in one timer. Only a planned restart
+    // through a reset still counts them down in NV.
+    if (!holdMode)
+    {
+      GetAppNVItem(APP_NV_RADIO_SLEEP_TIMER, &nv_radio_sleep_timer_cnt );
+    }
     
     // If this is not the last repitition, store decremented value of count back to NV
     // And set a new timer of the same length.
-    if ( (--nv_radio_sleep_timer_cnt) != 0 )
+    if ( !holdMode && (--nv_radio_sleep_timer_cnt) != 0 )
     {
       SetAppNVItem( APP_NV_RADIO_SLEEP_TIMER, 0, &nv_radio_sleep_timer_cnt );
       
-      ProjectSpecific_UartWrite(ZBC_PORT, "keep sleeping: ", 15);
-      ProjectSpecific_HexDump((uint8*) &nv_radio_sleep_timer_cnt, 2);
-      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RADIO_ON_EVT, RADIO_SLEEP_TIMER_DEFAULT );
+      APP_TRACE1(TRC_KEEP_SLEEPING, nv_radio_sleep_timer_cnt);
+      AppTimer_Start(PRESENCE_RADIO_ON_EVT, RADIO_SLEEP_TIMER_DEFAULT, PRESENCE_HOLD_SLACK);
     }
     else
     {
-      // Turn on radio and initialize device
-      ProjectSpecific_PowerUpRadio(1, 0);
+      holdMode = FALSE;
+      holdCycles = 0;
+      ProjectSpecific_SetPollRate(zgPollRate);
+      NLME_SetQueuedPollRate(zgQueuedPollRate);
+      NLME_SetResponseRate(zgResponsePollRate);
+      
+      // Turn on radio and initialize device. An active device is only
+      // rejoining, the RF shutdown would hold it again two minutes later;
+      // the receiver goes off once it is back, see ProjSpecific_ZDO_state_change().
+      if (nv_commissioned_status == DEVICE_ACTIVE) {
+        rejoinInProgress = TRUE;
+        ProjectSpecific_PowerUpRadio(1, 0xFFFF);
+      }
+      else {
+        ProjectSpecific_PowerUpRadio(1, 0);
+      }
+      if (nv_commissioned_status == DEVICE_ACTIVE) {
+        AppTimer_StartReload(PRESENCE_DATARATE_CALC_EVT, PRESENCE_DATARATE_SAMPLE_TIMER, PRESENCE_DATARATE_SLACK);
+      }
       //start a timer to see if it should join a new PAN
-      ProjectSpecific_UartWrite(ZBC_PORT, "pwr up!\r\n", 9);
+      APP_TRACE(TRC_POWER_UP);
       if (nv_commissioned_status == DEVICE_COMMISSIONED) {
         osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT, PRESENCE_SCAN_NETWORKS_TIMER);
       }
@@ -855,65 +1326,27 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   
   if (events & PRESENCE_SEND_COORD_INIT_PACKET_EVT) 
   {
-    interPanMsgIndex = 0;
-    coordInfoResponses = 0;
     uint8 parmsFlag = 0;
     SetAppNVItem(APP_NV_GET_COORD_PARMS_FLAG, 0, &parmsFlag);
     ProjectSpecific_TurnUpPolling();
     ProjectSpecific_PowerUpRadio(0, 2);
+    // The query ends the gather itself once every coordinator has answered or
+    // timed out, the gather timer only backs it up.
+    uint16 gatherTimeout = InterPanQuery_Start(nv_pan_info_array, nv_num_discovered_nwks);
     osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT, PRESENCE_SEND_INTER_PAN_INIT_TIMER);
-    osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT, 30000);
+    osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT, gatherTimeout);
     return (events ^ PRESENCE_SEND_COORD_INIT_PACKET_EVT);
   }
   
   if (events & PRESENCE_SEND_INTER_PAN_INIT_EVT) {
-    StubAPS_RegisterApp((endPointDesc_t *)&BaseED_epDesc);
-    // We store channel using a bit in a 32 bit field, StubAPS requires it as an 8 bit integer
-    uint32 channelBit = nv_pan_info_array[interPanMsgIndex].channel;
-    uint8 channel = 0;
-    while (channelBit & 0xFFFFFFFE) {
-      channelBit = channelBit >> 1;
-      ++channel;
+    uint16 next = InterPanQuery_Process();
+    if (next) {
+      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT, next);
     }
-    ZStatus_t chanResult = StubAPS_SetInterPanChannel(channel);
-    ProjectSpecific_UartWrite(ZBC_PORT, "Chan Change: ", 13);
-    ProjectSpecific_HexDump(&chanResult, 1);
-    
-    uint16 panid = nv_pan_info_array[interPanMsgIndex].panID;
-    uint16 addr = nv_pan_info_array[interPanMsgIndex].address;
-    
-    uint16 devicePan;
-    osal_nv_read( ZCD_NV_PANID, 0, sizeof( devicePan ), &devicePan ); 
-    
-    // Here we send out a packet that will ask the coordinator to send their 'info'
-    // packet. Which is nothing but a UD-MT packet.
-    uint8 initreq[7];    
-    initreq[0] = MT_SOF;
-    initreq[1] = 0x02;
-    initreq[2] = 0x2B;
-    initreq[3] = 0x08;
-    initreq[4] = LO_UINT16(devicePan);
-    initreq[5] = HI_UINT16(devicePan);
-    initreq[6] = CalcFCS(initreq+1, MT_UD_HDR_LEN + 2);
-    
-    #ifdef DEBUG
-    ProjectSpecific_UartWrite(ZBC_PORT, "INIT: ", 6);
-    ProjectSpecific_HexDump((uint8*) &(nv_pan_info_array[interPanMsgIndex].panID), 2);
-    #endif //DEBUG
-
-    #ifdef INTER_PAN
-    BaseED_SendInterPan(CORECOMMS_CLUSTER, END_DEVICE_MESSAGE_TYPE_OTA_MT_REQ, 
-                0,
-                panid,
-                addr,
-                7, 
-                initreq);
-    StubAPS_SetIntraPanChannel();
-    #endif //INTER_PAN
-    
-    ++interPanMsgIndex;
-    if (interPanMsgIndex < nv_num_discovered_nwks) {
-      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT, PRESENCE_SEND_INTER_PAN_INIT_TIMER);
+    else {
+      // Every coordinator answered or timed out, no need to wait for the gather timeout
+      osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT);
+      osal_set_event(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT);
     }
 
     return (events ^ PRESENCE_SEND_INTER_PAN_INIT_EVT);
@@ -922,7 +1355,7 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   if (events & PRESENCE_CHECK_NETWORK_STATUS_EVT) {
     ++check_network_status_count;
     if (check_network_status_count < check_network_status_repeats) {
-      osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_CHECK_NETWORK_STATUS_EVT, PRESENCE_CHECK_NETWORK_STATUS_TIMER);
+      AppTimer_Start(PRESENCE_CHECK_NETWORK_STATUS_EVT, PRESENCE_CHECK_NETWORK_STATUS_TIMER, PRESENCE_CHECK_NETWORK_STATUS_SLACK);
     }
     else {
       ProjectSpecific_CheckNetworkStatus();
@@ -933,21 +1366,29 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   if(events & PRESENCE_GATHER_NW_PARMS_EVT)
   {
     //ANALED2_OFF();
-    ProjectSpecific_UartWrite(ZBC_PORT, "LNW\n\r", 5); 
+    APP_TRACE(TRC_NWK_PARMS_GATHERED);
+    // Coordinators still silent by now are not waited for any longer
+    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
+    InterPanQuery_Stop();
+    // A background search of the roaming monitor, not commissioning
+    if (roamingSearch) {
+      ProjectSpecific_FinishRoamingSearch();
+      return (events ^ PRESENCE_GATHER_NW_PARMS_EVT);
+    }
     // First we leave current network, if we already have joined one
     if (get_nwk_status() == NWK_JOINED)
     {
       //ANALED1_ON();
       //ZDO_RegisterForZdoCB(ZDO_LEAVE_CNF_CBID, ZDO_NwkLeaveCB);
       //ProjectSpecific_SendLeaveReq();
-      ProjectSpecific_UartWrite(ZBC_PORT, "NNW=J\n\r", 7); 
+      APP_TRACE(TRC_NEXT_NWK_LEAVE);
       ProjectSpecific_ApplyJoinPolicy();
     }
     else
     {
       // Since we are not connected to any network and don't have to do a leave, we can
       // directly start the JoinNext process here.
-      ProjectSpecific_UartWrite(ZBC_PORT, "NNW=NJ\n\r", 8); 
+      APP_TRACE(TRC_NEXT_NWK);
       ProjectSpecific_JoinNextNw();
     }
     return (events ^ PRESENCE_GATHER_NW_PARMS_EVT);
@@ -984,16 +1425,13 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   if (events & BaseED_RF_SHUTDOWN_EVT) {
     if (rfShutdownCount < BaseED_rf_shutdown_count - 1) {
       ++rfShutdownCount;
-      ProjectSpecific_UartWrite(ZBC_PORT, "rfShutdownCount: ", 17);
-      ProjectSpecific_HexDump(&rfShutdownCount, 1);
-      osal_start_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT);
+      APP_TRACE1(TRC_RF_SHUTDOWN_COUNT, rfShutdownCount);
+      AppTimer_Start(BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT, BaseED_RF_SHUTDOWN_SLACK);
     }
     else {
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "RF Shutdown\r\n", 13);
-      #endif
+      APP_TRACE(TRC_RF_SHUTDOWN);
       
-      osal_stop_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT);
+      AppTimer_Stop(BaseED_TOGGLE_LED_EVT);
 
       #if RFD_RCVC_ALWAYS_ON==FALSE  //TODO Move these to project specific
 
@@ -1013,12 +1451,17 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
     #if RFD_RCVC_ALWAYS_ON==FALSE
     HAL_TOGGLE_LED_PRESENCE();
     #endif
-    osal_start_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT, BaseED_TOGGLE_LED_TIMER);
+    AppTimer_Start(BaseED_TOGGLE_LED_EVT, BaseED_TOGGLE_LED_TIMER, BaseED_TOGGLE_LED_SLACK);
     return (events ^ BaseED_TOGGLE_LED_EVT);
   }
   
   if (events & PRESENCE_SCAN_NETWORKS_EVT)
   {
+    if (fingerprintRejoin) {
+      // The direct rejoin didn't make it, do the full discovery instead
+      APP_TRACE(TRC_FINGERPRINT_FAILED);
+      ProjectSpecific_DropNwkFingerprint();
+    }
     // Register for the Callback first
     ZDO_RegisterForZdoCB(ZDO_NWK_DISCOVERY_CNF_CBID, ZDO_NwkDiscCB);
     ProjSpecific_ScanforNetworks();
@@ -1028,6 +1471,20 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
   if (events & PRESENCE_TIMER_OTA_TIMEOUT_EVT)
   {
     #define OTA_MAX_MISSING_PACKET_ATTEMPTS 3600 // Define this somewhere else
+    if (otaFetchActive)
+    {
+      // Request deadlines rather than ticks drive the windowed fetch. Things
+      // have gone quiet, so write out the run the journal held back.
+      ProjectSpecific_OtaJournalFlush();
+      ProjectSpecific_OtaFetchService();
+      return (events ^ PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+    }
+    if (nv_ota_stream)
+    {
+      // A coded stream is never filled in one by one, see ProjSpecific_ZDO_state_change()
+      ProjectSpecific_AbortOtaFill();
+      return (events ^ PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+    }
     elapsedTurns++;
     if (gtotalMissingPackets && elapsedTurns < OTA_MAX_MISSING_PACKET_ATTEMPTS)
     {
@@ -1035,15 +1492,7 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
     }
     else if(elapsedTurns >= nv_xnv_ota_repeat_count_value)
     {
-      elapsedTurns = 0;
-      appInstance.otaStatus = NOT_IN_PROGRESS;
-      SetAppNVItem(APP_NV_APP_INSTANCE, 0, &appInstance);
-      ProjectSpecific_UartWrite(ZBC_PORT, "OAD Fill-in aborted!\n", 21);
-    
-      //Step1: Turn OFF the MAC for idle
-      //Step2: restore the broadcast parameters
-      //Step3: restore the polling rate
-      ProjectSpecific_RestoreToNormalMode();    
+      ProjectSpecific_AbortOtaFill();
     }
     else
     {
@@ -1055,29 +1504,29 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
    
   if (events & BaseED_NWK_JOIN_STATUS_EVT)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, (unsigned char *)MSG1, MSG1_LEN);  
+    APP_TRACE(TRC_CHECK_NWK_STATUS);
     PresenceSensor_HandleNwkStatusCheck();                //we call function to check our network status, i.e. whether we are joined to a coordinator or not.
     return (events ^ BaseED_NWK_JOIN_STATUS_EVT);
   }
   
   if (events & BaseED_NWK_JOIN_RETRY_EVT)
   {
-    sleepCount++;
-    if (sleepCount >= BaseED_NWK_JOIN_RETRY_REPEAT_COUNT)
+    if (joinRetryRemaining == 0)
     {
-        sleepCount = 0;  //Need to reset this for the next iteration
         // Start the timer again, to check the status after sometime
-        ProjectSpecific_UartWrite(ZBC_PORT, (unsigned char *)MSG2, MSG2_LEN); 
+        APP_TRACE(TRC_WAKE_REJOIN);
         osal_start_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_STATUS_EVT, BaseED_NWK_JOIN_STATUS_TIMEOUT);
         uint8 RxOnIdle = TRUE;
-        ZMacSetReq( ZMacRxOnIdle, &RxOnIdle );
+        ProjectSpecific_SetRxOnIdle(RxOnIdle);
         ZDApp_StartJoiningCycle();
         nwkJoinAttemptCount++;  //now increment the counter which counts how many times we have tried to join our network
     }
     else
     {
-        // Start the timer for the next interval
-        osal_start_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_RETRY_EVT, BaseED_NWK_JOIN_RETRY_TIMEOUT);
+        // Sleep off the whole backoff delay, application timers aren't
+        // limited to 16 bit like OSAL timers
+        AppTimer_Start(BaseED_NWK_JOIN_RETRY_EVT, joinRetryRemaining, BaseED_NWK_JOIN_RETRY_SLACK);
+        joinRetryRemaining = 0;
     }
     return (events ^ BaseED_NWK_JOIN_RETRY_EVT);
   }
@@ -1109,6 +1558,10 @@ UINT16 ProjectSpecific_ProcessEvent( UINT16 events )
       currentRSSIAvg = rssi;
       totalRSSI = 0;  // reset totalRSSI for next iteration
     }
+    ProjectSpecific_CheckRoaming();
+    // Also catches up on changes made while the controller was held off
+    PollCtl_Tick(&pollCtl);
+    ProjectSpecific_ApplyPollRate();
     return ( events ^ PRESENCE_DATARATE_CALC_EVT );
   }  
   
@@ -1129,6 +1582,43 @@ void ProjectSpecific_ProcessSystemEvent( afIncomingMSGPacket_t *MSGpkt )
 {
   switch ( MSGpkt->hdr.event )
   {
+    case AF_INCOMING_MSG_CMD:
+      // Replies from other PANs during a query say nothing about our parent
+      if (!roamingSearch && !InterPanQuery_Busy()) {
+        Roaming_RxSample(&roamMonitor, MSGpkt->LinkQuality, MSGpkt->rssi);
+      }
+      // The parent had data for us, there may well be more queued behind it
+      if (PollCtl_Activity(&pollCtl)) {
+        ProjectSpecific_ApplyPollRate();
+      }
+      break;
+    case AF_DATA_CONFIRM_CMD:
+      Energy_Tx(&energyLedger);
+      // Inter-PAN 'init' requests of commissioning or of a roaming search go to
+      // other PANs' coordinators, they are neither link samples nor tell
+      // whether the parent is reached, either way
+      if (roamingSearch || InterPanQuery_Busy()) {
+        break;
+      }
+      Roaming_TxConfirm(&roamMonitor, ((afDataConfirm_t *)MSGpkt)->hdr.status == ZSuccess);
+      // Count consecutive failures to reach the parent
+      if (((afDataConfirm_t *)MSGpkt)->hdr.status == ZSuccess) {
+        confirmFailures = 0;
+      }
+      else if (get_nwk_status() == NWK_JOINED && !rejoinInProgress &&
+               ++confirmFailures >= parentLoss->confirmFailures) {
+        ProjectSpecific_ParentLost(TRUE);
+      }
+      break;
+    case ZDO_STATE_CHANGE:
+      // The NWK layer gave up on the parent after zgMaxPollFailureRetry poll
+      // no-acks and is rejoining by itself. Not while a query keeps the radio
+      // on another PAN's channel, the polls can't reach the parent from there.
+      if ((devStates_t)MSGpkt->hdr.status != DEV_END_DEVICE && get_nwk_status() == NWK_JOINED &&
+          !rejoinInProgress && !roamingSearch && !InterPanQuery_Busy()) {
+        ProjectSpecific_ParentLost(FALSE);
+      }
+      break;
     case MT_SYS_SERIAL_MSG:
       //ProjectSpecific_UartWrite(ZBC_PORT, "\n\rOTA\n\r", 7);
       //ANALED2_TOGGLE();
@@ -1136,10 +1626,11 @@ void ProjectSpecific_ProcessSystemEvent( afIncomingMSGPacket_t *MSGpkt )
       break;
   case MT_SYS_UD_CMD:
       //ProjectSpecific_UartWrite(ZBC_PORT, "\n\rOTA-UD\n\r", 10);
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "MTUD Cmd", 8);
-      #endif //DEBUG
-      AppUDMT_ProcessMTUDCmd( (mtOSALSerialData_t *)MSGpkt );
+      APP_TRACE1(TRC_MT_UD_CMD, ((mtOSALSerialData_t *)MSGpkt)->msg[3]);
+      if ( !ProjectSpecific_ProcessAppMTCmd( (mtOSALSerialData_t *)MSGpkt ) )
+      {
+        AppUDMT_ProcessMTUDCmd( (mtOSALSerialData_t *)MSGpkt );
+      }
   default:
       break;
   } 
@@ -1197,11 +1688,11 @@ void AppUDMT_SendMTRespWrapper(uint8 *mtbuff, uint8 mtbufflen, uint8 respType, b
        
        // First, set the PAN in NV to wildcard 0xFFFF
        uint16 defPAN = 0xFFFF;
-       osal_nv_write(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &defPAN);
+       ProjectSpecific_NvWrite(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &defPAN);
        
        // Second, set the channel list to default channel list, the value with which it was compiled
        uint32 defChanlist = DEFAULT_CHANLIST;
-       osal_nv_write(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &defChanlist);
+       ProjectSpecific_NvWrite(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &defChanlist);
        
        // Third, just do a hard reboot so that the device will be able to latch onto whatever network it finds after the reboot
        osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_RESET_TIMER);
@@ -1212,142 +1703,1998 @@ void AppUDMT_SendMTRespWrapper(uint8 *mtbuff, uint8 mtbufflen, uint8 respType, b
      {  
        // We need to call ZDApp_StopJoiningCycle() here
        uint8 RxOnIdle = FALSE;
-       ZMacSetReq( ZMacRxOnIdle, &RxOnIdle );
+       ProjectSpecific_SetRxOnIdle(RxOnIdle);
        status = ZDApp_StopJoiningCycle();
        // Max asks: why this if-else?
        if (status == TRUE)
        {
          // Start another timer now, after which we will call ZDApp_StartJoiningCycle()
-         ProjectSpecific_UartWrite(ZBC_PORT, "ZZZ\n\r", 5);
-         osal_start_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_RETRY_EVT, BaseED_NWK_JOIN_RETRY_TIMEOUT);  // start timer to wake up and to retry joining the network again
+         APP_TRACE(TRC_JOIN_SLEEP);
+         ProjectSpecific_ScheduleJoinRetry();  // start timer to wake up and to retry joining the network again
        }
        else
        {
          //SProjectSpecific_UartWrite(ZBC_PORT, (unsigned char *)MSG4, MSG4_LEN);
-         osal_start_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_RETRY_EVT, BaseED_NWK_JOIN_RETRY_TIMEOUT);
+         ProjectSpecific_ScheduleJoinRetry();
        }
      }
    }
    else
    {
-     ProjectSpecific_UartWrite(ZBC_PORT, (unsigned char *)MSG3, MSG3_LEN);
+     APP_TRACE(TRC_ALREADY_JOINED);
    }
  }
 
 /*********************************************************************
- * @fn      ProjectSpecific_ProcessCoreMsg
+ * @fn      ProjectSpecific_InitRetryBackoff
  *
- * @brief  This processes all device specific communication messages 
+ * @brief   Sets up the join retry and planned restart backoff from the
+ *          limits in NV, seeded from our IEEE address and the boot count so
+ *          that every boot draws different delays.
  *
- * @param  afIncomingMSGPacket_t *pkt - the packet that contains the msg
+ * @return  None
  */
-void ProjectSpecific_ProcessCoreMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr )
+void ProjectSpecific_InitRetryBackoff(void)
 {
-  // Here we inspect the incoming packet and act on it. This being an ED
-  // Almost all incoming packets will be admin packets to act upon.
-  uint8 *mt_buffer = NULL;
-  uint8  mt_packet_len = 0;
-
-  if(pkt->cmd.Data[0] == SYNCBYTE_1 && pkt->cmd.Data[1] == SYNCBYTE_2)
-  {
-    uint16 recvCkSum = BUILD_UINT16(pkt->cmd.Data[pkt->cmd.DataLength - 1],
-                                    pkt->cmd.Data[pkt->cmd.DataLength - 2]);
-    if (recvCkSum == CalcCkSum(pkt->cmd.Data, pkt->cmd.DataLength - 2)) {
-      mt_packet_len = pkt->cmd.Data[13];
-      mt_buffer = osal_mem_alloc(mt_packet_len);
-      #if DEBUG > 1
-      ProjectSpecific_UartWrite(ZBC_PORT, "\r\nCmd msg: ", 11);
-      ProjectSpecific_HexDump(&(pkt->cmd.Data[14]), pkt->cmd.DataLength);
-      #endif
-      #ifdef DEBUG
-      ProjectSpecific_UartWrite(ZBC_PORT, "\r\nLQI: ", 7);
-      ProjectSpecific_HexDump(&(pkt->LinkQuality), 1);
-      #endif //DEBUG
-      if (mt_buffer) {
-        osal_memcpy(mt_buffer, &pkt->cmd.Data[14],mt_packet_len);       //TODO: change the hardcode for 14
-        if(pkt->cmd.Data[3] == END_DEVICE_MESSAGE_TYPE_OTA_MT_REQ)
-        {
-          if((mt_buffer[2] & MT_RPC_SUBSYSTEM_MASK) < MT_RPC_SYS_MAX)
-          {
-            // Means we are within the range of well established MT sub systems
-            MT_UartProcessOTAZToolData(mt_buffer, mt_packet_len, shortAddr, pkt->srcAddr.panId);
-          }
-        }
-        else
-        if (pkt->cmd.Data[3] == END_DEVICE_MESSAGE_TYPE_OTA_MT_RESP)  
-        {
-          ProjectSpecific_UartWrite(ZBC_PORT, "UPLLLLLLL\n\r", 11);
-          if (interPanMsgIndex < nv_num_discovered_nwks) {
-            // We got the response packet sooner than expected -- send out the next init packet
-            osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
-            osal_set_event(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
-          }
-          // ProjectSpecific_SendLeaveReq();
-          // Means we have received the reply to our "init" packet. So we need to
-          // update our PAN info struct in the NV and move on to the next PAN
-          ProjectSpecific_UpdatePanInfoArray(mt_buffer, mt_packet_len);
-        }
-        osal_mem_free(mt_buffer);
-      }
-    }
-  }
+  uint16 boots = nv_boot_count + 1;
+  SetAppNVItem(APP_NV_BOOT_COUNT, 0, &boots);
+  
+  Backoff_Init(&joinBackoff, appInstance.extaddr, nv_boot_count,
+               (uint32)nv_retry_backoff.joinBase * 1000, (uint32)nv_retry_backoff.joinCap * 1000);
+  Backoff_Init(&restartBackoff, appInstance.extaddr, nv_boot_count, RESTART_BACKOFF_BASE, nv_retry_backoff.restartCap);
+  joinRetryRemaining = 0;
 }
-/**************************************************************************************************
- * @fn      ProjectSpecific_ProcessAppSpecificMTReq
- *
- * @brief   
+
+/*********************************************************************
+ * @fn      ProjectSpecific_ScheduleJoinRetry
  *
- * @param   
+ * @brief   Schedules the next ZDApp_StartJoiningCycle() after the next
+ *          backoff delay. Called after every failed join.
  *
- * @return  
- **************************************************************************************************/
-void ProjectSpecific_ProcessAppSpecificMTReq(uint8 *mt_buffer, uint8 mt_packet_len, uint16 shortAddr)
+ * @return  None
+ */
+void ProjectSpecific_ScheduleJoinRetry(void)
 {
-  //uint8 len = mt_buffer[1];
-  if (mt_buffer[0] == MT_UART_SOF)
-  {
-
-  }
-  else
-  {
-    //TODO: Send error message
-  }
+  joinRetryRemaining = Backoff_Next(&joinBackoff);
+  
+  APP_TRACE32(TRC_JOIN_RETRY, joinRetryRemaining);
+  
+  AppTimer_Stop(BaseED_NWK_JOIN_RETRY_EVT);
+  osal_set_event(PresenceSensor_TaskID, BaseED_NWK_JOIN_RETRY_EVT);
 }
 
 /*********************************************************************
- * @fn     ProjectSpecific_ProcessDevSpecificMsg
+ * @fn      ProjectSpecific_InitParentLossDetector
  *
- * @brief  This processes all device specific communication messages 
+ * @brief   Picks the parent loss thresholds for our device type and hands
+ *          the poll no-ack limit to the NWK layer.
  *
- * @param  afIncomingMSGPacket_t *pkt - the packet that contains the msg
+ * @return  None
  */
-void ProjectSpecific_ProcessDevSpecificMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr )
+void ProjectSpecific_InitParentLossDetector(void)
 {
-  /* INDEV */
-  /* Send received OTA message from coordinator across serial to attached
-     energy meter for processing.
-  */
-  unsigned char packet[4] = {1,2,3,4};
-  unsigned short recvd_device_id = (unsigned short)(pkt->cmd.Data[4]<<8) + pkt->cmd.Data[5];
-  //if (pkt->cmd.Data[2] == DEV_SPECIFIC_SERIAL_CMD)
-  if ( (recvd_device_id == DEVICE_ID) || (recvd_device_id == 0) )
-  {
-    packet[0] = 0x6E;
-    packet[1] = pkt->cmd.Data[6];
-    packet[2] = pkt->cmd.Data[7];
-    packet[3] = 0x6F;
-    
-    // Send data to energy meter attached to serial port
-    ProjectSpecific_UartWrite( ZBC_PORT, (unsigned char *)packet, 4);
+  uint8 i;
+  uint8 last = sizeof(parentLossThresholdTable) / sizeof(parentLossThresholds_t) - 1;
+  
+  for (i = 0; i < last; ++i) {
+    if (parentLossThresholdTable[i].deviceType == nv_device_info.deviceType) {
+      break;
+    }
   }
+  parentLoss = &parentLossThresholdTable[i];
+  zgMaxPollFailureRetry = parentLoss->pollFailures;
+  confirmFailures = 0;
 }
 
-/**************************************************************************************************
- * @fn      ProjectSpecific_CallBack
+/*********************************************************************
+ * @fn      ProjectSpecific_ParentLost
  *
- * @brief   
+ * @brief   Reacts to losing the parent right away instead of waiting for
+ *          the network status check timers. If we don't get back in, the
+ *          network status check puts us through network discovery again,
+ *          there is no reset.
  *
- * @param   
+ * @param   orphanScan - TRUE to start an orphan scan on our channel, FALSE
+ *                       if the NWK layer is already rejoining on its own
+ *
+ * @return  None
+ */
+void ProjectSpecific_ParentLost(uint8 orphanScan)
+{
+  APP_TRACE1(TRC_PARENT_LOST, orphanScan);
+  confirmFailures = 0;
+  set_nwk_status(NWK_ORPHAN);
+  
+  if (orphanScan) {
+    // Our parent, or another router that knows us, answers with a coordinator
+    // realignment. ZDApp finishes the orphan join and falls back to a normal
+    // join if it fails, just like it does when resuming after a reset.
+    // The NWK layer is reset first, as for any other rejoin, it still holds
+    // the state of the parent we lost.
+    uint32 channel = (uint32)1 << _NIB.nwkLogicalChannel;
+    uint8 RxOnIdle = TRUE;
+    if (NLME_ResetRequest() != ZSuccess) {
+      APP_TRACE(TRC_REJOIN_RESET_FAILED);
+      ProjectSpecific_StartCheckNwStatusEvt(0);
+      return;
+    }
+    ProjectSpecific_SetRxOnIdle(RxOnIdle);
+    devState = DEV_NWK_ORPHAN;
+    if (NLME_OrphanJoinRequest(channel, zgDefaultStartingScanDuration) != ZSuccess) {
+      ProjectSpecific_StartCheckNwStatusEvt(0);
+      return;
+    }
+  }
+  
+  rejoinInProgress = TRUE;
+  ProjectSpecific_StartCheckNwStatusEvt(PRESENCE_NORMAL_RESET_DELAY);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_ApplyPollRate
+ *
+ * @brief   Hands the interval of the poll rate controller to the NWK
+ *          layer. Only active devices on their network are controlled,
+ *          and not while a burst of ProjectSpecific_TurnUpPolling() is on.
+ *
+ * @return  None
+ */
+void ProjectSpecific_ApplyPollRate(void)
+{
+  if (nv_commissioned_status != DEVICE_ACTIVE || get_nwk_status() != NWK_JOINED ||
+      pollBurst || zgPollRate == pollCtl.rate) {
+    return;
+  }
+  zgPollRate = pollCtl.rate;
+  ProjectSpecific_SetPollRate(pollCtl.rate);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_PollExchange
+ *
+ * @brief   An MT request or response is going out over the air. The
+ *          other side is waiting on it, or about to answer, so polling
+ *          speeds up for the exchange. Plain sensor reports leave the
+ *          poll rate alone, nothing comes back for them.
+ *
+ * @return  None
+ */
+void ProjectSpecific_PollExchange(void)
+{
+  if (PollCtl_Activity(&pollCtl)) {
+    ProjectSpecific_ApplyPollRate();
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_SetRxOnIdle
+ *
+ * @brief   Switches the receiver on or off while idle. All changes of
+ *          ZMacRxOnIdle go through here so the energy ledger sees them.
+ *
+ * @param   rxOnIdle - TRUE to keep the receiver on
+ *
+ * @return  None
+ */
+void ProjectSpecific_SetRxOnIdle(uint8 rxOnIdle)
+{
+  Energy_SetRxOnIdle(&energyLedger, osal_GetSystemClock(), rxOnIdle);
+  ZMacSetReq( ZMacRxOnIdle, &rxOnIdle );
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_SetPollRate
+ *
+ * @brief   Sets the poll rate of the NWK layer. The energy ledger
+ *          estimates the number of polls from it.
+ *
+ * @param   pollRate - poll interval in ms
+ *
+ * @return  None
+ */
+void ProjectSpecific_SetPollRate(uint16 pollRate)
+{
+  Energy_SetPollRate(&energyLedger, osal_GetSystemClock(), pollRate);
+  NLME_SetPollRate(pollRate);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_NvWrite
+ *
+ * @brief   Writes an NV item, of the application or of the stack. All
+ *          NV writes go through here so the energy ledger sees them.
+ *
+ * @param   id     - NV item
+ * @param   offset - offset into the item
+ * @param   len    - bytes to write
+ * @param   buf    - data to write
+ *
+ * @return  status of osal_nv_write()
+ */
+uint8 ProjectSpecific_NvWrite(uint16 id, uint16 offset, uint16 len, void *buf)
+{
+  Energy_NvWrite(&energyLedger);
+  return osal_nv_write(id, offset, len, buf);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_UpdateEnergyPhase
+ *
+ * @brief   Accounts energy to OTA while an image is being downloaded,
+ *          otherwise to the commissioning state of the device.
+ *
+ * @return  None
+ */
+void ProjectSpecific_UpdateEnergyPhase(void)
+{
+  uint8 phase = nv_commissioned_status;
+
+  if (otaMode || nv_xnv_ota_in_progress != OTA_DL_NOTINPROGRESS) {
+    phase = ENERGY_PHASE_OTA;
+  }
+  Energy_SetPhase(&energyLedger, osal_GetSystemClock(), phase);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_SetPowerProfile
+ *
+ * @brief   Switches between the debug and the battery power profile and
+ *          keeps it in NV, so a device switched to debug in the field
+ *          stays that way across resets.
+ *
+ * @param   profile - POWER_PROFILE_DEBUG or POWER_PROFILE_BATTERY
+ *
+ * @return  SUCCESS, FAILURE for an unknown profile or NV status
+ */
+uint8 ProjectSpecific_SetPowerProfile(uint8 profile)
+{
+  uint8 status;
+
+  if (profile != POWER_PROFILE_DEBUG && profile != POWER_PROFILE_BATTERY) {
+    return FAILURE;
+  }
+  status = SetAppNVItem(APP_NV_POWER_PROFILE, 0, &profile);
+  if (!APP_VERBOSE()) {
+    AppTimer_Stop(BaseED_TOGGLE_LED_EVT);
+    #ifdef HAL_TURN_OFF_LED_PRESENCE
+    HAL_TURN_OFF_LED_PRESENCE();
+    #endif
+  }
+  return status;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaNextMissing
+ *
+ * @brief   Missing block search of the windowed OTA fetch.
+ *
+ * @param   from - first block to look at
+ *
+ * @return  first block at or after from that hasn't arrived yet, or
+ *          OTA_FETCH_NONE
+ */
+static uint16 ProjectSpecific_OtaNextMissing(uint16 from)
+{
+  if (otaBitmapSummary)
+  {
+    return SparseBm_NextClear(&otaBitmap, from);
+  }
+  return Bitmap_NextClear(gpacketbitmap, gtotalpackets, from);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaMissingRun
+ *
+ * @brief   Length of the run of missing blocks that starts at first.
+ *
+ * @param   first - first block of the run
+ *
+ * @return  number of consecutive blocks that haven't arrived yet
+ */
+static uint16 ProjectSpecific_OtaMissingRun(uint16 first)
+{
+  if (otaBitmapSummary)
+  {
+    return SparseBm_ClearRun(&otaBitmap, first, 0xFFFF);
+  }
+  return Bitmap_ClearRun(gpacketbitmap, gtotalpackets, first, 0xFFFF);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaBitmapStart
+ *
+ * @brief   Moves the windowed fetch onto the two level bitmap, which is
+ *          built straight from the bitmap in XNV. A flat bitmap left by
+ *          the one by one fill is written out first, it may hold blocks
+ *          or replayed journal records XNV doesn't, and then freed. The
+ *          fetch needs the summary and a few leaves of RAM whatever the
+ *          size of the image. A fetch started over keeps its summary.
+ *
+ * @return  TRUE if the fetch runs on the two level bitmap
+ */
+static uint8 ProjectSpecific_OtaBitmapStart(void)
+{
+  if (otaBitmapSummary)
+  {
+    return TRUE;
+  }
+  otaBitmapSummary = osal_mem_alloc(2 * SPARSEBM_SUMMARY_BYTES(gtotalpackets));
+  if (otaBitmapSummary == NULL)
+  {
+    return FALSE;
+  }
+  if (gpacketbitmap)
+  {
+    XNV_Write(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, gpacketbitmap, 0, BM_MAX_BYTES(gtotalpackets));
+    BM_FREE(gpacketbitmap);
+    gpacketbitmap = NULL;
+  }
+  SparseBm_Init(&otaBitmap, gtotalpackets, otaBitmapSummary,
+                ProjectSpecific_OtaLeafRead, ProjectSpecific_OtaLeafWrite);
+  SparseBm_Load(&otaBitmap);
+  gtotalMissingPackets = otaBitmap.missing;
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaBitmapEnd
+ *
+ * @brief   Writes the leaves of the two level bitmap back to XNV and
+ *          frees it once the windowed fetch is over. The flat bitmap
+ *          isn't rebuilt, XNV holds the progress for whatever comes next.
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaBitmapEnd(void)
+{
+  if (otaBitmapSummary)
+  {
+    SparseBm_Flush(&otaBitmap);
+    osal_mem_free(otaBitmapSummary);
+    otaBitmapSummary = NULL;
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaBitmapClear
+ *
+ * @brief   Marks every unit of the windowed fetch missing, in XNV and in
+ *          the two level bitmap, whose leaves are dropped.
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaBitmapClear(void)
+{
+  uint8 leaf[SPARSEBM_LEAF_BYTES];
+  uint16 group;
+
+  osal_memset(leaf, 0, sizeof(leaf));
+  for (group = 0; group < otaBitmap.groups; ++group)
+  {
+    ProjectSpecific_OtaLeafWrite(group, leaf);
+  }
+  SparseBm_Init(&otaBitmap, gtotalpackets, otaBitmapSummary,
+                ProjectSpecific_OtaLeafRead, ProjectSpecific_OtaLeafWrite);
+  gtotalMissingPackets = gtotalpackets;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaLeafRead
+ *
+ * @brief   Reads the leaf of a group of the two level bitmap, its bytes
+ *          of the bitmap in XNV.
+ *
+ * @param   group - group of SPARSEBM_GROUP_UNITS units
+ * @param   leaf  - SPARSEBM_LEAF_BYTES bytes
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaLeafRead(uint16 group, uint8 *leaf)
+{
+  uint16 offset = group * SPARSEBM_LEAF_BYTES;
+  uint16 len = BM_MAX_BYTES(gtotalpackets) - offset;
+
+  XNV_Read(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, leaf, offset,
+           (len < SPARSEBM_LEAF_BYTES) ? len : SPARSEBM_LEAF_BYTES);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaLeafWrite
+ *
+ * @brief   Writes the leaf of a group of the two level bitmap back to
+ *          the bitmap in XNV.
+ *
+ * @param   group - group of SPARSEBM_GROUP_UNITS units
+ * @param   leaf  - SPARSEBM_LEAF_BYTES bytes
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaLeafWrite(uint16 group, uint8 *leaf)
+{
+  uint16 offset = group * SPARSEBM_LEAF_BYTES;
+  uint16 len = BM_MAX_BYTES(gtotalpackets) - offset;
+
+  XNV_Write(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, leaf, offset,
+            (len < SPARSEBM_LEAF_BYTES) ? len : SPARSEBM_LEAF_BYTES);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaFetchService
+ *
+ * @brief   Gives up on the block requests past their deadline, fills the
+ *          window with new ones and sets the OTA timer for the next
+ *          deadline. Runs off the timer and after every block received.
+ *          While the throttle holds the fetch back no new requests go
+ *          out, and once the last one is in the radio is handed back to
+ *          the sensor until the throttle lets the fetch run again. None
+ *          go out either while the coordinator is broadcasting the image.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaFetchService(void)
+{
+  uint32 now = osal_GetSystemClock();
+  uint32 wait;
+  uint32 throttle;
+  uint32 hold = 0;
+  uint16 block;
+  uint8 req[4];
+  uint8 count;
+  uint8 full = FALSE;
+
+  OtaFetch_SetLink(&otaFetch, ProjectSpecific_OtaLinkState());
+  OtaFetch_Expire(&otaFetch, now);
+  if (gtotalMissingPackets == 0 && otaFetch.outstanding == 0)
+  {
+    // A compressed or delta image must end where a complete one ends,
+    // and with block CRCs what came in must add up to the digest
+    if (!ProjectSpecific_OtaStreamComplete() || (otaBlockCrc && otaDigest != otaDigestExpected))
+    {
+      ProjectSpecific_AbortOtaFill();
+      return;
+    }
+    // Report the image complete the same way a one by one fill does. The
+    // broadcast may complete it while the fetch is paused, the report
+    // needs the radio.
+    otaFetchActive = FALSE;
+    ProjectSpecific_OtaPause(FALSE);
+    ProjectSpecific_OtaMcastLeave();
+    ProjectSpecific_OtaBitmapEnd();
+    ProjectSpecific_OtaJournalClose();
+    ProjectSpecific_OtaEndStream();
+    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+    AppUDMT_XNVEndPacketTransferRsp(NULL, true);
+    return;
+  }
+  // Same limit as the one by one fill, counted from the last block received.
+  // Time held back by the throttle or for the broadcast doesn't count.
+  throttle = OtaThrottle_Check(&otaThrottle, &nv_ota_throttle_cfg, now);
+  if (otaMcast && now - otaMcastLast < otaMcastHold)
+  {
+    hold = otaMcastHold - (now - otaMcastLast);
+  }
+  if (throttle || hold)
+  {
+    otaFetch.lastProgress = now;
+  }
+  if (now - otaFetch.lastProgress >= (uint32)nv_xnv_ota_unit_timer * nv_xnv_ota_repeat_count_value)
+  {
+    ProjectSpecific_AbortOtaFill();
+    return;
+  }
+
+  // Consecutive blocks go out as one request for the whole range of units,
+  // split into blocks of req[3] units. Only full blocks can be followed by
+  // another one, so the blocks sent start where the requests do.
+  req[2] = 0;
+  req[3] = otaFetch.units;
+  if (throttle)
+  {
+    if (otaFetch.outstanding == 0)
+    {
+      ProjectSpecific_OtaPause(TRUE);
+    }
+  }
+  else
+  {
+    ProjectSpecific_OtaPause(FALSE);
+  }
+  while (!throttle && !hold && (block = OtaFetch_Next(&otaFetch, now, ProjectSpecific_OtaNextMissing, &count)) != OTA_FETCH_NONE)
+  {
+    if (req[2] && full && block == BUILD_UINT16(req[0], req[1]) + req[2] && req[2] + count <= 0xFF)
+    {
+      req[2] += count;
+      full = (count == req[3]);
+      continue;
+    }
+    if (req[2])
+    {
+      ProjectSpecific_SendAppMTResp(APP_MT_OTA_BLOCK_REQ, req, sizeof(req), TRUE);
+    }
+    req[0] = LO_UINT16(block);
+    req[1] = HI_UINT16(block);
+    req[2] = count;
+    full = (count == req[3]);
+  }
+  if (req[2])
+  {
+    ProjectSpecific_SendAppMTResp(APP_MT_OTA_BLOCK_REQ, req, sizeof(req), TRUE);
+  }
+
+  wait = OtaFetch_TimeToDeadline(&otaFetch, now);
+  if (wait == 0xFFFFFFFFUL && !throttle && !hold)
+  {
+    // Every missing block is requested, or the window collapsed; look again shortly
+    wait = otaFetch.timeout;
+  }
+  if (throttle && throttle < wait)
+  {
+    wait = throttle;
+  }
+  if (hold && hold < wait)
+  {
+    wait = hold;
+  }
+  osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_OTA_TIMEOUT_EVT,
+                     (wait == 0) ? 1 : (wait > 0xFFFF) ? 0xFFFF : (uint16)wait);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaPause
+ *
+ * @brief   Hands the radio back to the sensor while the fetch is held
+ *          back: normal poll rate, receiver off when idle. OTA mode stays
+ *          on, the fetch still accounts its energy to OTA. Taking the
+ *          radio again restores the receiver and the poll rate only, the
+ *          rest of ProjectSpecific_ChangeToOTAMode() is still in place.
+ *
+ * @param   pause - TRUE to hand the radio back, FALSE to take it again
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaPause(uint8 pause)
+{
+  if (pause && !otaPaused)
+  {
+    otaPaused = TRUE;
+    ProjectSpecific_TurnDownPolling();
+    ProjectSpecific_PowerDownRadio(0);
+  }
+  else if (!pause && otaPaused)
+  {
+    otaPaused = FALSE;
+    ProjectSpecific_TurnUpPolling();
+    ProjectSpecific_SetRxOnIdle(TRUE);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaSensorTraffic
+ *
+ * @brief   Sensor traffic is going out. A fetch in progress stops
+ *          requesting blocks until the link has been quiet for a while.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaSensorTraffic(void)
+{
+  if (otaFetchActive)
+  {
+    OtaThrottle_Traffic(&otaThrottle, osal_GetSystemClock());
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaMcastJoin
+ *
+ * @brief   Joins the group the coordinator broadcasts the image to.
+ *
+ * @param   group - APS group of the broadcast
+ * @param   hold  - ms without a broadcast block before the units still
+ *                  missing are requested one by one
+ *
+ * @return  TRUE if the device is in the group
+ */
+static uint8 ProjectSpecific_OtaMcastJoin(uint16 group, uint16 hold)
+{
+  aps_Group_t grp;
+  ZStatus_t status;
+
+  ProjectSpecific_OtaMcastLeave();
+  grp.ID = group;
+  grp.name[0] = 0;
+  status = aps_AddGroup(BaseED_ENDPOINT, &grp);
+  if (status != ZSuccess && status != ZApsDuplicateEntry)
+  {
+    return FALSE;
+  }
+  otaMcast = TRUE;
+  otaMcastGroup = group;
+  otaMcastHold = hold;
+  otaMcastLast = osal_GetSystemClock();
+  otaMcastUnits = 0;
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaMcastLeave
+ *
+ * @brief   Leaves the OTA group, once the image is complete or the fetch
+ *          is given up on.
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaMcastLeave(void)
+{
+  if (otaMcast)
+  {
+    otaMcast = FALSE;
+    aps_RemoveGroup(BaseED_ENDPOINT, otaMcastGroup);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaBlockReceived
+ *
+ * @brief   Stores a block of the windowed OTA fetch in the image area, or
+ *          decodes it into there, and requests the next one right away.
+ *          A block that fails its CRC is requested again right away.
+ *          Broadcast blocks weren't requested; the units missing are
+ *          kept, a damaged block is left to the unicast fill.
+ *
+ * @param   block - first unit of the block, indexes otaBitmap
+ * @param   crc   - CRC the block came with, if otaBlockCrc
+ * @param   buf   - block data
+ * @param   len   - length of buf, at most otaFetch.unitsMax units of
+ *                  otaBlockSize
+ * @param   mcast - TRUE if the block was broadcast to the OTA group
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaBlockReceived(uint16 block, uint16 crc, uint8 *buf, uint8 len, uint8 mcast)
+{
+  uint16 unit;
+  uint8 n;
+
+  if (otaBitmapSummary == NULL || block >= gtotalpackets || len == 0 ||
+      len > (uint16)otaBlockSize * otaFetch.unitsMax)
+  {
+    return;
+  }
+  if (otaBlockCrc && Crc16_Block(block, buf, len) != crc)
+  {
+    if (mcast)
+    {
+      return;
+    }
+    OtaFetch_Corrupt(&otaFetch, block);
+    ProjectSpecific_OtaFetchService();
+    return;
+  }
+  // Unit by unit, whatever the block size. Compressed and delta images only
+  // decode in order, a unit that comes in ahead of a lost one is dropped
+  // and fetched again later.
+  for (unit = block; len && unit < gtotalpackets; ++unit)
+  {
+    n = (len < otaBlockSize) ? len : otaBlockSize;
+    if (!SparseBm_Test(&otaBitmap, unit) &&
+        ((otaLzss == NULL && otaDelta == NULL) || unit == 0 || SparseBm_Test(&otaBitmap, unit - 1)))
+    {
+      if (otaLzss || otaDelta)
+      {
+        ProjectSpecific_OtaStreamBlock(buf, n);
+      }
+      else
+      {
+        XNV_Write(appInstance.imgarea, appInstance.imgtype, buf, (uint32)unit * otaBlockSize, n);
+      }
+      SparseBm_Set(&otaBitmap, unit);
+      if (gtotalMissingPackets)
+      {
+        --gtotalMissingPackets;
+      }
+      if (otaBlockCrc)
+      {
+        // The digest goes by units so that it doesn't depend on the block size
+        otaDigest += (n == len && unit == block) ? crc : Crc16_Block(unit, buf, n);
+      }
+      ProjectSpecific_OtaJournalBlock(unit);
+      if (mcast)
+      {
+        ++otaMcastUnits;
+      }
+    }
+    buf += n;
+    len -= n;
+  }
+  if (ProjectSpecific_OtaStreamFailed())
+  {
+    ProjectSpecific_AbortOtaFill();
+    return;
+  }
+  if (mcast)
+  {
+    // The broadcast is still going, keep out of its way
+    otaMcastLast = osal_GetSystemClock();
+    otaFetch.lastProgress = otaMcastLast;
+  }
+  else
+  {
+    OtaFetch_Received(&otaFetch, block, osal_GetSystemClock());
+  }
+  ProjectSpecific_OtaFetchService();
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaLinkState
+ *
+ * @brief   Rates the parent link for the OTA block size, by the averages
+ *          and thresholds of the roaming monitor.
+ *
+ * @return  OTA_FETCH_LINK_POOR, OTA_FETCH_LINK_FAIR or OTA_FETCH_LINK_GOOD
+ */
+uint8 ProjectSpecific_OtaLinkState(void)
+{
+  uint8 lqi = (uint8)(roamMonitor.lqiAvg >> ROAMING_LQI_FRAC);
+  uint8 fail = (uint8)(roamMonitor.failAvg >> ROAMING_FAIL_FRAC);
+
+  if (!roamMonitor.rxPrimed)
+  {
+    return OTA_FETCH_LINK_FAIR;
+  }
+  if (lqi < nv_roaming_cfg.lqiLow || (roamMonitor.txPrimed && fail > nv_roaming_cfg.failHigh))
+  {
+    return OTA_FETCH_LINK_POOR;
+  }
+  if (lqi >= nv_roaming_cfg.lqiHigh && (!roamMonitor.txPrimed || fail <= nv_roaming_cfg.failLow))
+  {
+    return OTA_FETCH_LINK_GOOD;
+  }
+  return OTA_FETCH_LINK_FAIR;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaNegotiateUnits
+ *
+ * @brief   Picks the block size a fetch starts with: as many units as
+ *          fit OTA_BLOCK_BYTES_MAX at most, half of that on a good link,
+ *          two units on a fair one and single units on a poor one. The
+ *          fetch adapts it from there.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaNegotiateUnits(void)
+{
+  uint8 unitsMax = (otaBlockSize >= OTA_BLOCK_BYTES_MAX) ? 1 : OTA_BLOCK_BYTES_MAX / otaBlockSize;
+  uint8 link = ProjectSpecific_OtaLinkState();
+
+  OtaFetch_SetUnits(&otaFetch, (link == OTA_FETCH_LINK_GOOD) ? unitsMax / 2 :
+                               (link == OTA_FETCH_LINK_FAIR) ? 2 : 1, unitsMax);
+  OtaFetch_SetLink(&otaFetch, link);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaSeedDigest
+ *
+ * @brief   Digest of the blocks that are in the image area already when
+ *          a fetch with block CRCs starts, e.g. after a reset. Only these
+ *          are read back, once; every block after them adds its CRC as it
+ *          comes in. Compressed and delta images always start empty.
+ *
+ * @param   imageLen - bytes transferred in all, to size the last block
+ *
+ * @return  sum of the CRCs of the blocks received
+ */
+uint16 ProjectSpecific_OtaSeedDigest(uint32 imageLen)
+{
+  uint16 digest = 0;
+  uint16 block;
+  uint32 offset;
+  uint16 len;
+  uint8 *buf;
+
+  if (otaBitmap.missing == gtotalpackets)
+  {
+    return 0;
+  }
+  buf = osal_mem_alloc(otaBlockSize);
+  if (buf == NULL)
+  {
+    // Can't tell, make the end of the fetch fail rather than pass
+    return otaDigestExpected + 1;
+  }
+  for (block = 0; block < gtotalpackets; ++block)
+  {
+    offset = (uint32)block * otaBlockSize;
+    if (SparseBm_Test(&otaBitmap, block) && offset < imageLen)
+    {
+      len = (imageLen - offset < otaBlockSize) ? (uint16)(imageLen - offset) : otaBlockSize;
+      XNV_Read(appInstance.imgarea, appInstance.imgtype, buf, offset, len);
+      digest += Crc16_Block(block, buf, len);
+    }
+  }
+  osal_mem_free(buf);
+  return digest;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_AbortOtaFill
+ *
+ * @brief   Gives up on fetching the missing OTA blocks.
+ *
+ * @return  None
+ */
+void ProjectSpecific_AbortOtaFill(void)
+{
+  otaFetchActive = FALSE;
+  ProjectSpecific_OtaMcastLeave();
+  ProjectSpecific_OtaBitmapEnd();
+  ProjectSpecific_OtaJournalClose();
+  ProjectSpecific_OtaEndStream();
+  elapsedTurns = 0;
+  appInstance.otaStatus = NOT_IN_PROGRESS;
+  SetAppNVItem(APP_NV_APP_INSTANCE, 0, &appInstance);
+  APP_TRACE(TRC_OTA_ABORTED);
+
+  //Step1: Turn OFF the MAC for idle
+  //Step2: restore the broadcast parameters
+  //Step3: restore the polling rate
+  ProjectSpecific_RestoreToNormalMode();    
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalStart
+ *
+ * @brief   Starts journaling the blocks of the windowed fetch. The bitmap
+ *          as it is now is written out first, the journal holds only
+ *          what arrives after it. The journal is keyed on the image; a
+ *          journal left open for another image means the bitmap holds
+ *          that image's progress, which is dropped.
+ *
+ * @param   imageLen - bytes of the image, 0 if the coordinator didn't say
+ * @param   digest   - digest of the image, 0 if the coordinator didn't say
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaJournalStart(uint32 imageLen, uint16 digest)
+{
+  otaJournalNv_t image = nv_ota_journal;
+
+  image.totalpackets = gtotalpackets;
+  image.imgarea = appInstance.imgarea;
+  image.imgtype = appInstance.imgtype;
+  image.imageLen = imageLen;
+  image.digest = digest;
+  if (nv_ota_journal.totalpackets && !OtaJournal_SameImage(&nv_ota_journal, &image))
+  {
+    ProjectSpecific_OtaBitmapClear();
+  }
+  nv_ota_journal.imgarea = image.imgarea;
+  nv_ota_journal.imgtype = image.imgtype;
+  nv_ota_journal.imageLen = image.imageLen;
+  nv_ota_journal.digest = image.digest;
+  OtaJournal_Init(&otaJournal, nv_ota_journal.session);
+  ProjectSpecific_OtaJournalCompact();
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalBlock
+ *
+ * @brief   Journals a block just marked received in otaBitmap. Costs
+ *          at most one record write per block, plus a bitmap write every
+ *          OTA_JOURNAL_RECORDS records.
+ *
+ * @param   block - block received
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaJournalBlock(uint16 block)
+{
+  otaJournalRecord_t rec;
+  uint8 slot;
+
+  if (nv_ota_journal.totalpackets == 0)
+  {
+    return;
+  }
+  slot = OtaJournal_Add(&otaJournal, block, &rec);
+  if (slot != OTA_JOURNAL_NONE)
+  {
+    ProjectSpecific_OtaJournalWrite(slot, &rec);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalFlush
+ *
+ * @brief   Writes out the run of blocks the journal held back.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaJournalFlush(void)
+{
+  otaJournalRecord_t rec;
+  uint8 slot;
+
+  if (nv_ota_journal.totalpackets == 0)
+  {
+    return;
+  }
+  slot = OtaJournal_Flush(&otaJournal, &rec);
+  if (slot != OTA_JOURNAL_NONE)
+  {
+    ProjectSpecific_OtaJournalWrite(slot, &rec);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalClose
+ *
+ * @brief   Drops the journal once the fetch is over, or before a fill
+ *          that doesn't journal starts, so it can't be replayed onto the
+ *          bitmap of a later image.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaJournalClose(void)
+{
+  if (nv_ota_journal.totalpackets)
+  {
+    nv_ota_journal.totalpackets = 0;
+    SetAppNVItem(APP_NV_OTA_JOURNAL, 0, &nv_ota_journal);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalReplay
+ *
+ * @brief   Rebuilds gpacketbitmap at resume: the bitmap has just been
+ *          read back from XNV, the journal records of the current
+ *          session go on top of it. Only a journal of the image being
+ *          resumed is replayed, and the result is written back so that
+ *          it survives the journal being closed. What the coordinator
+ *          announces for the image is only known once the fetch starts
+ *          again, ProjectSpecific_OtaJournalStart() checks that.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaJournalReplay(void)
+{
+  otaJournalNv_t image = nv_ota_journal;
+  otaJournalRecord_t rec;
+  uint8 slot;
+
+  image.totalpackets = gtotalpackets;
+  image.imgarea = appInstance.imgarea;
+  image.imgtype = appInstance.imgtype;
+  if (gpacketbitmap == NULL || !OtaJournal_SameImage(&nv_ota_journal, &image))
+  {
+    return;
+  }
+  for (slot = 0; slot < OTA_JOURNAL_RECORDS; ++slot)
+  {
+    XNV_Read(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_JOURNAL, (uint8 *)&rec,
+             (uint32)slot * sizeof(rec), sizeof(rec));
+    if (!OtaJournal_Replay(&rec, nv_ota_journal.session, gpacketbitmap, gtotalpackets))
+    {
+      break;
+    }
+  }
+  if (slot)
+  {
+    XNV_Write(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_BITMAP, gpacketbitmap, 0, BM_MAX_BYTES(gtotalpackets));
+  }
+  gtotalMissingPackets = Bitmap_CountClear(gpacketbitmap, gtotalpackets);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalWrite
+ *
+ * @brief   Writes a journal record to its slot and compacts the journal
+ *          once the last slot is used.
+ *
+ * @param   slot - slot returned by OtaJournal_Add() or OtaJournal_Flush()
+ * @param   rec  - record to write
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaJournalWrite(uint8 slot, otaJournalRecord_t *rec)
+{
+  XNV_Write(appInstance.imgarea, FLASH_IMAGE_TYPE_OTA_JOURNAL, (uint8 *)rec,
+            (uint32)slot * sizeof(*rec), sizeof(*rec));
+  if (otaJournal.next >= OTA_JOURNAL_RECORDS)
+  {
+    ProjectSpecific_OtaJournalCompact();
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaJournalCompact
+ *
+ * @brief   Writes the bitmap out and starts a new journal session.
+ *          The bitmap goes first: a reset in between replays the old
+ *          session onto a bitmap that already has its blocks, which is
+ *          harmless.
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaJournalCompact(void)
+{
+  // Only the leaves in RAM can be behind the bitmap in XNV
+  SparseBm_Flush(&otaBitmap);
+  OtaJournal_Compacted(&otaJournal);
+  nv_ota_journal.session = otaJournal.session;
+  nv_ota_journal.totalpackets = gtotalpackets;
+  SetAppNVItem(APP_NV_OTA_JOURNAL, 0, &nv_ota_journal);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaStartStream
+ *
+ * @brief   Sets up the fetch of a compressed or delta image. Either is a
+ *          stream that is decoded from its start only, so every block is
+ *          fetched again and nothing is journaled. The mode is kept in
+ *          APP_NV_OTA_STREAM, after a reset the fill is aborted and the
+ *          coordinator starts the stream over. A compressed delta is
+ *          decompressed first, then applied. The bitmap is cleared by
+ *          the caller once the fetch is on the two level bitmap.
+ *
+ * @param   flags    - OTA_FETCH_COMPRESSED and/or OTA_FETCH_DELTA
+ * @param   imageLen - bytes of the image the stream decodes to
+ * @param   imageCrc - CRC of the image the stream decodes to
+ *
+ * @return  TRUE if the decoders could be allocated
+ */
+uint8 ProjectSpecific_OtaStartStream(uint8 flags, uint32 imageLen, uint16 imageCrc)
+{
+  ProjectSpecific_OtaEndStream();
+  if (flags & OTA_FETCH_COMPRESSED)
+  {
+    otaLzss = osal_mem_alloc(sizeof(lzss_t));
+    if (otaLzss == NULL)
+    {
+      return FALSE;
+    }
+    Lzss_Init(otaLzss);
+  }
+  if (flags & OTA_FETCH_DELTA)
+  {
+    otaDelta = osal_mem_alloc(sizeof(delta_t));
+    if (otaDelta == NULL)
+    {
+      ProjectSpecific_OtaEndStream();
+      return FALSE;
+    }
+    Delta_Init(otaDelta, ProjectSpecific_RunningImageLen(), imageLen);
+  }
+  otaStreamOffset = 0;
+  otaStreamLen = imageLen;
+  otaStreamCrc = imageCrc;
+  otaStreamOutCrc = CRC16_INIT;
+  otaStreamFailed = FALSE;
+  flags &= OTA_FETCH_COMPRESSED | OTA_FETCH_DELTA;
+  SetAppNVItem(APP_NV_OTA_STREAM, 0, &flags);
+  ProjectSpecific_OtaJournalClose();
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaEndStream
+ *
+ * @brief   Frees the decoders of a compressed or delta image, if any,
+ *          and forgets the stream in NV.
+ *
+ * @return  None
+ */
+void ProjectSpecific_OtaEndStream(void)
+{
+  uint8 none = 0;
+
+  if (nv_ota_stream)
+  {
+    SetAppNVItem(APP_NV_OTA_STREAM, 0, &none);
+  }
+  if (otaLzss)
+  {
+    osal_mem_free(otaLzss);
+    otaLzss = NULL;
+  }
+  if (otaDelta)
+  {
+    osal_mem_free(otaDelta);
+    otaDelta = NULL;
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaStreamComplete
+ *
+ * @brief   Whether the stream ended where a complete one ends, with the
+ *          whole of the announced image written and its CRC the one
+ *          announced. Nothing is read back for that.
+ *
+ * @return  TRUE unless a token or patch operation is partly decoded, the
+ *          image came out short or it isn't the one announced
+ */
+uint8 ProjectSpecific_OtaStreamComplete(void)
+{
+  if (otaLzss == NULL && otaDelta == NULL)
+  {
+    return TRUE;
+  }
+  return (!ProjectSpecific_OtaStreamFailed() && otaStreamOffset == otaStreamLen &&
+          (otaLzss == NULL || Lzss_Idle(otaLzss)) &&
+          (otaDelta == NULL || Delta_Complete(otaDelta)) &&
+          otaStreamOutCrc == otaStreamCrc);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaStreamFailed
+ *
+ * @brief   Whether the stream went past the announced image or a patch
+ *          copied from outside the running image.
+ *
+ * @return  TRUE if the fill has to be given up
+ */
+uint8 ProjectSpecific_OtaStreamFailed(void)
+{
+  return (otaStreamFailed || (otaDelta && Delta_Failed(otaDelta)));
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaStreamBlock
+ *
+ * @brief   Decodes the next block of a compressed or delta image into the
+ *          image area.
+ *
+ * @param   buf - block data
+ * @param   len - length of buf
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaStreamBlock(uint8 *buf, uint8 len)
+{
+  uint8 out[32];
+  uint16 used;
+  uint16 n;
+
+  if (otaLzss == NULL)
+  {
+    ProjectSpecific_OtaPatch(buf, len);
+    return;
+  }
+  // Runs until the block is used up and a back reference it ends with is
+  // copied out completely
+  do
+  {
+    n = Lzss_Decode(otaLzss, buf, len, &used, out, sizeof(out));
+    if (otaDelta)
+    {
+      ProjectSpecific_OtaPatch(out, n);
+    }
+    else if (n > otaStreamLen - otaStreamOffset)
+    {
+      otaStreamFailed = TRUE;
+    }
+    else if (n)
+    {
+      XNV_Write(appInstance.imgarea, appInstance.imgtype, out, otaStreamOffset, n);
+      otaStreamOutCrc = Crc16_Update(otaStreamOutCrc, out, n);
+      otaStreamOffset += n;
+    }
+    buf += used;
+    len -= used;
+  } while (!ProjectSpecific_OtaStreamFailed() && (len || n == sizeof(out)));
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_OtaPatch
+ *
+ * @brief   Applies the next piece of a delta image against the running
+ *          image and appends the output to the image area.
+ *
+ * @param   buf - patch data
+ * @param   len - length of buf
+ *
+ * @return  None
+ */
+static void ProjectSpecific_OtaPatch(uint8 *buf, uint16 len)
+{
+  uint8 out[32];
+  uint16 used;
+  uint16 n;
+
+  // Runs until the patch data is used up and a copy it ends with is
+  // complete, or the patch fails
+  do
+  {
+    n = Delta_Apply(otaDelta, buf, len, &used, out, sizeof(out), ProjectSpecific_ReadRunningImage);
+    if (n)
+    {
+      XNV_Write(appInstance.imgarea, appInstance.imgtype, out, otaStreamOffset, n);
+      otaStreamOutCrc = Crc16_Update(otaStreamOutCrc, out, n);
+      otaStreamOffset += n;
+    }
+    buf += used;
+    len -= used;
+  } while (!Delta_Failed(otaDelta) && (len || n == sizeof(out)));
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_ReadRunningImage
+ *
+ * @brief   Reads the image we are running, the base of a delta image.
+ *
+ * @param   offset - offset into the image
+ * @param   buf    - buffer to read into
+ * @param   len    - bytes to read
+ *
+ * @return  None
+ */
+static void ProjectSpecific_ReadRunningImage(uint32 offset, uint8 *buf, uint16 len)
+{
+  HalOTARead(offset, buf, len, HAL_OTA_RC);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_RunningImageLen
+ *
+ * @brief   Length of the image we are running, from its preamble. A
+ *          delta image copies from no further than that.
+ *
+ * @return  Bytes of the running image
+ */
+static uint32 ProjectSpecific_RunningImageLen(void)
+{
+  preamble_t preamble;
+
+  HalOTARead(PREAMBLE_OFFSET, (uint8 *)&preamble, sizeof(preamble_t), HAL_OTA_RC);
+  return preamble.len;
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_CheckRoaming
+ *
+ * @brief   Runs the roaming monitor on every data rate sample. Once the
+ *          parent link has been poor for long enough the coordinators in
+ *          nv_pan_info_array are queried in the background, the same way
+ *          as during commissioning, while we stay joined to our own PAN.
+ *          ProjectSpecific_FinishRoamingSearch() takes it from there.
+ *
+ * @return  None
+ */
+void ProjectSpecific_CheckRoaming(void)
+{
+  if (nv_commissioned_status != DEVICE_ACTIVE || get_nwk_status() != NWK_JOINED ||
+      roamingSearch || rejoinInProgress || nv_num_discovered_nwks < 2) {
+    return;
+  }
+  if (!Roaming_Evaluate(&roamMonitor, &nv_roaming_cfg)) {
+    return;
+  }
+  
+  APP_TRACE(TRC_ROAM_SEARCH);
+  roamingSearch = TRUE;
+  ProjectSpecific_TurnUpPolling();
+  ProjectSpecific_PowerUpRadio(0, 2);
+  uint16 gatherTimeout = InterPanQuery_Start(nv_pan_info_array, nv_num_discovered_nwks);
+  osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT, PRESENCE_SEND_INTER_PAN_INIT_TIMER);
+  osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT, gatherTimeout);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_FinishRoamingSearch
+ *
+ * @brief   Called once the background query is over. Moves to the best
+ *          coordinator that answered if it beats our parent, otherwise
+ *          goes back to normal polling.
+ *
+ * @return  None
+ */
+void ProjectSpecific_FinishRoamingSearch(void)
+{
+  uint32 answered = 0;
+  uint8 i;
+  
+  roamingSearch = FALSE;
+  for (i = 0; i < nv_num_discovered_nwks; ++i) {
+    if (InterPanQuery_Answered(i)) {
+      answered |= (uint32)1 << i;
+    }
+  }
+  
+  uint8 best = Roaming_SelectCandidate(&roamMonitor, &nv_roaming_cfg, &nv_join_policy_weights,
+                                       nv_pan_info_array, nv_num_discovered_nwks,
+                                       _NIB.nwkPanId, answered);
+  Roaming_SearchDone(&roamMonitor, &nv_roaming_cfg, best != ROAMING_NO_CANDIDATE);
+  ProjectSpecific_TurnDownPolling();
+  
+  if (best == ROAMING_NO_CANDIDATE) {
+    APP_TRACE(TRC_ROAM_NONE);
+    #if RFD_RCVC_ALWAYS_ON==FALSE
+    ProjectSpecific_PowerDownRadio(0);
+    #endif
+    return;
+  }
+  
+  APP_TRACE1(TRC_ROAM, nv_pan_info_array[best].panID);
+  // No leave request here, the parent we are leaving may well not hear it
+  ProjectSpecific_RejoinPan(nv_pan_info_array[best].panID, nv_pan_info_array[best].channel);
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_ProcessCoreMsg
+ *
+ * @brief  This processes all device specific communication messages 
+ *
+ * @param  afIncomingMSGPacket_t *pkt - the packet that contains the msg
+ */
+void ProjectSpecific_ProcessCoreMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr )
+{
+  // Here we inspect the incoming packet and act on it. This being an ED
+  // Almost all incoming packets will be admin packets to act upon.
+  uint8 *mt_buffer = NULL;
+  uint8  mt_packet_len = 0;
+
+  if(pkt->cmd.Data[0] == SYNCBYTE_1 && pkt->cmd.Data[1] == SYNCBYTE_2)
+  {
+    uint16 recvCkSum = BUILD_UINT16(pkt->cmd.Data[pkt->cmd.DataLength - 1],
+                                    pkt->cmd.Data[pkt->cmd.DataLength - 2]);
+    if (recvCkSum == CalcCkSum(pkt->cmd.Data, pkt->cmd.DataLength - 2)) {
+      mt_packet_len = pkt->cmd.Data[13];
+      mt_buffer = osal_mem_alloc(mt_packet_len);
+      #if DEBUG > 1
+      ProjectSpecific_UartWrite(ZBC_PORT, "\r\nCmd msg: ", 11);
+      ProjectSpecific_HexDump(&(pkt->cmd.Data[14]), pkt->cmd.DataLength);
+      #endif
+      APP_TRACE1(TRC_CMD_LQI, pkt->LinkQuality);
+      if (mt_buffer) {
+        osal_memcpy(mt_buffer, &pkt->cmd.Data[14],mt_packet_len);       //TODO: change the hardcode for 14
+        if(pkt->cmd.Data[3] == END_DEVICE_MESSAGE_TYPE_OTA_MT_REQ)
+        {
+          if((mt_buffer[2] & MT_RPC_SUBSYSTEM_MASK) < MT_RPC_SYS_MAX)
+          {
+            // Means we are within the range of well established MT sub systems
+            MT_UartProcessOTAZToolData(mt_buffer, mt_packet_len, shortAddr, pkt->srcAddr.panId);
+          }
+        }
+        else
+        if (pkt->cmd.Data[3] == END_DEVICE_MESSAGE_TYPE_OTA_MT_RESP)  
+        {
+          APP_TRACE(TRC_INIT_RESP);
+          // ProjectSpecific_SendLeaveReq();
+          // Means we have received the reply to our "init" packet. So we need to
+          // update our PAN info struct in the NV and move on to the next PAN
+          ProjectSpecific_UpdatePanInfoArray(mt_buffer, mt_packet_len, pkt->LinkQuality);
+        }
+        osal_mem_free(mt_buffer);
+      }
+    }
+  }
+}
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ProcessAppSpecificMTReq
+ *
+ * @brief   
+ *
+ * @param   
+ *
+ * @return  
+ **************************************************************************************************/
+void ProjectSpecific_ProcessAppSpecificMTReq(uint8 *mt_buffer, uint8 mt_packet_len, uint16 shortAddr)
+{
+  //uint8 len = mt_buffer[1];
+  if (mt_buffer[0] == MT_UART_SOF)
+  {
+
+  }
+  else
+  {
+    //TODO: Send error message
+  }
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ProcessAppMTCmd
+ *
+ * @brief   Handles the application specific UD-MT commands (cmd0 == APP_MT_UD_CMD0 and
+ *          cmd1 >= APP_MT_CMD_BASE), whether they came in over the serial port or OTA.
+ *          All other UD commands are left to AppUDMT.
+ *
+ * @param   MSGpkt - MT_SYS_UD_CMD message, msg is laid out as SOF | LEN | CMD0 | CMD1 | DATA | FCS
+ *
+ * @return  TRUE if the command was consumed here
+ **************************************************************************************************/
+uint8 ProjectSpecific_ProcessAppMTCmd(mtOSALSerialData_t *MSGpkt)
+{
+  uint8 *mt = MSGpkt->msg;
+  uint8 len = mt[1];
+  uint8 *data = mt + 4;
+  uint8 rsp[28];
+  uint8 idx = 0;
+
+  if (mt[2] != APP_MT_UD_CMD0 || mt[3] < APP_MT_CMD_BASE)
+  {
+    return FALSE;
+  }
+
+  idx = ProjectSpecific_ProcessAppMTCfg(mt[3], data, len, rsp);
+  if (idx)
+  {
+    ProjectSpecific_SendAppMTResp(mt[3], rsp, idx, MSGpkt->isOTA);
+    return TRUE;
+  }
+
+  switch (mt[3])
+  {
+    case APP_MT_JOIN_POLICY_GET_PAN:
+      // One entry per request so that the response fits in a single BaseED frame.
+      // The host records these to build the scan tables replayed by tools/joinpolicy_eval.
+      if (len < 1 || data[0] >= nv_num_discovered_nwks)
+      {
+        rsp[idx++] = FAILURE;
+      }
+      else
+      {
+        NWInfo_t *pan = &nv_pan_info_array[data[0]];
+        int32 score = JoinPolicy_Score(&nv_join_policy_weights, nv_pan_info_array,
+                                       nv_num_discovered_nwks, data[0]);
+        rsp[idx++] = SUCCESS;
+        rsp[idx++] = data[0];
+        rsp[idx++] = LO_UINT16(pan->panID);
+        rsp[idx++] = HI_UINT16(pan->panID);
+        rsp[idx++] = LO_UINT16(pan->address);
+        rsp[idx++] = HI_UINT16(pan->address);
+        rsp[idx++] = BREAK_UINT32(pan->channel, 0);
+        rsp[idx++] = BREAK_UINT32(pan->channel, 1);
+        rsp[idx++] = BREAK_UINT32(pan->channel, 2);
+        rsp[idx++] = BREAK_UINT32(pan->channel, 3);
+        rsp[idx++] = LO_UINT16(pan->rssi);
+        rsp[idx++] = HI_UINT16(pan->rssi);
+        rsp[idx++] = LO_UINT16(pan->lqi);
+        rsp[idx++] = HI_UINT16(pan->lqi);
+        rsp[idx++] = LO_UINT16(pan->nassoc);
+        rsp[idx++] = HI_UINT16(pan->nassoc);
+        rsp[idx++] = LO_UINT16(pan->drate);
+        rsp[idx++] = HI_UINT16(pan->drate);
+        rsp[idx++] = BREAK_UINT32(score, 0);
+        rsp[idx++] = BREAK_UINT32(score, 1);
+        rsp[idx++] = BREAK_UINT32(score, 2);
+        rsp[idx++] = BREAK_UINT32(score, 3);
+        // Appended so that hosts reading the older response still find the score
+        rsp[idx++] = pan->energy;
+      }
+      break;
+
+    case APP_MT_BACKOFF_GET_STATS:
+      rsp[idx++] = LO_UINT16(joinBackoff.attempts);
+      rsp[idx++] = HI_UINT16(joinBackoff.attempts);
+      rsp[idx++] = LO_UINT16(joinBackoff.maxAttempts);
+      rsp[idx++] = HI_UINT16(joinBackoff.maxAttempts);
+      rsp[idx++] = LO_UINT16(joinBackoff.successes);
+      rsp[idx++] = HI_UINT16(joinBackoff.successes);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.last, 0);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.last, 1);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.last, 2);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.last, 3);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.totalDelay, 0);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.totalDelay, 1);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.totalDelay, 2);
+      rsp[idx++] = BREAK_UINT32(joinBackoff.totalDelay, 3);
+      rsp[idx++] = LO_UINT16(nv_last_startup_sleep_count);
+      rsp[idx++] = HI_UINT16(nv_last_startup_sleep_count);
+      break;
+
+    case APP_MT_ROAMING_GET_STATS:
+      rsp[idx++] = LO_UINT16(roamMonitor.lqiAvg);
+      rsp[idx++] = HI_UINT16(roamMonitor.lqiAvg);
+      rsp[idx++] = LO_UINT16(roamMonitor.rssiAvg);
+      rsp[idx++] = HI_UINT16(roamMonitor.rssiAvg);
+      rsp[idx++] = LO_UINT16(roamMonitor.failAvg);
+      rsp[idx++] = HI_UINT16(roamMonitor.failAvg);
+      rsp[idx++] = roamMonitor.poorTicks;
+      rsp[idx++] = roamMonitor.degraded;
+      rsp[idx++] = LO_UINT16(roamMonitor.searches);
+      rsp[idx++] = HI_UINT16(roamMonitor.searches);
+      rsp[idx++] = LO_UINT16(roamMonitor.roams);
+      rsp[idx++] = HI_UINT16(roamMonitor.roams);
+      break;
+
+    case APP_MT_POLL_GET_STATE:
+      rsp[idx++] = LO_UINT16(pollCtl.rate);
+      rsp[idx++] = HI_UINT16(pollCtl.rate);
+      rsp[idx++] = LO_UINT16(nv_poll_rate_cfg.minRate);
+      rsp[idx++] = HI_UINT16(nv_poll_rate_cfg.minRate);
+      rsp[idx++] = LO_UINT16(nv_poll_rate_cfg.maxRate);
+      rsp[idx++] = HI_UINT16(nv_poll_rate_cfg.maxRate);
+      rsp[idx++] = nv_poll_rate_cfg.idleTicks;
+      rsp[idx++] = LO_UINT16(pollCtl.speedUps);
+      rsp[idx++] = HI_UINT16(pollCtl.speedUps);
+      rsp[idx++] = pollBurst;
+      break;
+
+    case APP_MT_TIMER_GET_STATS:
+      {
+        appTimerStats_t stats;
+        AppTimer_GetStats(&stats);
+        rsp[idx++] = BREAK_UINT32(stats.wakeups, 0);
+        rsp[idx++] = BREAK_UINT32(stats.wakeups, 1);
+        rsp[idx++] = BREAK_UINT32(stats.wakeups, 2);
+        rsp[idx++] = BREAK_UINT32(stats.wakeups, 3);
+        rsp[idx++] = BREAK_UINT32(stats.expirations, 0);
+        rsp[idx++] = BREAK_UINT32(stats.expirations, 1);
+        rsp[idx++] = BREAK_UINT32(stats.expirations, 2);
+        rsp[idx++] = BREAK_UINT32(stats.expirations, 3);
+        rsp[idx++] = BREAK_UINT32(stats.elapsed, 0);
+        rsp[idx++] = BREAK_UINT32(stats.elapsed, 1);
+        rsp[idx++] = BREAK_UINT32(stats.elapsed, 2);
+        rsp[idx++] = BREAK_UINT32(stats.elapsed, 3);
+        rsp[idx++] = BREAK_UINT32(stats.wakeupsPerHour, 0);
+        rsp[idx++] = BREAK_UINT32(stats.wakeupsPerHour, 1);
+        rsp[idx++] = BREAK_UINT32(stats.wakeupsPerHour, 2);
+        rsp[idx++] = BREAK_UINT32(stats.wakeupsPerHour, 3);
+        // A non zero byte in the request starts a new measurement period
+        if (len >= 1 && data[0])
+        {
+          AppTimer_ClearStats();
+        }
+      }
+      break;
+
+    case APP_MT_ENERGY_GET_PHASE:
+      if (len < 1 || data[0] >= ENERGY_PHASES)
+      {
+        rsp[idx++] = FAILURE;
+      }
+      else
+      {
+        const energyPhase_t *p = &energyLedger.phase[data[0]];
+        uint32 charge;
+
+        Energy_Settle(&energyLedger, osal_GetSystemClock());
+        charge = Energy_Charge(p);
+        rsp[idx++] = SUCCESS;
+        rsp[idx++] = BREAK_UINT32(p->rxOnMs, 0);
+        rsp[idx++] = BREAK_UINT32(p->rxOnMs, 1);
+        rsp[idx++] = BREAK_UINT32(p->rxOnMs, 2);
+        rsp[idx++] = BREAK_UINT32(p->rxOnMs, 3);
+        rsp[idx++] = BREAK_UINT32(p->rxOffMs, 0);
+        rsp[idx++] = BREAK_UINT32(p->rxOffMs, 1);
+        rsp[idx++] = BREAK_UINT32(p->rxOffMs, 2);
+        rsp[idx++] = BREAK_UINT32(p->rxOffMs, 3);
+        rsp[idx++] = BREAK_UINT32(p->polls, 0);
+        rsp[idx++] = BREAK_UINT32(p->polls, 1);
+        rsp[idx++] = BREAK_UINT32(p->polls, 2);
+        rsp[idx++] = BREAK_UINT32(p->polls, 3);
+        rsp[idx++] = LO_UINT16(p->tx);
+        rsp[idx++] = HI_UINT16(p->tx);
+        rsp[idx++] = LO_UINT16(p->nvWrites);
+        rsp[idx++] = HI_UINT16(p->nvWrites);
+        rsp[idx++] = BREAK_UINT32(charge, 0);
+        rsp[idx++] = BREAK_UINT32(charge, 1);
+        rsp[idx++] = BREAK_UINT32(charge, 2);
+        rsp[idx++] = BREAK_UINT32(charge, 3);
+      }
+      break;
+
+    case APP_MT_ENERGY_CLEAR:
+      Energy_Clear(&energyLedger, osal_GetSystemClock());
+      rsp[idx++] = SUCCESS;
+      break;
+
+    case APP_MT_POWER_GET_PROFILE:
+      rsp[idx++] = nv_power_profile;
+      break;
+
+    case APP_MT_POWER_SET_PROFILE:
+      rsp[idx++] = (len < 1) ? FAILURE : ProjectSpecific_SetPowerProfile(data[0]);
+      break;
+
+    case APP_MT_OTA_BLOCK:
+    case APP_MT_OTA_MCAST_BLOCK:
+      if (mt[3] == APP_MT_OTA_MCAST_BLOCK && !otaMcast)
+      {
+        // Broadcast to a group we have already left
+      }
+      else if (otaBlockCrc)
+      {
+        if (len > 4 && otaFetchActive)
+        {
+          ProjectSpecific_OtaBlockReceived(BUILD_UINT16(data[0], data[1]), BUILD_UINT16(data[2], data[3]),
+                                           data + 4, len - 4, mt[3] == APP_MT_OTA_MCAST_BLOCK);
+        }
+      }
+      else if (len > 2 && otaFetchActive)
+      {
+        ProjectSpecific_OtaBlockReceived(BUILD_UINT16(data[0], data[1]), 0, data + 2, len - 2,
+                                         mt[3] == APP_MT_OTA_MCAST_BLOCK);
+      }
+      // Not answered, the next block request acknowledges it
+      return TRUE;
+
+    case APP_MT_OTA_FETCH_START:
+      rsp[idx++] = FAILURE;
+      if (len >= 4 && data[0] && data[1] && BUILD_UINT16(data[2], data[3]) &&
+          (gpacketbitmap || otaBitmapSummary) && appInstance.otaStatus != NOT_IN_PROGRESS)
+      {
+        if (len >= 5 && (((data[4] & OTA_FETCH_BLOCK_CRC) && len < 12) ||
+                         ((data[4] & OTA_FETCH_MULTICAST) && len < 16)))
+        {
+          break;
+        }
+        // Whatever can fail goes first, so that a failed request leaves
+        // the bitmap where it is; the flat one stays for the one by one fill
+        otaFetchActive = FALSE;
+        if (len >= 5 && (data[4] & (OTA_FETCH_COMPRESSED | OTA_FETCH_DELTA)))
+        {
+          // A delta only applies to the image it was made against, the
+          // coordinator falls back to the full image otherwise
+          if ((data[4] & OTA_FETCH_DELTA) && (len < 6 || data[5] != VERSION_NUMBER))
+          {
+            break;
+          }
+          if (len < 22 ||
+              !ProjectSpecific_OtaStartStream(data[4], BUILD_UINT32(data[16], data[17], data[18], data[19]),
+                                              BUILD_UINT16(data[20], data[21])))
+          {
+            break;
+          }
+        }
+        else
+        {
+          ProjectSpecific_OtaEndStream();
+        }
+        if (len >= 5 && (data[4] & OTA_FETCH_MULTICAST))
+        {
+          if (!ProjectSpecific_OtaMcastJoin(BUILD_UINT16(data[12], data[13]), BUILD_UINT16(data[14], data[15])))
+          {
+            ProjectSpecific_OtaEndStream();
+            break;
+          }
+        }
+        else
+        {
+          ProjectSpecific_OtaMcastLeave();
+        }
+        if (!ProjectSpecific_OtaBitmapStart())
+        {
+          ProjectSpecific_OtaMcastLeave();
+          ProjectSpecific_OtaEndStream();
+          break;
+        }
+        if (otaLzss || otaDelta)
+        {
+          ProjectSpecific_OtaBitmapClear();
+        }
+        else if (len >= 12)
+        {
+          ProjectSpecific_OtaJournalStart(BUILD_UINT32(data[6], data[7], data[8], data[9]),
+                                          BUILD_UINT16(data[10], data[11]));
+        }
+        else
+        {
+          ProjectSpecific_OtaJournalStart(0, 0);
+        }
+        otaBlockSize = data[0];
+        OtaFetch_Init(&otaFetch, data[1], BUILD_UINT16(data[2], data[3]), osal_GetSystemClock());
+        ProjectSpecific_OtaNegotiateUnits();
+        otaBlockCrc = (len >= 12 && (data[4] & OTA_FETCH_BLOCK_CRC));
+        if (otaBlockCrc)
+        {
+          otaDigestExpected = BUILD_UINT16(data[10], data[11]);
+          otaDigest = ProjectSpecific_OtaSeedDigest(BUILD_UINT32(data[6], data[7], data[8], data[9]));
+        }
+        OtaThrottle_Init(&otaThrottle, &nv_ota_throttle_cfg, osal_GetSystemClock());
+        ProjectSpecific_OtaPause(FALSE);
+        otaFetchActive = TRUE;
+        elapsedTurns = 0;
+        osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+        osal_set_event(PresenceSensor_TaskID, PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+        rsp[0] = SUCCESS;
+        rsp[idx++] = otaFetch.units;
+        rsp[idx++] = otaFetch.unitsMax;
+      }
+      break;
+
+    case APP_MT_OTA_FETCH_GET_STATS:
+      rsp[idx++] = otaFetchActive;
+      rsp[idx++] = otaFetch.window;
+      rsp[idx++] = otaFetch.outstanding;
+      rsp[idx++] = BREAK_UINT32(otaFetch.requests, 0);
+      rsp[idx++] = BREAK_UINT32(otaFetch.requests, 1);
+      rsp[idx++] = BREAK_UINT32(otaFetch.requests, 2);
+      rsp[idx++] = BREAK_UINT32(otaFetch.requests, 3);
+      rsp[idx++] = BREAK_UINT32(otaFetch.received, 0);
+      rsp[idx++] = BREAK_UINT32(otaFetch.received, 1);
+      rsp[idx++] = BREAK_UINT32(otaFetch.received, 2);
+      rsp[idx++] = BREAK_UINT32(otaFetch.received, 3);
+      rsp[idx++] = BREAK_UINT32(otaFetch.timeouts, 0);
+      rsp[idx++] = BREAK_UINT32(otaFetch.timeouts, 1);
+      rsp[idx++] = BREAK_UINT32(otaFetch.timeouts, 2);
+      rsp[idx++] = BREAK_UINT32(otaFetch.timeouts, 3);
+      rsp[idx++] = BREAK_UINT32(otaStreamOffset, 0);
+      rsp[idx++] = BREAK_UINT32(otaStreamOffset, 1);
+      rsp[idx++] = BREAK_UINT32(otaStreamOffset, 2);
+      rsp[idx++] = BREAK_UINT32(otaStreamOffset, 3);
+      rsp[idx++] = BREAK_UINT32(otaFetch.corrupt, 0);
+      rsp[idx++] = BREAK_UINT32(otaFetch.corrupt, 1);
+      rsp[idx++] = BREAK_UINT32(otaFetch.corrupt, 2);
+      rsp[idx++] = BREAK_UINT32(otaFetch.corrupt, 3);
+      rsp[idx++] = LO_UINT16(otaMcastUnits);
+      rsp[idx++] = HI_UINT16(otaMcastUnits);
+      break;
+
+    case APP_MT_OTA_THROTTLE_GET_STATE:
+      rsp[idx++] = otaPaused;
+      rsp[idx++] = nv_ota_throttle_cfg.dutyPct;
+      rsp[idx++] = LO_UINT16(nv_ota_throttle_cfg.burstMs);
+      rsp[idx++] = HI_UINT16(nv_ota_throttle_cfg.burstMs);
+      rsp[idx++] = LO_UINT16(nv_ota_throttle_cfg.quietMs);
+      rsp[idx++] = HI_UINT16(nv_ota_throttle_cfg.quietMs);
+      rsp[idx++] = LO_UINT16(otaThrottle.pauses);
+      rsp[idx++] = HI_UINT16(otaThrottle.pauses);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.runMs, 0);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.runMs, 1);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.runMs, 2);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.runMs, 3);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.pauseMs, 0);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.pauseMs, 1);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.pauseMs, 2);
+      rsp[idx++] = BREAK_UINT32(otaThrottle.pauseMs, 3);
+      break;
+
+    case APP_MT_UART_GET_STATS:
+      rsp[idx++] = uartTx.policy;
+      rsp[idx++] = LO_UINT16(uartTx.count);
+      rsp[idx++] = HI_UINT16(uartTx.count);
+      rsp[idx++] = LO_UINT16(uartTx.highWater);
+      rsp[idx++] = HI_UINT16(uartTx.highWater);
+      rsp[idx++] = BREAK_UINT32(uartTx.dropped, 0);
+      rsp[idx++] = BREAK_UINT32(uartTx.dropped, 1);
+      rsp[idx++] = BREAK_UINT32(uartTx.dropped, 2);
+      rsp[idx++] = BREAK_UINT32(uartTx.dropped, 3);
+      rsp[idx++] = BREAK_UINT32(uartTx.overwritten, 0);
+      rsp[idx++] = BREAK_UINT32(uartTx.overwritten, 1);
+      rsp[idx++] = BREAK_UINT32(uartTx.overwritten, 2);
+      rsp[idx++] = BREAK_UINT32(uartTx.overwritten, 3);
+      // A non zero byte in the request starts counting again
+      if (len >= 1 && data[0])
+      {
+        uartTx.highWater = uartTx.count;
+        uartTx.dropped = 0;
+        uartTx.overwritten = 0;
+      }
+      break;
+
+    case APP_MT_TRACE_READ:
+      rsp[idx++] = LO_UINT16(trace.lost);
+      rsp[idx++] = HI_UINT16(trace.lost);
+      trace.lost = 0;
+      idx += Trace_Read(&trace, rsp + idx, sizeof(rsp) - idx);
+      break;
+
+    case APP_MT_OTA_GET_MISSING:
+      if (len < 2 || (gpacketbitmap == NULL && otaBitmapSummary == NULL))
+      {
+        rsp[idx++] = FAILURE;
+      }
+      else
+      {
+        uint16 block = BUILD_UINT16(data[0], data[1]);
+        uint16 missing = otaBitmapSummary ? otaBitmap.missing : Bitmap_CountClear(gpacketbitmap, gtotalpackets);
+        uint8 ranges = 0;
+
+        rsp[idx++] = SUCCESS;
+        rsp[idx++] = LO_UINT16(missing);
+        rsp[idx++] = HI_UINT16(missing);
+        // The coordinator asks again from after the last range for more
+        while (ranges < 4 && (block = ProjectSpecific_OtaNextMissing(block)) != BITMAP_NONE)
+        {
+          uint16 count = ProjectSpecific_OtaMissingRun(block);
+          rsp[idx++] = LO_UINT16(block);
+          rsp[idx++] = HI_UINT16(block);
+          rsp[idx++] = LO_UINT16(count);
+          rsp[idx++] = HI_UINT16(count);
+          block += count;
+          ++ranges;
+        }
+      }
+      break;
+
+    default:
+      // Unknown application command, let AppUDMT reject it
+      return FALSE;
+  }
+
+  ProjectSpecific_SendAppMTResp(mt[3], rsp, idx, MSGpkt->isOTA);
+  return TRUE;
+}
+
+// Configuration NV items read and written by application MT commands.
+// Their layout is the one of the MT payload, little endian and packed.
+static const appMTCfg_t appMTCfgTable[] =
+{
+  { APP_MT_JOIN_POLICY_GET_WEIGHTS, APP_MT_JOIN_POLICY_SET_WEIGHTS, APP_NV_JOIN_POLICY_WEIGHTS, NULL, NULL },
+  { APP_MT_BACKOFF_GET_CFG, APP_MT_BACKOFF_SET_CFG, APP_NV_RETRY_BACKOFF, NULL, ProjectSpecific_ApplyBackoffCfg },
+  { APP_MT_ROAMING_GET_CFG, APP_MT_ROAMING_SET_CFG, APP_NV_ROAMING_CFG, NULL, NULL },
+  { 0, APP_MT_POLL_SET_CFG, APP_NV_POLL_RATE_CFG, ProjectSpecific_CheckPollCfg, ProjectSpecific_ApplyPollCfg },
+  { 0, APP_MT_OTA_THROTTLE_SET_CFG, APP_NV_OTA_THROTTLE_CFG, ProjectSpecific_CheckThrottleCfg, NULL },
+};
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ProcessAppMTCfg
+ *
+ * @brief   Handles the GET and SET commands of appMTCfgTable. A GET answers with the NV item,
+ *          a SET writes it if the request carries at least the whole item and it passes the
+ *          item's check, and answers with the status.
+ *
+ * @param   cmd  - cmd1 of the request
+ *          data - request data
+ *          len  - length of data
+ *          rsp  - set to the response, large enough for any of the items
+ *
+ * @return  Bytes of the response, 0 if cmd isn't one of appMTCfgTable
+ **************************************************************************************************/
+static uint8 ProjectSpecific_ProcessAppMTCfg(uint8 cmd, uint8 *data, uint8 len, uint8 *rsp)
+{
+  const appMTCfg_t *cfg;
+  int item;
+
+  for (cfg = appMTCfgTable; cfg < appMTCfgTable + sizeof(appMTCfgTable) / sizeof(appMTCfg_t); ++cfg)
+  {
+    if (cmd != cfg->getCmd && cmd != cfg->setCmd)
+    {
+      continue;
+    }
+    item = FindNVItemIndex(cfg->id);
+    if (item < 0)
+    {
+      rsp[0] = FAILURE;
+      return 1;
+    }
+    if (cmd == cfg->getCmd)
+    {
+      osal_memcpy(rsp, appNVItemTable[item].buf, appNVItemTable[item].len);
+      return (uint8)appNVItemTable[item].len;
+    }
+    rsp[0] = FAILURE;
+    if (len >= appNVItemTable[item].len && (cfg->check == NULL || cfg->check(data)))
+    {
+      rsp[0] = SetAppNVItem(cfg->id, 0, data);
+      if (rsp[0] == SUCCESS && cfg->apply)
+      {
+        cfg->apply();
+      }
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ApplyBackoffCfg
+ *
+ * @brief   New backoff limits take effect from the next retry on, the statistics are kept.
+ *
+ * @return  None
+ **************************************************************************************************/
+static void ProjectSpecific_ApplyBackoffCfg(void)
+{
+  Backoff_SetLimits(&joinBackoff, (uint32)nv_retry_backoff.joinBase * 1000,
+                    (uint32)nv_retry_backoff.joinCap * 1000);
+  Backoff_SetLimits(&restartBackoff, RESTART_BACKOFF_BASE, nv_retry_backoff.restartCap);
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_CheckPollCfg
+ *
+ * @brief   Poll rate limits need a minimum, no larger than the maximum.
+ *
+ * @param   cfg - pollRateCfg_t to check
+ *
+ * @return  TRUE if the limits can be used
+ **************************************************************************************************/
+static uint8 ProjectSpecific_CheckPollCfg(const void *cfg)
+{
+  const pollRateCfg_t *poll = cfg;
+
+  return (poll->minRate > 0 && poll->minRate <= poll->maxRate);
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ApplyPollCfg
+ *
+ * @brief   Puts new poll rate limits in effect at once.
+ *
+ * @return  None
+ **************************************************************************************************/
+static void ProjectSpecific_ApplyPollCfg(void)
+{
+  PollCtl_SetLimits(&pollCtl, &nv_poll_rate_cfg);
+  ProjectSpecific_ApplyPollRate();
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_CheckThrottleCfg
+ *
+ * @brief   The OTA duty cycle has to be 1 to 100%, and without a burst the fetch would never run.
+ *
+ * @param   cfg - otaThrottleCfg_t to check
+ *
+ * @return  TRUE if the throttle can be used
+ **************************************************************************************************/
+static uint8 ProjectSpecific_CheckThrottleCfg(const void *cfg)
+{
+  const otaThrottleCfg_t *throttle = cfg;
+
+  return (throttle->dutyPct > 0 && throttle->dutyPct <= 100 && throttle->burstMs > 0);
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_SendAppMTResp
+ *
+ * @brief   Frames a response to an application specific UD-MT command and sends it back the
+ *          way the request came in.
+ *
+ * @param   cmd1    - command being answered
+ *          payload - response data
+ *          len     - length of payload
+ *          isOTA   - TRUE if the request came in over the air
+ *
+ * @return  None
+ **************************************************************************************************/
+static void ProjectSpecific_SendAppMTResp(uint8 cmd1, uint8 *payload, uint8 len, uint8 isOTA)
+{
+  uint8 *rsp = osal_mem_alloc(len + MT_UD_HDR_LEN + 2);
+
+  if (rsp)
+  {
+    rsp[0] = MT_SOF;
+    rsp[1] = len;
+    rsp[2] = APP_MT_UD_RSP0;
+    rsp[3] = cmd1;
+    osal_memcpy(rsp + 4, payload, len);
+    rsp[4 + len] = CalcFCS(rsp + 1, MT_UD_HDR_LEN + len);
+
+    AppUDMT_SendMTRespWrapper(rsp, len + MT_UD_HDR_LEN + 2, SERIAL_MT_CMD_RESPONSE, isOTA);
+    osal_mem_free(rsp);
+  }
+}
+
+/*********************************************************************
+ * @fn     ProjectSpecific_ProcessDevSpecificMsg
+ *
+ * @brief  This processes all device specific communication messages 
+ *
+ * @param  afIncomingMSGPacket_t *pkt - the packet that contains the msg
+ */
+void ProjectSpecific_ProcessDevSpecificMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr )
+{
+  /* INDEV */
+  /* Send received OTA message from coordinator across serial to attached
+     energy meter for processing.
+  */
+  unsigned char packet[4] = {1,2,3,4};
+  unsigned short recvd_device_id = (unsigned short)(pkt->cmd.Data[4]<<8) + pkt->cmd.Data[5];
+  //if (pkt->cmd.Data[2] == DEV_SPECIFIC_SERIAL_CMD)
+  if ( (recvd_device_id == DEVICE_ID) || (recvd_device_id == 0) )
+  {
+    packet[0] = 0x6E;
+    packet[1] = pkt->cmd.Data[6];
+    packet[2] = pkt->cmd.Data[7];
+    packet[3] = 0x6F;
+    
+    // Send data to energy meter attached to serial port, whatever the power profile
+    ProjectSpecific_UartQueue( ZBC_PORT, (unsigned char *)packet, 4);
+  }
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_CallBack
+ *
+ * @brief   
+ *
+ * @param   
  *
  * @return  
  **************************************************************************************************/
@@ -1358,6 +3705,10 @@ static void ProjectSpecific_CallBack(uint8 port, uint8 event)
   {
     ParseSerialCommand();
   }
+  if (event & HAL_UART_TX_EMPTY)
+  {
+    ProjectSpecific_UartDrain();
+  }
 }
 
 /**************************************************************************************************
@@ -1521,6 +3872,37 @@ void ProjSpecific_InitNvItems(void)
     // Move on to the next item
     i++;
   }
+  
+  ProjSpecific_MigratePanInfo();
+}
+
+/**************************************************************************************************
+ * @fn      ProjSpecific_MigratePanInfo
+ *
+ * @brief   Moves the PAN table of older firmware, stored in APP_NV_PANINFO_STRUCT without the
+ *          energy field, over to APP_NV_PAN_INFO. The energy of the moved entries is 0, which
+ *          the join policy takes as a quiet channel.
+ *
+ * @param   none
+ *
+ * @return  none
+ **************************************************************************************************/
+static void ProjSpecific_MigratePanInfo(void)
+{
+  uint16 oldLen = osal_offsetof(NWInfo_t, energy);
+  uint8 i;
+  
+  if (osal_nv_item_len(APP_NV_PANINFO_STRUCT) != oldLen * MAX_PANS_SCANNED)
+  {
+    return;
+  }
+  for (i = 0; i < MAX_PANS_SCANNED; i++)
+  {
+    osal_memset(&nv_pan_info_array[i], 0, sizeof(NWInfo_t));
+    osal_nv_read(APP_NV_PANINFO_STRUCT, i * oldLen, oldLen, &nv_pan_info_array[i]);
+  }
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, 0, sizeof(nv_pan_info_array), nv_pan_info_array);
+  osal_nv_delete(APP_NV_PANINFO_STRUCT, oldLen * MAX_PANS_SCANNED);
 }
 
 /**************************************************************************************************
@@ -1579,7 +3961,7 @@ uint8 APPNVItemInit( uint16 id, uint16 len, void *buf, uint8 setDefault )
     if ( setDefault )
     {
       // Write the default value back to NV
-      status = osal_nv_write( id, 0, len, buf );
+      status = ProjectSpecific_NvWrite( id, 0, len, buf );
     }
     else
     {
@@ -1644,13 +4026,17 @@ uint8 SetAppNVItem(uint16 id, uint16 offset, void *buf)
       status = osal_nv_item_init( id, appNVItemTable[idx].len, buf);
       if ( status == ZSUCCESS )
       {
-        status = osal_nv_write( id, offset, appNVItemTable[idx].len, buf );
+        status = ProjectSpecific_NvWrite( id, offset, appNVItemTable[idx].len, buf );
         // Now make sure the copy in RAM is updated
         if ( status == ZSUCCESS )
         {
           osal_memcpy(appNVItemTable[idx].buf, buf, appNVItemTable[idx].len);
         }
       }
+      if (id == APP_NV_COMMISSIONED_STATUS || id == APP_NV_XNV_OTA_IN_PROGRESS)
+      {
+        ProjectSpecific_UpdateEnergyPhase();
+      }
       break;
     }
   }
@@ -1719,80 +4105,154 @@ void ProjectSpecific_ProcessMTResp( mtOSALSerialData_t *MSGpkt )
 }
 
 void ProjectSpecific_TurnDownPolling() {
-    // Restore poll rates to previous state
+    // Restore poll rates to previous state, the poll rate controller takes over again
+    pollBurst = FALSE;
     zgPollRate = appInstance.pollRate;
     zgQueuedPollRate = appInstance.queuedPollRate;
     zgResponsePollRate = appInstance.responsePollRate;
-    NLME_SetPollRate(appInstance.pollRate);
+    ProjectSpecific_SetPollRate(appInstance.pollRate);
     NLME_SetQueuedPollRate(appInstance.queuedPollRate);
     NLME_SetResponseRate(appInstance.responsePollRate);
 }
 
 void ProjectSpecific_TurnUpPolling() {
-  // Save poll rates and turn polling way up
+  // Save poll rates and turn polling way up, the poll rate controller keeps its hands off
+  pollBurst = TRUE;
   appInstance.pollRate = zgPollRate;
   appInstance.queuedPollRate = zgQueuedPollRate;
   appInstance.responsePollRate = zgResponsePollRate;
-  NLME_SetPollRate(60);
+  ProjectSpecific_SetPollRate(60);
   NLME_SetQueuedPollRate(60);
   NLME_SetResponseRate(60);
 }
 
 /*
- * @fn      ProjectSpecific_PowerUpRadio (uint8 init, uint8 repeat)
+ * @fn      ProjectSpecific_PowerUpRadio (uint8 init, uint16 repeat)
  * 
  * @brief   Activates Anaren receiver and puts the device in an INIT state.  Starts a
  *          timer to power down the receiver after BaseED_RF_SHUTDOWN_TIMEOUT x
  *          BaseED_RF_SHUTDOWN_COUNT ms.
  * @param   init - if != 0, will put device into DEV_INIT state and call ZDOInitDevice()
  * @param   repeat - number of 15 second intervals to wait before powering radio back down
- *                  if 0, will use default (BaseED_RF_SHUTDOWN_REPEAT_COUNT)
+ *                  if 0, will use default (BaseED_RF_SHUTDOWN_REPEAT_COUNT),
+ *                  0xFFFF leaves the radio on until it is powered down otherwise
  */
 
-void ProjectSpecific_PowerUpRadio(uint8 init, uint8 repeat) {
+void ProjectSpecific_PowerUpRadio(uint8 init, uint16 repeat) {
   
   // Power up receiver
   uint8 rxOnIdle = TRUE;
-  ZMacSetReq( ZMacRxOnIdle, &rxOnIdle );
+  ProjectSpecific_SetRxOnIdle(rxOnIdle);
   
-  // Start the LED flashing
-  osal_stop_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT);
-  osal_start_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT, BaseED_TOGGLE_LED_TIMER);
+  // Start the LED flashing, the timer is not even started in battery mode
+  AppTimer_Stop(BaseED_TOGGLE_LED_EVT);
+  if (APP_VERBOSE()) {
+    AppTimer_Start(BaseED_TOGGLE_LED_EVT, BaseED_TOGGLE_LED_TIMER, BaseED_TOGGLE_LED_SLACK);
+  }
   
   if (init) {
-    static uint8 initComplete = FALSE;
-    if (initComplete == FALSE) {
+    if (zdoInitComplete == FALSE) {
       // Get the device into INIT mode
-      initComplete = TRUE;
+      zdoInitComplete = TRUE;
       devState = DEV_INIT;
       ZDOInitDevice( 0 );
     }
   }
   
   rfShutdownCount = 0;
-  if (repeat > 0) {
-    BaseED_rf_shutdown_count = repeat;
+  if (repeat > 0 && repeat != 0xFFFF) {
+    BaseED_rf_shutdown_count = (uint8)repeat;
   }
   // Start the shutdown timer
-  osal_stop_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT);
+  AppTimer_Stop(BaseED_RF_SHUTDOWN_EVT);
   if (repeat != 0xFFFF) {
-    osal_start_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT);
+    AppTimer_Start(BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT, BaseED_RF_SHUTDOWN_SLACK);
   }
 }
 
 void ProjectSpecific_PowerDownRadio(uint8 hold) {
-  osal_stop_timerEx(PresenceSensor_TaskID, BaseED_TOGGLE_LED_EVT); 
-  osal_stop_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT);
+  AppTimer_Stop(BaseED_TOGGLE_LED_EVT); 
+  AppTimer_Stop(BaseED_RF_SHUTDOWN_EVT);
   
   #if RFD_RCVC_ALWAYS_ON == FALSE
   uint8 rxOnIdle = FALSE;
-  ZMacSetReq( ZMacRxOnIdle, &rxOnIdle );
+  ProjectSpecific_SetRxOnIdle(rxOnIdle);
   #endif
   #ifdef HAL_TURN_OFF_LED_PRESENCE
   HAL_TURN_OFF_LED_PRESENCE();
   #endif
   if (hold) {
-    SystemReset();
+    // Held like after a reset: a device that isn't commissioned waits to be,
+    // any other one tries again after a sleep cycle
+    ProjectSpecific_EnterHold(nv_commissioned_status == NON_COMMISSIONED ? 0 : RADIO_SLEEP_TIMER_CNT_DEFAULT);
+  }
+}
+
+/*********************************************************************
+ * @fn      ProjectSpecific_EnterHold
+ *
+ * @brief   Stops the network and every application timer, NWK polling
+ *          included, and turns the receiver off, so the device drops to
+ *          its lowest power mode even if it is still associated. One long
+ *          timer wakes it up again, through the same PRESENCE_RADIO_ON_EVT
+ *          handling as a planned restart, but without the reset and the NV
+ *          write of every sleep cycle.
+ *
+ * @param   cycles - RADIO_SLEEP_TIMER_DEFAULT cycles to sleep, 0 to stay
+ *                   held until the device is powered up otherwise
+ *
+ * @return  None
+ */
+void ProjectSpecific_EnterHold(uint16 cycles)
+{
+  AppTimer_Stop(BaseED_TOGGLE_LED_EVT);
+  AppTimer_Stop(BaseED_RF_SHUTDOWN_EVT);
+  AppTimer_Stop(BaseED_NWK_JOIN_RETRY_EVT);
+  AppTimer_Stop(PRESENCE_CHECK_NETWORK_STATUS_EVT);
+  AppTimer_Stop(PRESENCE_DATARATE_CALC_EVT);
+  AppTimer_Stop(PRESENCE_RADIO_ON_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, BaseED_NWK_JOIN_STATUS_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_COORD_INIT_PACKET_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_DEV_ANNOUNCE_EVT);
+  osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_TIMER_OTA_TIMEOUT_EVT);
+  
+  // A roaming search or commissioning query is given up with its timers
+  InterPanQuery_Stop();
+  roamingSearch = FALSE;
+  rejoinInProgress = FALSE;
+  
+  // Same as holding the device at boot, ZDOInitDevice() starts it again
+  ZDApp_StopJoiningCycle();
+  osal_stop_timerEx(ZDAppTaskID, ZDO_NETWORK_INIT);
+  devState = DEV_HOLD;
+  zdoInitComplete = FALSE;
+  
+  // The NWK layer keeps polling a parent it is still associated with. The
+  // zg rates are left as they are, the wake up puts them back in effect.
+  if (pollBurst) {
+    ProjectSpecific_TurnDownPolling();
+  }
+  ProjectSpecific_SetPollRate(0);
+  NLME_SetQueuedPollRate(0);
+  NLME_SetResponseRate(0);
+  
+  #if RFD_RCVC_ALWAYS_ON == FALSE
+  uint8 rxOnIdle = FALSE;
+  ProjectSpecific_SetRxOnIdle(rxOnIdle);
+  #endif
+  #ifdef HAL_TURN_OFF_LED_PRESENCE
+  HAL_TURN_OFF_LED_PRESENCE();
+  #endif
+  
+  holdMode = TRUE;
+  holdCycles = cycles;
+  APP_TRACE1(TRC_HOLD, holdCycles);
+  if (cycles) {
+    AppTimer_Start(PRESENCE_RADIO_ON_EVT, (uint32)cycles * RADIO_SLEEP_TIMER_DEFAULT, PRESENCE_HOLD_SLACK);
   }
 }
 
@@ -1804,20 +4264,43 @@ void ProjectSpecific_PowerDownRadio(uint8 hold) {
 void ProjectSpecific_PowerDownRadioTimer() {
 
   rfShutdownCount = 0;  
-  osal_start_timerEx(PresenceSensor_TaskID, BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT);
+  AppTimer_Start(BaseED_RF_SHUTDOWN_EVT, BaseED_RF_SHUTDOWN_TIMEOUT, BaseED_RF_SHUTDOWN_SLACK);
 }
 
 /**************************************************************************************************
  * @fn      ProjSpecific_ScanforNetworks
  *
- * @brief   
+ * @brief   Scans for networks in two stages. A short energy detect scan over the candidate
+ *          channels runs first; its confirm sets PRESENCE_SCAN_NETWORKS_EVT again and the
+ *          expensive active scan then only goes to the channels that showed activity.
  *
- * @param   
+ * @param   none
  *
- * @return  
+ * @return  none
  **************************************************************************************************/
 void ProjSpecific_ScanforNetworks(void)
 {
+  if (!edScanDone)
+  {
+    osal_memset(channelEnergy, 0, sizeof(channelEnergy));
+    activeScanChannels = PRESENCE_SCAN_CANDIDATE_CHANNELS;
+    quietScanChannels = 0;
+  }
+  if (!edScanDone && !PRESENCE_SCAN_SINGLE_CHANNEL)
+  {
+    // The ED scan confirm is only handed to the network manager hook, borrow it for the scan
+    edScanSavedCB = pZDNwkMgr_EDScanConfirmCB;
+    pZDNwkMgr_EDScanConfirmCB = ProjSpecific_EDScanConfirmCB;
+    if (NLME_EDScanRequest(PRESENCE_SCAN_CANDIDATE_CHANNELS, PRESENCE_ED_SCAN_DURATION) == ZSuccess)
+    {
+      APP_TRACE(TRC_ED_SCAN);
+      return;
+    }
+    // No ED scan, active scan all the candidates like we used to
+    pZDNwkMgr_EDScanConfirmCB = edScanSavedCB;
+  }
+  edScanDone = FALSE;
+  
   /*
   zAddrType_t destAddr;
   destAddr.addrMode = (afAddrMode_t)Addr16Bit;
@@ -1830,17 +4313,85 @@ void ProjSpecific_ScanforNetworks(void)
   */
   //uint32 scanChannels = 0x00004000;
   NLME_ScanFields_t scaninfo;
-  scaninfo.channels = 0x4000; //MAX_CHANNELS_24GHZ;
+  scaninfo.channels = activeScanChannels; //MAX_CHANNELS_24GHZ;
   scaninfo.duration = BEACON_ORDER_4_SECONDS;
   scaninfo.scanType = ZMAC_ACTIVE_SCAN;
   scaninfo.scanApp = NLME_DISC_SCAN;
     
-  ProjectSpecific_UartWrite(ZBC_PORT, "SC\n\r", 4); 
+  APP_TRACE(TRC_ACTIVE_SCAN);
   NLME_NwkDiscReq2(&scaninfo);
   
   //NLME_NetworkDiscoveryRequest(scanChannels, BEACON_ORDER_1_SECOND);
 }
 
+/**************************************************************************************************
+ * @fn      ProjSpecific_EDScanConfirmCB
+ *
+ * @brief   Energy detect scan results. Keeps the energy per channel for the PAN table and
+ *          narrows the active scan down to the candidate channels that showed activity, most
+ *          active first in the debug output. If none did we still scan them all, an idle PAN
+ *          doesn't show up in an energy scan. The quiet channels are scanned after all when
+ *          the active ones turn up no PAN.
+ *
+ * @param   EDScanConfirm - status and energy per channel number
+ *
+ * @return  none
+ **************************************************************************************************/
+void ProjSpecific_EDScanConfirmCB(NLME_EDScanConfirm_t *EDScanConfirm)
+{
+  uint32 active = 0;
+  uint8 ch;
+  
+  pZDNwkMgr_EDScanConfirmCB = edScanSavedCB;
+  
+  if (EDScanConfirm->status == ZSuccess)
+  {
+    for (ch = SCAN_CHANNEL_FIRST; ch <= SCAN_CHANNEL_LAST; ++ch)
+    {
+      if (EDScanConfirm->scannedChannels & ((uint32)1 << ch))
+      {
+        channelEnergy[ch] = EDScanConfirm->energyDetectList[ch];
+        if (channelEnergy[ch] >= PRESENCE_ED_ACTIVITY_THRESHOLD)
+        {
+          active |= (uint32)1 << ch;
+        }
+      }
+    }
+  }
+  
+  if (active)
+  {
+    // The quiet ones are kept for when no PAN turns up on the active ones
+    quietScanChannels = activeScanChannels & ~active;
+    activeScanChannels = active;
+  }
+  
+  APP_TRACE32(TRC_ED_CHANNELS, activeScanChannels);
+  #ifdef DEBUG
+  {
+    // Rank the channels by energy for the log
+    uint32 left = activeScanChannels;
+    while (left)
+    {
+      uint8 best = 0;
+      for (ch = SCAN_CHANNEL_FIRST; ch <= SCAN_CHANNEL_LAST; ++ch)
+      {
+        if ((left & ((uint32)1 << ch)) && (best == 0 || channelEnergy[ch] > channelEnergy[best]))
+        {
+          best = ch;
+        }
+      }
+      APP_TRACE2(TRC_ED_CHANNEL, best, channelEnergy[best]);
+      left &= ~((uint32)1 << best);
+    }
+  }
+  #endif
+  
+  // Carry on with the active scan from the task, not from the NWK confirm
+  edScanDone = TRUE;
+  osal_set_event(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT);
+}
+
 uint8 extPanIdEqual(uint8* devPanID, uint8* testPanID)
 {
   int i;
@@ -1876,7 +4427,7 @@ void *ZDO_NwkDiscCB(void *pBuff)
 
   NetworkList = pList = nwk_getNwkDescList();
   
-  ProjectSpecific_UartWrite(ZBC_PORT, "SCCB\n\r", 6); 
+  APP_TRACE(TRC_SCAN_DONE);
   
   // Count the number of PANs found after scanning
   while (pList)
@@ -1884,24 +4435,31 @@ void *ZDO_NwkDiscCB(void *pBuff)
     if (pList->panId != COMMISSIONING_PAN && extPanIdEqual(ZDO_UseExtendedPANID, pList->extendedPANID))
       nwCount++;           // We are only concerned with networks that are NOT commissioning PANs
     pList = pList->nextDesc;
-    ProjectSpecific_UartWrite(ZBC_PORT, "NWF\n\r", 5);
+    APP_TRACE(TRC_NWK_FOUND);
 #if DEBUG > 2
     ProjectSpecific_HexDump((uint8*)pList, 20);
 #endif //DEBUG
   }
   
-  if (nwCount == 0)
+  if (nwCount == 0 && quietScanChannels)
+  {
+    // The only coordinator may sit on a channel that read below the energy threshold
+    activeScanChannels = quietScanChannels;
+    quietScanChannels = 0;
+    edScanDone = TRUE;
+    osal_set_event(PresenceSensor_TaskID, PRESENCE_SCAN_NETWORKS_EVT);
+  }
+  else if (nwCount == 0)
   {
     //ANALED1_ON();
     //ANALED2_ON();
-    ProjectSpecific_UartWrite(ZBC_PORT, "NW=0\n\r", 6);
+    APP_TRACE(TRC_NO_NWK);
     ProjectSpecific_PlannedRestart();
-    SystemReset();
     //osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_RESET_TIMER);
   }
   else
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "NW>=1\n\r", 7); 
+    APP_TRACE1(TRC_NWKS_FOUND, nwCount);
 
     // Since we have found some networks, we can now transition to IN_PROGRESS    
     uint8 comm_flag = NETWORK_COMMISSIONING_IN_PROGRESS;
@@ -1922,6 +4480,9 @@ void *ZDO_NwkDiscCB(void *pBuff)
         foundNWList[i].address = NetworkList->chosenRouter;
         foundNWList[i].lqi = NetworkList->chosenRouterLinkQuality;
         foundNWList[i].channel = (0x00000001 << NetworkList->logicalChannel);
+        if (NetworkList->logicalChannel <= SCAN_CHANNEL_LAST) {
+          foundNWList[i].energy = channelEnergy[NetworkList->logicalChannel];
+        }
         i++;
       }
       NetworkList = NetworkList->nextDesc;
@@ -1970,22 +4531,22 @@ void *ZDO_NwkDiscCB(void *pBuff)
     // MAX_PANS_SCANNED number of PANs
     
     // This initializes whole array in NV to zeroes
-    osal_nv_write(APP_NV_PANINFO_STRUCT, 0, sizeof(nv_pan_info_default_array), (void *)nv_pan_info_default_array);
+    ProjectSpecific_NvWrite(APP_NV_PAN_INFO, 0, sizeof(nv_pan_info_default_array), (void *)nv_pan_info_default_array);
     // This writes the discovered networks information to NV
     for(i = 0; i < nwCount; i++)
     {
-      // osal_nv_write(APP_NV_PANINFO_STRUCT, i * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, panID), sizeof(foundNWList[i].panID), &foundNWList[i].panID);
-      osal_nv_write(APP_NV_PANINFO_STRUCT, i * sizeof(NWInfo_t), sizeof(NWInfo_t), &foundNWList[i]);
+      // osal_nv_write(APP_NV_PAN_INFO, i * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, panID), sizeof(foundNWList[i].panID), &foundNWList[i].panID);
+      ProjectSpecific_NvWrite(APP_NV_PAN_INFO, i * sizeof(NWInfo_t), sizeof(NWInfo_t), &foundNWList[i]);
     }
     
     // Now sync the entire struc array by reading back into the shadow RAM array
     // nv_pan_info_array can now be used like a normal variable to iterate through the found PANs
-    osal_nv_read(APP_NV_PANINFO_STRUCT, 0, sizeof(nv_pan_info_array), nv_pan_info_array);
+    osal_nv_read(APP_NV_PAN_INFO, 0, sizeof(nv_pan_info_array), nv_pan_info_array);
     
     // Start timer which will make us join some network - later this will move to some kind of policy 
     //osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_COORD_INIT_PACKET_EVT, PRESENCE_SEND_COORD_INIT_PACKET_TIMER);
     //osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_JOIN_A_NETWORK_EVT, PRESENCE_JOIN_A_NETWORK_TIMER);
-    ProjectSpecific_UartWrite(ZBC_PORT, "SJT\n\r", 5);
+    APP_TRACE(TRC_JOIN_TIMER);
     osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT, PRESENCE_GATHER_NW_PARMS_TIMER);
   }
   
@@ -2043,10 +4604,7 @@ void BaseED_SendInterPanInitPackets() {
     initreq[3] = 0x08;
     initreq[4] = CalcFCS(initreq+1, MT_UD_HDR_LEN);
     
-    #ifdef DEBUG
-    ProjectSpecific_UartWrite(ZBC_PORT, "INIT_: ", 7);
-    ProjectSpecific_HexDump((uint8*) &(nv_pan_info_array[panIdx].panID), 2);
-    #endif //DEBUG
+    APP_TRACE1(TRC_INIT_TO, nv_pan_info_array[panIdx].panID);
     
     
     //[SAM] this is in the for loop.  immediately after we are done it sets t
@@ -2080,18 +4638,14 @@ void ProjectSpecific_JoinNextNw(void)
   uint16 nextPanID = nv_pan_info_array[nv_panlist_idx].panID;
   uint32 defChanlist = DEFAULT_CHANLIST;
   
-#ifdef DEBUG
-  ProjectSpecific_UartWrite(ZBC_PORT, "idx: ", 5);
-  ProjectSpecific_HexDump(&nv_panlist_idx, 1);
-  ProjectSpecific_UartWrite(ZBC_PORT, "num disc: ", 10);
-  ProjectSpecific_HexDump(&nv_num_discovered_nwks, 1);
-#endif //DEBUG
+  APP_TRACE2(TRC_PAN_LIST, nv_panlist_idx, nv_num_discovered_nwks);
   
   if (nv_panlist_idx >= nv_num_discovered_nwks) {
     // Reset panlist_idx to 0
     SetAppNVItem(APP_NV_PANLIST_IDX, 0, &idx);
     
     ProjectSpecific_PlannedRestart();
+    return;
     /*
     // Put device into DEVICE_COMMISSIONED mode (will initiate network discovery)
     // This will also ensure that APP_NV_GET_COORD_PARMS_FLAG == 1 (in ProjSpecific_InitializePanList())
@@ -2114,19 +4668,159 @@ void ProjectSpecific_JoinNextNw(void)
     idx = nv_panlist_idx + 1;
     SetAppNVItem(APP_NV_PANLIST_IDX, 0, &idx);
   
-    // Also update the PAN id/Channel so that on reboot we latch onto that network
-    osal_nv_write(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &nextPanID);
-    osal_nv_write(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &defChanlist);
-  
     // This will ensure that the entry in the assoc list of the coordinator is cleaned up
     // ProjectSpecific_SendLeaveReq();
+    
+    // Hop over to the next PAN without a reset
+    APP_TRACE1(TRC_REJOIN_NEXT, nextPanID);
+    ProjectSpecific_RejoinPan(nextPanID, defChanlist);
+    return;
   }
-  ProjectSpecific_UartWrite(ZBC_PORT, "RST=NNW\n\r", 9);
+  APP_TRACE(TRC_RESET_NEXT);
   //uint8 comm_stat = NETWORK_COMMISSIONING_COMPLETED;  
   //SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_stat);
   osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_RESET_TIMER);
 }
 
+/**************************************************************************************************
+ * @fn      ProjectSpecific_RejoinPan
+ *
+ * @brief   Moves the device over to another PAN without a reset. The NWK layer is reset and
+ *          ZDApp is restarted in join mode on the new PAN id and channel list, the same way it
+ *          would come up after a reboot, minus the boot and NV load. PRESENCE_RESET_EVT is armed
+ *          as a watchdog and is stopped once the ZDO state change to end device arrives.
+ *
+ * @param   panid    - PAN to join
+ * @param   chanlist - channel mask to look for it on
+ *
+ * @return  TRUE if the rejoin was started, FALSE if we fell back to a reset right away
+ **************************************************************************************************/
+uint8 ProjectSpecific_RejoinPan(uint16 panid, uint32 chanlist)
+{
+  // Update the PAN id/Channel in NV first so that should we have to reset after all,
+  // we latch onto that network on reboot
+  ProjectSpecific_NvWrite(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &panid);
+  ProjectSpecific_NvWrite(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &chanlist);
+  
+  // The commissioning state would have moved on in ProjSpecific_InitDevice on reboot
+  if (nv_commissioned_status == NETWORK_COMMISSIONING_IN_PROGRESS) {
+    uint8 comm_flag = NETWORK_COMMISSIONED;
+    SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_flag);
+  }
+  
+  if (NLME_ResetRequest() != ZSuccess) {
+    APP_TRACE(TRC_REJOIN_RESET_FAILED);
+    rejoinInProgress = FALSE;
+    osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_RESET_TIMER);
+    return FALSE;
+  }
+  
+  set_nwk_status(NWK_ORPHAN);
+  zgConfigPANID = panid;
+  zgDefaultChannelList = chanlist;
+  
+  uint8 rxOnIdle = TRUE;
+  ProjectSpecific_SetRxOnIdle(rxOnIdle);
+  
+  // Restart the ZDApp state machine as if we just came out of reset
+  devState = DEV_INIT;
+  devStartMode = MODE_JOIN;
+  ZDApp_NetworkInit( 0 );
+  
+  // Check on the join and put the coordinator reset flag back to its default, as
+  // ProjSpecific_InitDevice does after the reboot this replaces. There is no planned
+  // restart sleep here, so a planned reset is checked on like a normal one.
+  if (nv_coord_reset == COORD_RESET_IMMEDIATE) {
+    ProjectSpecific_StartCheckNwStatusEvt(0);
+  }
+  else {
+    ProjectSpecific_StartCheckNwStatusEvt(PRESENCE_NORMAL_RESET_DELAY);
+  }
+  uint8 rst = APP_NV_COORD_RESET_DEFAULT;
+  SetAppNVItem(APP_NV_COORD_RESET, 0, &rst);
+  
+  rejoinInProgress = TRUE;
+  osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_REJOIN_TIMER);
+  return TRUE;
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_ApplyNwkFingerprint
+ *
+ * @brief   Points the network configuration at the fingerprinted network so that ZDApp joins
+ *          it straight away on a single channel. Must be called before ZDApp starts the
+ *          network, i.e. from ProjSpecific_InitDevice.
+ *
+ * @param   none
+ *
+ * @return  none
+ **************************************************************************************************/
+void ProjectSpecific_ApplyNwkFingerprint(void)
+{
+  fingerprintSavedPanID = zgConfigPANID;
+  fingerprintSavedChanList = zgDefaultChannelList;
+  osal_memcpy(fingerprintSavedExtPanID, ZDO_UseExtendedPANID, Z_EXTADDR_LEN);
+  
+  zgConfigPANID = nv_nwk_fingerprint.panID;
+  zgDefaultChannelList = (uint32)1 << nv_nwk_fingerprint.logicalChannel;
+  osal_memcpy(ZDO_UseExtendedPANID, nv_nwk_fingerprint.extPanID, Z_EXTADDR_LEN);
+  fingerprintRejoin = TRUE;
+  
+  APP_TRACE2(TRC_FINGERPRINT, nv_nwk_fingerprint.panID, nv_nwk_fingerprint.logicalChannel);
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_DropNwkFingerprint
+ *
+ * @brief   Gives up on the fingerprinted network: restores the network configuration it
+ *          replaced and forgets the fingerprint so the next reset goes through discovery too.
+ *
+ * @param   none
+ *
+ * @return  none
+ **************************************************************************************************/
+void ProjectSpecific_DropNwkFingerprint(void)
+{
+  if (fingerprintRejoin) {
+    fingerprintRejoin = FALSE;
+    zgConfigPANID = fingerprintSavedPanID;
+    zgDefaultChannelList = fingerprintSavedChanList;
+    osal_memcpy(ZDO_UseExtendedPANID, fingerprintSavedExtPanID, Z_EXTADDR_LEN);
+    // The PAN list was kept for the rejoin, the discovery starts from scratch
+    ProjSpecific_InitializePanList();
+  }
+  
+  if (nv_nwk_fingerprint.commStatus != NON_COMMISSIONED) {
+    nwkFingerprint_t fp = nv_nwk_fingerprint_default;
+    SetAppNVItem(APP_NV_NWK_FINGERPRINT, 0, &fp);
+  }
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_SaveNwkFingerprint
+ *
+ * @brief   Stores the network we are joined to as the fingerprint. NV is only written when
+ *          something actually changed.
+ *
+ * @param   none
+ *
+ * @return  none
+ **************************************************************************************************/
+void ProjectSpecific_SaveNwkFingerprint(void)
+{
+  nwkFingerprint_t fp;
+  
+  osal_memset(&fp, 0, sizeof(fp));
+  fp.panID = _NIB.nwkPanId;
+  fp.logicalChannel = _NIB.nwkLogicalChannel;
+  osal_memcpy(fp.extPanID, _NIB.extendedPANID, Z_EXTADDR_LEN);
+  fp.commStatus = nv_commissioned_status;
+  
+  if (!osal_memcmp(&fp, &nv_nwk_fingerprint, sizeof(fp))) {
+    SetAppNVItem(APP_NV_NWK_FINGERPRINT, 0, &fp);
+  }
+}
+
 /**************************************************************************************************
  * @fn      ZDO_NwkLeaveCB
  *
@@ -2145,10 +4839,14 @@ void *ZDO_NwkLeaveCB(void *pBuff)
   // de-registering
   ZDO_DeregisterForZdoCB(ZDO_LEAVE_CNF_CBID);
   
-    
-  // Reset for changes to take effect
-  ProjectSpecific_UartWrite(ZBC_PORT, "RST=AP\n\r", 8); 
-  osal_start_timerEx(PresenceSensor_TaskID, PRESENCE_RESET_EVT, PRESENCE_RESET_TIMER);
+  // ProjectSpecific_ApplyJoinPolicy() left the chosen PAN in NV, go join it
+  uint16 nextPAN;
+  uint32 nextChanlist;
+  osal_nv_read(ZCD_NV_PANID, 0, sizeof( nextPAN ), &nextPAN);
+  osal_nv_read(ZCD_NV_CHANLIST, 0, sizeof( nextChanlist ), &nextChanlist);
+  
+  APP_TRACE1(TRC_REJOIN_ASSIGNED, nextPAN);
+  ProjectSpecific_RejoinPan(nextPAN, nextChanlist);
   
   // Starting the sequence of network joins
   //ProjectSpecific_ApplyJoinPolicy();
@@ -2157,15 +4855,15 @@ void *ZDO_NwkLeaveCB(void *pBuff)
 /*  
   uint16 nextPAN = foundNWList[nv_panlist_idx].panID;
   nextPAN = 0x1043;
-  osal_nv_write(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &nextPAN);
+  ProjectSpecific_NvWrite(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &nextPAN);
 
   // Second, increment the panlist index and store it in NV for the next reset
   nv_panlist_idx++;
-  osal_nv_write(APP_NV_PANLIST_IDX, 0, osal_nv_item_len(APP_NV_PANLIST_IDX), &nv_panlist_idx);
+  ProjectSpecific_NvWrite(APP_NV_PANLIST_IDX, 0, osal_nv_item_len(APP_NV_PANLIST_IDX), &nv_panlist_idx);
   
   // Third, set the channel list to default channel list, the value with which it was compiled
   uint32 defChanlist = DEFAULT_CHANLIST;
-  osal_nv_write(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &defChanlist);
+  ProjectSpecific_NvWrite(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &defChanlist);
   
   // Fourth, just do a hard reboot so that the device will be able to latch onto 
   // the network we set in the NV after it reboots
@@ -2187,16 +4885,16 @@ void ProjectSpecific_PlannedRestart() {
     uint8 comm_stat = DEVICE_COMMISSIONED;  
     SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_stat);
     
-    // Call this a planned restart so it stays in low-power mode for a bit
-    uint8 rst = COORD_RESET_PLANNED;
-    SetAppNVItem(APP_NV_COORD_RESET, 0, &rst);
-    
-    // set counter for number of 15 second sleep cycles should be performed.
+    // Number of 15 second sleep cycles to stay in low-power mode for.
+    // The previous count is kept in NV so the backoff survives a reset.
     uint16 count;
     GetAppNVItem(APP_NV_LAST_STARTUP_SLEEP_COUNT, &count);
-    count = (count << 1 > MAX_STARTUP_SLEEP_COUNT) ? MAX_STARTUP_SLEEP_COUNT : count << 1;
+    restartBackoff.last = count;
+    count = (uint16)Backoff_Next(&restartBackoff);
     SetAppNVItem(APP_NV_LAST_STARTUP_SLEEP_COUNT, 0, &count);
-    SetAppNVItem(APP_NV_RADIO_SLEEP_TIMER, 0, &count);
+    
+    // Sleep it off in a hold rather than across a reset
+    ProjectSpecific_EnterHold(count);
 }
 
 /**************************************************************************************************
@@ -2213,7 +4911,9 @@ void ProjSpecific_InitializePanList(void)
   uint8 pflag_on = 1;
   uint8 startidx = 0;
   uint8 paninfobuff[MAX_PANS_SCANNED * sizeof(NWInfo_t)] = {0};
-  if (nv_commissioned_status == DEVICE_COMMISSIONED)
+  // A fingerprint rejoin picks up where we left off, PAN list included, and only
+  // starts over here if it fails, see ProjectSpecific_DropNwkFingerprint()
+  if (nv_commissioned_status == DEVICE_COMMISSIONED && !fingerprintRejoin)
   {
     // We set the dirty flag for first power up indication
     SetAppNVItem(APP_NV_GET_COORD_PARMS_FLAG, 0, &pflag_on);
@@ -2222,7 +4922,7 @@ void ProjSpecific_InitializePanList(void)
     SetAppNVItem(APP_NV_PANLIST_IDX, 0, &startidx);
     
     // Initialize the PANinfo array itself too, like the array index with all zeroes
-    SetAppNVItem(APP_NV_PANINFO_STRUCT, 0, paninfobuff);
+    SetAppNVItem(APP_NV_PAN_INFO, 0, paninfobuff);
   }
   else
   {
@@ -2246,13 +4946,15 @@ typedef struct NWInfo
 /**************************************************************************************************
  * @fn      ProjectSpecific_UpdatePanInfoArray
  *
- * @brief   
+ * @brief   Stores the parameters a coordinator returned for the init packet.
  *
- * @param   
+ * @param   paninfo_buff - MT payload of the response
+ * @param   bufflen      - its length
+ * @param   linkQuality  - LQI we received the response with
  *
- * @return  
+ * @return  none
  **************************************************************************************************/
-void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen)
+void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen, uint8 linkQuality)
 {
   // uint8 idx = nv_panlist_idx - 1; // We do the -1 because by now, the idx is already incremented for the next iteration
   
@@ -2263,10 +4965,7 @@ void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen)
   uint16 numassoc = BUILD_UINT16(paninfo_buff[15], paninfo_buff[14]);
   uint16 drate =   BUILD_UINT16(paninfo_buff[17], paninfo_buff[16]);
   
-  #ifdef DEBUG
-  ProjectSpecific_UartWrite(ZBC_PORT, "PanInfo: ", 9);
-  ProjectSpecific_HexDump((uint8*)&panid, 2);
-  #endif //DEBUG
+  APP_TRACE1(TRC_PAN_INFO, panid);
   
   uint8 idx;
   for (idx = 0; idx < nv_num_discovered_nwks; ++idx) {
@@ -2281,16 +4980,16 @@ void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen)
   
   // Write all PAN specific information into NV here
   /* Let's make sure all this data is good before writing it
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, panID), sizeof(panid), &panid);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, panID), sizeof(panid), &panid);
   nv_pan_info_array[idx].panID = panid;
     
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, channel), sizeof(channel), &channel);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, channel), sizeof(channel), &channel);
   nv_pan_info_array[idx].channel = channel;
     
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, rssi), sizeof(rssi), &rssi);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, rssi), sizeof(rssi), &rssi);
   nv_pan_info_array[idx].rssi = rssi;
     
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, lqi), sizeof(lqi), &lqi);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, lqi), sizeof(lqi), &lqi);
   nv_pan_info_array[idx].lqi = lqi;
   */
     
@@ -2298,23 +4997,34 @@ void ProjectSpecific_UpdatePanInfoArray(uint8 *paninfo_buff, uint8 bufflen)
   {
     numassoc--;
   }
+
+  // The join policy weighs the RSSI reported by the coordinator, the LQI stays
+  // the one we measured on its beacon. A roaming search compares the PAN with
+  // our parent as it is heard now, so it keeps the LQI of the reply instead.
+  if (roamingSearch) {
+    lqi = linkQuality;
+    ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, lqi), sizeof(lqi), &lqi);
+    nv_pan_info_array[idx].lqi = lqi;
+  }
+  
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, rssi), sizeof(rssi), &rssi);
+  nv_pan_info_array[idx].rssi = rssi;
   
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, nassoc), sizeof(numassoc), &numassoc);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, nassoc), sizeof(numassoc), &numassoc);
   nv_pan_info_array[idx].nassoc = numassoc;
     
-  osal_nv_write(APP_NV_PANINFO_STRUCT, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, drate), sizeof(drate), &drate);
+  ProjectSpecific_NvWrite(APP_NV_PAN_INFO, idx * sizeof(NWInfo_t)+ osal_offsetof(NWInfo_t, drate), sizeof(drate), &drate);
   nv_pan_info_array[idx].drate = drate;
   
   // Now sync the entire struc array by reading back into the shadow RAM array
   // nv_pan_info_array can now be used like a normal variable to iterate through the found PANs
-  osal_nv_read(APP_NV_PANINFO_STRUCT, 0, sizeof(nv_pan_info_array), nv_pan_info_array);
-  
-  ++coordInfoResponses;
+  osal_nv_read(APP_NV_PAN_INFO, 0, sizeof(nv_pan_info_array), nv_pan_info_array);
   
-  // We've heard back from all our coordinators; stop the timeout and start the restart event right away
-  if (coordInfoResponses >= nv_num_discovered_nwks) {
-    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT);
-    osal_set_event(PresenceSensor_TaskID, PRESENCE_GATHER_NW_PARMS_EVT);
+  // Let the query engine free the slot right away; it ends the gather once
+  // we've heard back from all our coordinators
+  if (InterPanQuery_ResponseReceived(panid)) {
+    osal_stop_timerEx(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
+    osal_set_event(PresenceSensor_TaskID, PRESENCE_SEND_INTER_PAN_INIT_EVT);
   }
 }
 
@@ -2332,145 +5042,16 @@ void ProjectSpecific_ApplyJoinPolicy(void)
   uint8 comm_stat = NETWORK_COMMISSIONING_COMPLETED;  
   uint16 finalPanID = 0;
   uint32 finalChanlist = DEFAULT_CHANLIST;
-  uint16 maxLQI = 0;
-  const uint16 assocDevCost = 4;
 
-  uint8 i;  
-  for (i = 0; i < nv_num_discovered_nwks; ++i) {
-    uint16 lqi = nv_pan_info_array[i].lqi;
-    uint16 cost = nv_pan_info_array[i].nassoc * assocDevCost;
-    lqi = (lqi > cost) ? lqi - cost : 1;
-    
-    if (lqi > maxLQI) {
-      maxLQI = lqi;
-      finalPanID = nv_pan_info_array[i].panID;
-      finalChanlist = nv_pan_info_array[i].channel;
-    }
-  }
-  
-  /*
-  uint8 lqi_level = 0;
-  uint8 lqi_idx;
-  uint8 chosenLvl = 0;
-  uint8 chosenIdx = 0;
-  //map of found coordinators.
-  NWInfo_t lqi_map[NUM_LQI_PARTITION_LVLS][NUM_DEVS_PER_LQI_PARTITION] = {0};
-  uint8 lqi_partition_lens[ NUM_LQI_PARTITION_LVLS ] = {0};
-  
-  // Test policy: pick PAN with least associated devices. In practice, some kind of
-  // parameterized formula which also takes into account the RSSI and LQI should be 
-  // applied to figure out which index to use.
-  
-  //ASSUMES that pan info array is already sorted by lqi
-  //sort elements into partitioned levels in map, based on their lqi.
-  for (i = 0; i < nv_num_discovered_nwks; i++)
-  {
-    lqi_level = NUM_LQI_PARTITION_LVLS;
-    //Find partition level this element should live on.
-    while (lqi_level > 0)
-    {
-      // Note that max lqi is 0x100.
-      if ( (nv_pan_info_array[i].lqi < (lqi_level * (0x100)/(NUM_LQI_PARTITION_LVLS))) 
-           && (nv_pan_info_array[i].lqi >= ((lqi_level-1) * (0x100)/(NUM_LQI_PARTITION_LVLS))) )
-      {
-        // Get the current index for a partition.
-        //TODO this might not work
-        lqi_idx = lqi_partition_lens[lqi_level - 1];
-        
-        // boundary check on the row
-        if ( lqi_idx < NUM_DEVS_PER_LQI_PARTITION )
-        {
-          // Store on the next index, as index 0 counts the length
-          lqi_map[lqi_level - 1][lqi_idx++] = nv_pan_info_array[i];
-          lqi_partition_lens[lqi_level - 1] = lqi_idx;
-        }
-        else // partition is full.  see if we want this coordinator more than any others.
-        {
-          
-          for ( lqi_idx = 0; lqi_idx < NUM_DEVS_PER_LQI_PARTITION; ++lqi_idx )
-          {
-            if( nv_pan_info_array[i].nassoc < lqi_map[lqi_level-1][lqi_idx].nassoc)
-            {
-              lqi_map[lqi_level-1][lqi_idx] = nv_pan_info_array[i];
-              break;
-            }
-          }
-        }
-        break;
-      }
-      else
-      {
-        --lqi_level;
-      }
-    }
-  }
-  
-  // The devices are now partitioned by lqi
-  
-  //move through partitions looking for the lowest association count in the highest LQI category
-  lqi_level = chosenLvl = NUM_LQI_PARTITION_LVLS - 1;
-  lqi_idx = chosenIdx = 0;
-  uint8 minFoundFlag = FALSE;
-  
-  while( TRUE )
-  {
-    // boundary check and NOT NULL TEST
-    if ( lqi_idx < NUM_DEVS_PER_LQI_PARTITION && lqi_map[lqi_level][lqi_idx].panID != 0x0000  )
-    {
-      minFoundFlag = TRUE; //we found something, so we'll ultimately find the minimum on this level.
-      
-      //Initially, set the chosenIdx to the first coordinator it can find.
-      //NOT NULL TEST
-      if ( lqi_map[lqi_level][chosenIdx].panID == 0x0000 )
-      {
-        chosenIdx = lqi_idx;
-      }
-      else if ( lqi_map[lqi_level][lqi_idx].nassoc < lqi_map[lqi_level][chosenIdx].nassoc)
-      {
-         //lqi_map[lqi_level ][lqi_index++];
-        chosenIdx = lqi_idx;
-      }
-      //increment index as we continue search on this level
-      ++lqi_idx;
-    }
-    else //nothing else in the row.
-    {
-      if(minFoundFlag)
-      {
-        break;
-      }
-      else
-      {
-        //force move to lower level in search
-        lqi_idx =  NUM_DEVS_PER_LQI_PARTITION;
-      }
-    }
-    // We have reached the end of the partition without finding a coordinator.
-    // Move to next lower layer.
-    if ( lqi_idx >= NUM_DEVS_PER_LQI_PARTITION )
-    {
-      lqi_idx = 0;
-      // If we've depleted the entire mapping and found no elements.
-      if (lqi_level-- == 0)
-      {
-        break;
-      }
-    }
+  // Score every PAN using the weights from NV (tunable over MT, see
+  // APP_MT_JOIN_POLICY_SET_WEIGHTS) and pick the best one.
+  uint8 best = JoinPolicy_SelectPan(&nv_join_policy_weights, nv_pan_info_array, nv_num_discovered_nwks);
+  if (best != JOIN_POLICY_NO_PAN) {
+    finalPanID = nv_pan_info_array[best].panID;
+    finalChanlist = nv_pan_info_array[best].channel;
   }
   
-    
-  // At this point we know which coordinator to join with.
-  
-  // Choose coordinator info for join.
-  finalPanID = lqi_map[lqi_level][chosenIdx].panID;
-  finalChanlist = lqi_map[lqi_level][chosenIdx].channel;
-  
-  */
-  
-  #ifdef DEBUG
-  ProjectSpecific_UartWrite(ZBC_PORT, "AP: ", 4); 
-  ProjectSpecific_HexDump((uint8*) &finalPanID, 2);
-  #endif
+  APP_TRACE1(TRC_ASSIGNED_PAN, finalPanID);
   
   uint16 pan;
   osal_nv_read( ZCD_NV_PANID, 0, sizeof( pan ), &pan );
@@ -2485,8 +5066,8 @@ void ProjectSpecific_ApplyJoinPolicy(void)
   }
   
   // Set the final PANid and channel in NV
-  osal_nv_write(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &finalPanID);
-  osal_nv_write(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &finalChanlist);
+  ProjectSpecific_NvWrite(ZCD_NV_PANID, 0, osal_nv_item_len( ZCD_NV_PANID ), &finalPanID);
+  ProjectSpecific_NvWrite(ZCD_NV_CHANLIST, 0, osal_nv_item_len( ZCD_NV_CHANLIST ), &finalChanlist);
   
   // Set flag to indicate completion of network commissioning
   // SetAppNVItem(APP_NV_COMMISSIONED_STATUS, 0, &comm_stat);
@@ -2523,7 +5104,7 @@ void ProjectSpecific_SendLeaveReq(void)
 {
   if (get_nwk_status() == NWK_JOINED)
   {
-    ProjectSpecific_UartWrite(ZBC_PORT, "LR\n\r", 4); 
+    APP_TRACE(TRC_LEAVE);
     NLME_LeaveReq_t leavingReq;
     leavingReq.extAddr = NULL;  //NULL to remove itself
     leavingReq.removeChildren = true;
@@ -2537,7 +5118,8 @@ void ProjectSpecific_SendLeaveReq(void)
  * @fn      ProjectSpecific_UartWrite
  *
  * @brief   Just a wrapper for writing to serial because while debugging
- *          we can turn off writing to serial just at one place      
+ *          we can turn off writing to serial just at one place. Nothing
+ *          is written in battery mode.
  *
  * @param   
  *
@@ -2545,8 +5127,52 @@ void ProjectSpecific_SendLeaveReq(void)
  **************************************************************************************************/
 uint16 ProjectSpecific_UartWrite(uint8 port, uint8 *buf, uint16 len)
 {
-  return HalUARTWrite(port, buf, len);
-  return 0;
+  if (!APP_VERBOSE()) {
+    return 0;
+  }
+  return ProjectSpecific_UartQueue(port, buf, len);
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_UartQueue
+ *
+ * @brief   Queues serial output in the transmit ring and returns straight away. The ring is
+ *          drained into the UART driver as the driver empties its buffer, see
+ *          ProjectSpecific_CallBack(); what doesn't fit is dropped or overwrites the oldest
+ *          output as UART_TX_POLICY says.
+ *
+ * @param   port - UART port
+ *          buf  - bytes to send
+ *          len  - length of buf
+ *
+ * @return  len if the output is queued, 0 if it was dropped
+ **************************************************************************************************/
+static uint16 ProjectSpecific_UartQueue(uint8 port, uint8 *buf, uint16 len)
+{
+  if (port != ZBC_PORT) {
+    return HalUARTWrite(port, buf, len);
+  }
+  len = TxRing_Put(&uartTx, buf, len);
+  ProjectSpecific_UartDrain();
+  return len;
+}
+
+/**************************************************************************************************
+ * @fn      ProjectSpecific_UartDrain
+ *
+ * @brief   Hands the UART driver as much of the transmit ring as it takes without waiting,
+ *          UART_TX_CHUNK bytes at a time. The rest goes on HAL_UART_TX_EMPTY.
+ *
+ * @return  None
+ **************************************************************************************************/
+static void ProjectSpecific_UartDrain(void)
+{
+  TxRing_Drain(&uartTx, ProjectSpecific_UartTxWrite, UART_TX_CHUNK);
+}
+
+static uint16 ProjectSpecific_UartTxWrite(uint8 *buf, uint16 len)
+{
+  return HalUARTWrite(ZBC_PORT, buf, len);
 }
 
 
@@ -2555,6 +5181,7 @@ uint16 ProjectSpecific_UartWrite(uint8 port, uint8 *buf, uint16 len)
  *
  * @brief   Converts a memory buffer pointed to by ptr of length len into a string
  *          of hex digits and sends it to output using ProjectSpecific_UartWrite()
+ *          In battery mode it returns before converting anything.
  *
  * @param   ptr - pointer to beginning of the memory segment to print
  *          len - number of bytes to convert and print
@@ -2567,6 +5194,9 @@ void ProjectSpecific_HexDump(uint8 *ptr, uint16 len)
   uint8 buf[256];
   uint8 *bufPtr = buf;
   int i;
+  if (!APP_VERBOSE()) {
+    return;
+  }
   for (i = 0; i < len; ++ptr, ++i) {
     *bufPtr = charMap[((*ptr) >> 4) & 0xF];
     ++bufPtr;
@@ -2575,14 +5205,31 @@ void ProjectSpecific_HexDump(uint8 *ptr, uint16 len)
   }
   *bufPtr++ = '\r';
   *bufPtr = '\n';
-  uint16 bufLen = len * 2 + 2;
-  uint16 frame;
-  const uint16 frameLen = 32;
-  for (frame = 0; frame + frameLen < bufLen; frame = frame + frameLen) {
-    ProjectSpecific_UartWrite(ZBC_PORT, buf + frame, frameLen);
-  }
-  ProjectSpecific_UartWrite(ZBC_PORT, buf + frame, bufLen - frame);
-  
+  // One write, the transmit ring takes the whole dump or none of it
+  ProjectSpecific_UartWrite(ZBC_PORT, buf, len * 2 + 2);
+}
+
+/*************************************************************************************
+ * @fn      ProjectSpecific_Trace
+ *
+ * @brief   Logs a trace event, see BaseED_trace.h; trace sites use APP_TRACE() and
+ *          friends. Only a few bytes are copied, nothing is formatted, so tracing
+ *          stays on in every power profile; APP_MT_TRACE_READ reads the records
+ *          back. In debug mode every record also goes out on the serial port behind
+ *          TRACE_SYNC, for tools/trace_decode.c to turn into text.
+ *
+ * @param   event - event id, one of TRACE_EVENTS
+ *          a     - first argument
+ *          b     - second argument
+ *************************************************************************************/
+void ProjectSpecific_Trace(uint8 event, uint16 a, uint16 b)
+{
+  uint8 rec[1 + TRACE_RECORD_MAX];
+  uint8 len;
+
+  len = Trace_Log(&trace, event, (uint16)osal_GetSystemClock(), a, b, rec + 1);
+  rec[0] = TRACE_SYNC;
+  ProjectSpecific_UartWrite(ZBC_PORT, rec, len + 1);
 }
 
 
@@ -2691,7 +5338,7 @@ void ProjectSpecific_SendMTResp(uint8 *mtbuff, uint8 mtbufflen, uint8 respType)
     MTRespPacket[idx++] = 0xDE;
     MTRespPacket[idx++] = 0xAD;
             
-    total_written = HalUARTWrite(ZBC_PORT, MTRespPacket, total_len);
+    total_written = ProjectSpecific_UartQueue(ZBC_PORT, MTRespPacket, total_len);
     osal_mem_free(MTRespPacket);
   }
   else 
@@ -2711,7 +5358,13 @@ void ProjectSpecific_SendMTResp(uint8 *mtbuff, uint8 mtbufflen, uint8 respType)
  **************************************************************************************************/
 void ProjectSpecific_ChangeToOTAMode(void)
 {
-  
+  // AppUDMT starting or resuming a one by one fill, which doesn't journal
+  if (!otaFetchActive)
+  {
+    ProjectSpecific_OtaJournalClose();
+  }
+  otaMode = TRUE;
+  ProjectSpecific_UpdateEnergyPhase();
   ProjectSpecific_TurnUpPolling();
   ProjectSpecific_PowerUpRadio(0, 0xFFFF);
   /*
@@ -2743,8 +5396,13 @@ void ProjectSpecific_ChangeToOTAMode(void)
  **************************************************************************************************/
 void ProjectSpecific_RestoreToNormalMode(void)
 {
+  // Every OTA ends here, including the ones AppUDMT finishes
+  ProjectSpecific_OtaJournalClose();
+  otaPaused = FALSE;
   ProjectSpecific_TurnDownPolling();
   ProjectSpecific_PowerDownRadio(0);
+  otaMode = FALSE;
+  ProjectSpecific_UpdateEnergyPhase();
   /*
   // Restore the values
   NLME_SetPollRate(appInstance.pollRate);
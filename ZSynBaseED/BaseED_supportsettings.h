@@ -39,12 +39,34 @@
 #define PRESENCE_SCAN_NETWORKS_EVT           0x0080
 #define PRESENCE_DATARATE_CALC_EVT           0x0040
 
+// Shared OSAL timer of the coalescing application timers (BaseED_apptimer.h),
+// BaseED_SEND_EVT is never used
+#define APP_TIMER_EVT                        0x0001
+
+
+// How late each coalesced application timer may fire, in ms
+#define BaseED_TOGGLE_LED_SLACK                200
+#define BaseED_RF_SHUTDOWN_SLACK               2000
+#define BaseED_NWK_JOIN_RETRY_SLACK            2000
+#define PRESENCE_CHECK_NETWORK_STATUS_SLACK    3000
+#define PRESENCE_DATARATE_SLACK                1000
+#define PRESENCE_HOLD_SLACK                    5000
 
 #define PRESENCE_RESET_TIMER                   1000
+#define PRESENCE_REJOIN_TIMER                  20000 // in-place rejoin gets this long before we fall back to a reset
 #define PRESENCE_SEND_COORD_INIT_PACKET_TIMER  500
 #define PRESENCE_SEND_INTER_PAN_INIT_TIMER     500
 #define PRESENCE_GATHER_NW_PARMS_TIMER         500
 #define PRESENCE_SCAN_NETWORKS_TIMER           2000
+#define PRESENCE_SCAN_CANDIDATE_CHANNELS       0x00004000  // channels coordinators may be on, widen to MAX_CHANNELS_24GHZ as needed
+#define PRESENCE_ED_SCAN_DURATION              3           // per channel, (2^n + 1) * 15.36 ms
+#define PRESENCE_ED_ACTIVITY_THRESHOLD         0x10        // channels reading less than this are active scanned last
+
+// Nothing to choose between with a single candidate, the energy scan is skipped then
+#define PRESENCE_SCAN_SINGLE_CHANNEL           ((PRESENCE_SCAN_CANDIDATE_CHANNELS & (PRESENCE_SCAN_CANDIDATE_CHANNELS - 1)) == 0)
+#define SCAN_CHANNEL_FIRST                     11
+#define SCAN_CHANNEL_LAST                      26
+#define PRESENCE_FINGERPRINT_REJOIN_TIMER      8000  // direct rejoin to the last good network before we scan
 #define PRESENCE_JOIN_A_NETWORK_TIMER          5000
 #define APPLY_JOIN_POLICY_TIMER                10000 //10 seconds
 #define OTA_GET_NEXT_PACKET_TIMEOUT_BASE       0x100
@@ -89,6 +111,111 @@
 
 #define MAX_PANS_SCANNED  10
 
+// Application NV items that are not carried in ZComDef.h
+#ifndef APP_NV_JOIN_POLICY_WEIGHTS
+#define APP_NV_JOIN_POLICY_WEIGHTS          0x0420
+#endif
+#ifndef APP_NV_NWK_FINGERPRINT
+#define APP_NV_NWK_FINGERPRINT              0x0421
+#endif
+#ifndef APP_NV_RETRY_BACKOFF
+#define APP_NV_RETRY_BACKOFF                0x0422
+#endif
+#ifndef APP_NV_ROAMING_CFG
+#define APP_NV_ROAMING_CFG                  0x0423
+#endif
+#ifndef APP_NV_POLL_RATE_CFG
+#define APP_NV_POLL_RATE_CFG                0x0424
+#endif
+#ifndef APP_NV_POWER_PROFILE
+#define APP_NV_POWER_PROFILE                0x0425
+#endif
+#ifndef APP_NV_OTA_JOURNAL
+#define APP_NV_OTA_JOURNAL                  0x0426
+#endif
+#ifndef APP_NV_OTA_THROTTLE_CFG
+#define APP_NV_OTA_THROTTLE_CFG             0x0427
+#endif
+#ifndef APP_NV_BOOT_COUNT
+#define APP_NV_BOOT_COUNT                   0x0428
+#endif
+// The PAN table, moved off APP_NV_PANINFO_STRUCT when NWInfo_t grew the energy field
+#ifndef APP_NV_PAN_INFO
+#define APP_NV_PAN_INFO                     0x0429
+#endif
+// OTA_FETCH_COMPRESSED/OTA_FETCH_DELTA of the stream being fetched, its decoders don't survive a reset
+#ifndef APP_NV_OTA_STREAM
+#define APP_NV_OTA_STREAM                   0x042A
+#endif
+
+// Application specific UD-MT commands. They share cmd0 with the AppUDMT commands
+// (see the coordinator 'init' request); cmd1 values from APP_MT_CMD_BASE upwards
+// are handled by ProjectSpecific_ProcessAppMTCmd() and never reach AppUDMT.
+#define APP_MT_UD_CMD0                      0x2B
+#define APP_MT_UD_RSP0                      0x6B
+#define APP_MT_CMD_BASE                     0x40
+
+#define APP_MT_JOIN_POLICY_GET_WEIGHTS      0x40   // rsp: 5 x int16 weights
+#define APP_MT_JOIN_POLICY_SET_WEIGHTS      0x41   // req: 5 x int16 weights, rsp: status
+#define APP_MT_JOIN_POLICY_GET_PAN          0x42   // req: index, rsp: status, NWInfo_t less energy, score, energy
+#define APP_MT_BACKOFF_GET_STATS            0x43   // rsp: join retry statistics, planned restart sleep count
+#define APP_MT_BACKOFF_GET_CFG              0x44   // rsp: retryBackoffCfg_t
+#define APP_MT_BACKOFF_SET_CFG              0x45   // req: retryBackoffCfg_t, rsp: status
+#define APP_MT_ROAMING_GET_STATS            0x46   // rsp: link averages, degraded flag, searches, roams
+#define APP_MT_ROAMING_GET_CFG              0x47   // rsp: roamingCfg_t
+#define APP_MT_ROAMING_SET_CFG              0x48   // req: roamingCfg_t, rsp: status
+#define APP_MT_POLL_GET_STATE               0x49   // rsp: current rate, pollRateCfg_t, speed ups, burst flag
+#define APP_MT_POLL_SET_CFG                 0x4A   // req: pollRateCfg_t, rsp: status
+#define APP_MT_TIMER_GET_STATS              0x4B   // req: optional clear flag, rsp: appTimerStats_t
+#define APP_MT_ENERGY_GET_PHASE             0x4C   // req: phase, rsp: status, energyPhase_t, charge in uC
+#define APP_MT_ENERGY_CLEAR                 0x4D   // rsp: status
+#define APP_MT_POWER_GET_PROFILE            0x4E   // rsp: power profile
+#define APP_MT_POWER_SET_PROFILE            0x4F   // req: power profile, rsp: status
+#define APP_MT_OTA_BLOCK_REQ                0x50   // sent by the ED: first unit, units, units per block
+#define APP_MT_OTA_BLOCK                    0x51   // req: first unit, [CRC,] data; not answered
+#define APP_MT_OTA_FETCH_START              0x52   // req: unit size, window, timeout, optional flags, base version, image length, digest,
+                                                   //      group, wait, decoded length, decoded CRC
+                                                   // rsp: status, units per block, most units per block
+#define APP_MT_OTA_FETCH_GET_STATS          0x53   // rsp: active, window, outstanding, requests, received, timeouts, bytes decoded, corrupt,
+                                                   // units received by multicast
+#define APP_MT_OTA_GET_MISSING              0x54   // req: from block, rsp: status, missing, up to 4 x first, count
+#define APP_MT_OTA_THROTTLE_GET_STATE       0x55   // rsp: paused, otaThrottleCfg_t, pauses, ms fetching, ms paused
+#define APP_MT_OTA_THROTTLE_SET_CFG         0x56   // req: otaThrottleCfg_t, rsp: status
+#define APP_MT_OTA_MCAST_BLOCK              0x57   // broadcast to the OTA group, as APP_MT_OTA_BLOCK; not answered
+#define APP_MT_UART_GET_STATS               0x58   // req: optional clear flag, rsp: policy, queued, high water, bytes dropped, overwritten
+#define APP_MT_TRACE_READ                   0x59   // rsp: records lost, then the oldest trace records that fit, see BaseED_trace.h
+
+// Flags of APP_MT_OTA_FETCH_START. A compressed image is an LZSS stream
+// (see BaseED_lzss.h) that is decoded into the image area as it comes in.
+// A delta image is a patch against the running image (see BaseED_delta.h),
+// the request then carries the VERSION_NUMBER the patch was made against.
+// Both together are a compressed patch. With block CRCs every block
+// carries the CRC of BaseED_crc.h ahead of its data; the request then also
+// carries the length of what is transferred (32 bits) and its digest, the
+// sum modulo 2^16 of the CRCs every unit would have as a block of its own.
+// With multicast the device joins an APS group the coordinator broadcasts
+// the image to in APP_MT_OTA_MCAST_BLOCK frames, and keeps whatever units
+// it is missing. The request then carries, after the digest, the group
+// and how long in ms to wait for the next broadcast block before asking
+// for the units still missing one by one. A compressed or delta request
+// ends, after the group and wait (unused without multicast), with the
+// length of the image it decodes to (32 bits) and the CRC of BaseED_crc.h
+// over that image, from CRC16_INIT. A stream that decodes to more or less
+// than that, or to another image, is given up.
+#define OTA_FETCH_COMPRESSED                0x01
+#define OTA_FETCH_DELTA                     0x02
+#define OTA_FETCH_BLOCK_CRC                 0x04
+#define OTA_FETCH_MULTICAST                 0x08
+
+// Power profiles, see ProjectSpecific_SetPowerProfile(). Battery mode drops
+// the LED blinking and the UART banners, MT responses still go out.
+#define POWER_PROFILE_DEBUG                 0
+#define POWER_PROFILE_BATTERY               1
+
+// Whether banners and LED blinking are wanted at all. Check it before
+// formatting anything for the UART, not only before writing it.
+#define APP_VERBOSE()                       (nv_power_profile == POWER_PROFILE_DEBUG)
+
 
 /* Legacy, Not Generic, Needs to be weeded out */
 #ifndef ANALED
@@ -174,8 +301,79 @@ typedef struct NWInfo
   uint16 lqi;
   uint16 nassoc;
   uint16 drate;
+  uint8 energy;           // energy detected on the channel before the active scan
 } NWInfo_t;
 
+// The last association that was known to work. After a reset the device
+// tries to rejoin it directly before falling back to the full discovery.
+typedef struct nwkFingerprint
+{
+  uint16 panID;
+  uint8  logicalChannel;
+  uint8  extPanID[Z_EXTADDR_LEN];
+  uint8  commStatus;      // deviceState_t to go back to, NON_COMMISSIONED if there is no fingerprint
+} nwkFingerprint_t;
+
+// Limits of the join retry and planned restart backoff, see BaseED_backoff.h
+typedef struct retryBackoffCfg
+{
+  uint16 joinBase;        // shortest wait before retrying to join, in seconds
+  uint16 joinCap;         // longest wait before retrying to join, in seconds
+  uint16 restartCap;      // longest planned restart sleep, in RADIO_SLEEP_TIMER_DEFAULT cycles
+} retryBackoffCfg_t;
+
+// Thresholds of the roaming monitor, see BaseED_roaming.h. Evaluations run
+// every PRESENCE_DATARATE_SAMPLE_TIMER ms.
+typedef struct roamingCfg
+{
+  uint8 lqiLow;           // average LQI below this is poor
+  uint8 lqiHigh;          // ... and at or above this good again
+  uint8 failHigh;         // AF confirm failures in percent above this are poor
+  uint8 failLow;          // ... and at or below this good again
+  uint8 holdTicks;        // evaluations the link must stay poor before we search, 0 disables roaming
+  uint8 lqiMargin;        // a candidate must have been heard this much better than our parent
+  uint8 retryTicks;       // evaluations to wait after a search that found nothing better
+} roamingCfg_t;
+
+// Parent loss thresholds for one device type, see parentLossThresholdTable
+typedef struct parentLossThresholds
+{
+  uint8 deviceType;       // DeviceInfo_t.deviceType these apply to
+  uint8 confirmFailures;  // consecutive failed AF data confirms before we orphan scan
+  uint8 pollFailures;     // poll no-acks before the NWK layer gives up on the parent (zgMaxPollFailureRetry)
+} parentLossThresholds_t;
+
+// Bounds of the poll rate controller, see BaseED_pollctl.h. Ticks are
+// PRESENCE_DATARATE_SAMPLE_TIMER ms apart.
+typedef struct pollRateCfg
+{
+  uint16 minRate;         // poll interval while there is traffic, in ms
+  uint16 maxRate;         // poll interval an idle link backs off to, in ms
+  uint8  idleTicks;       // idle ticks before the interval is doubled
+} pollRateCfg_t;
+
+// OTA progress journal in use, see BaseED_otajournal.h. Written once per
+// compaction, not per block. The records only replay onto the image they
+// were written for, told apart by everything the device knows about it.
+typedef struct otaJournalNv
+{
+  uint8  session;         // session of the journal records written since the last compaction
+  uint16 totalpackets;    // blocks of the image the journal belongs to, 0 if there is none
+  uint8  imgarea;         // appInstance.imgarea of that image
+  uint8  imgtype;         // appInstance.imgtype of that image
+  uint32 imageLen;        // bytes of the image as announced by APP_MT_OTA_FETCH_START, 0 if not
+  uint16 digest;          // digest announced with it, 0 if not
+} otaJournalNv_t;
+
+// Background OTA fetch, see BaseED_otathrottle.h. A duty cycle of 100%
+// leaves only the quiet window after sensor traffic.
+typedef struct otaThrottleCfg
+{
+  uint8  dutyPct;         // share of the time the fetch may keep the radio busy, 1..100
+  uint16 burstMs;         // longest the fetch runs at a stretch, in ms
+  uint16 quietMs;         // no fetching until nothing was sent for this long, in ms
+} otaThrottleCfg_t;
+
 // Structure for storing an NV item
 typedef struct appNVItemTab
 {
@@ -184,6 +382,18 @@ typedef struct appNVItemTab
   void *buf;
 } appNVItemTab_t;
 
+// An application MT command pair that reads and writes an NV item whole,
+// as laid out in RAM. check rejects values that can't be used, apply puts
+// a new value in effect; either may be NULL.
+typedef struct appMTCfg
+{
+  uint8 getCmd;                         // 0 if the item is only written
+  uint8 setCmd;
+  uint16 id;
+  uint8 (*check)(const void *cfg);
+  void (*apply)(void);
+} appMTCfg_t;
+
 // Struct for ... *?*
 typedef struct appNVItemDefaultValues
 {
@@ -203,5 +413,6 @@ void ProjSpecific_ZDO_state_change( void );
 void ProjectSpecific_ProcessDevSpecificMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr );
 void ProjectSpecific_ProcessCoreMsg( afIncomingMSGPacket_t *pkt, uint16 shortAddr );
 uint8 SetAppNVItem(uint16 id, uint16 offset, void *buf);
+void ProjectSpecific_Trace(uint8 event, uint16 a, uint16 b);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*******************************************************************************
+  Filename:       BaseED_trace.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Tokenized trace: binary event records in a RAM ring that
+                  gives up the oldest records when it is full.
+*******************************************************************************/
+
+#include "BaseED_trace.h"
+
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+#define TRACE_EVENT_ARGS(event, args, text)   args,
+
+// Arguments of every event
+static const uint8 traceArgs[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_EVENT_ARGS) };
+
+/*********************************************************************
+ * LOCAL FUNCTIONS
+ */
+
+static uint8 Trace_Byte( const trace_t *t, uint16 offset )
+{
+  offset += t->head;
+  if (offset >= TRACE_BYTES) {
+    offset -= TRACE_BYTES;
+  }
+  return t->buf[offset];
+}
+
+// Drops the oldest record
+static void Trace_Drop( trace_t *t )
+{
+  uint8 len = Trace_RecordLen(Trace_Byte(t, 0));
+
+  t->head += len;
+  if (t->head >= TRACE_BYTES) {
+    t->head -= TRACE_BYTES;
+  }
+  t->count -= len;
+}
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      Trace_Init
+ *
+ * @brief   Starts an empty trace.
+ *
+ * @param   t - trace to initialize
+ *
+ * @return  none
+ */
+void Trace_Init( trace_t *t )
+{
+  t->head = 0;
+  t->count = 0;
+  t->lost = 0;
+}
+
+/*********************************************************************
+ * @fn      Trace_RecordLen
+ *
+ * @brief   Bytes of a record of an event.
+ *
+ * @param   event - event id
+ *
+ * @return  3 to TRACE_RECORD_MAX
+ */
+uint8 Trace_RecordLen( uint8 event )
+{
+  return 3 + 2 * ((event < TRACE_EVENT_COUNT) ? traceArgs[event] : 0);
+}
+
+/*********************************************************************
+ * @fn      Trace_Log
+ *
+ * @brief   Logs an event, giving up the oldest records if it doesn't
+ *          fit. Arguments the event doesn't take are left out.
+ *
+ * @param   t     - trace
+ * @param   event - event id, one of TRACE_EVENTS
+ * @param   now   - current time in ms, low 16 bits
+ * @param   a     - first argument
+ * @param   b     - second argument
+ * @param   rec   - set to the record, TRACE_RECORD_MAX bytes
+ *
+ * @return  bytes of the record
+ */
+uint8 Trace_Log( trace_t *t, uint8 event, uint16 now, uint16 a, uint16 b, uint8 *rec )
+{
+  uint8 len = Trace_RecordLen(event);
+  uint16 tail;
+  uint8 i;
+
+  rec[0] = event;
+  rec[1] = (uint8)now;
+  rec[2] = (uint8)(now >> 8);
+  rec[3] = (uint8)a;
+  rec[4] = (uint8)(a >> 8);
+  rec[5] = (uint8)b;
+  rec[6] = (uint8)(b >> 8);
+
+  while (len > TRACE_BYTES - t->count) {
+    Trace_Drop(t);
+    ++t->lost;
+  }
+
+  tail = t->head + t->count;
+  if (tail >= TRACE_BYTES) {
+    tail -= TRACE_BYTES;
+  }
+  for (i = 0; i < len; ++i) {
+    t->buf[tail] = rec[i];
+    if (++tail == TRACE_BYTES) {
+      tail = 0;
+    }
+  }
+  t->count += len;
+  return len;
+}
+
+/*********************************************************************
+ * @fn      Trace_Read
+ *
+ * @brief   Takes the oldest records out of the trace, as many whole
+ *          records as fit.
+ *
+ * @param   t   - trace
+ * @param   buf - set to the records
+ * @param   max - bytes buf holds
+ *
+ * @return  bytes of records at buf
+ */
+uint8 Trace_Read( trace_t *t, uint8 *buf, uint8 max )
+{
+  uint8 n = 0;
+  uint8 len;
+  uint8 i;
+
+  while (t->count) {
+    len = Trace_RecordLen(Trace_Byte(t, 0));
+    if (len > max - n) {
+      break;
+    }
+    for (i = 0; i < len; ++i) {
+      buf[n++] = Trace_Byte(t, i);
+    }
+    Trace_Drop(t);
+  }
+  return n;
+}
@@ -0,0 +1,137 @@
+#ifndef BaseED_TRACE_H
+#define BaseED_TRACE_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the tokenized trace. A trace site doesn't format any
+text, it logs a record of an event id and up to two 16 bit arguments
+into a ring in RAM: the id byte, the low 16 bits of the ms clock and
+the arguments, 3 to 7 bytes. Turning a record back into text is left to
+tools/trace_decode.c, which takes the text of every event from the same
+TRACE_EVENTS list as the firmware. When the ring is full the oldest
+records are given up, whole, so the ring always holds the latest
+events.
+
+An event is added at the end of TRACE_EVENTS, never in between, so that
+records logged by older firmware still decode. Its text is printf like,
+%u, %d, %x and %X take one argument, %L takes both as one 32 bit value,
+low half first.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Bytes the ring holds, up to 0x8000
+#ifndef TRACE_BYTES
+#define TRACE_BYTES                         128
+#endif
+
+// Most bytes of a record
+#define TRACE_RECORD_MAX                    7
+
+// Precedes every record that is copied to the serial port
+#define TRACE_SYNC                          0xFB
+
+//    event                       args  text
+#define TRACE_EVENTS(X) \
+  X(TRC_NV_CLEANED,               0, "NV items cleaned, back to defaults") \
+  X(TRC_NV_KEPT,                  0, "NV items kept") \
+  X(TRC_DEVICE_COMMISSIONED,      0, "device commissioned") \
+  X(TRC_FINGERPRINT_REJOIN,       0, "rejoining the fingerprinted network") \
+  X(TRC_COMMISSIONING,            0, "network commissioning in progress") \
+  X(TRC_COMMISSIONING_DONE,       0, "network commissioning completed") \
+  X(TRC_PLANNED_RESET_SLEEP,      1, "planned reset, sleeping for %u cycles") \
+  X(TRC_RESET_NORMAL,             0, "normal reset") \
+  X(TRC_RESET_IMMEDIATE,          0, "immediate reset") \
+  X(TRC_PAN,                      1, "PAN %04X") \
+  X(TRC_NOT_JOINED,               0, "not joined") \
+  X(TRC_STILL_JOINED,             0, "still joined") \
+  X(TRC_STATE_CHANGE,             1, "ZDO state change, devState %u") \
+  X(TRC_FINGERPRINT_JOINED,       0, "joined the fingerprinted network") \
+  X(TRC_ACTIVE,                   1, "device active, unit timer %u") \
+  X(TRC_SEND_INIT,                0, "init packet in progress") \
+  X(TRC_KEEP_SLEEPING,            1, "keep sleeping, %u cycles left") \
+  X(TRC_POWER_UP,                 0, "radio powered up") \
+  X(TRC_NWK_PARMS_GATHERED,       0, "network parameters gathered") \
+  X(TRC_NEXT_NWK_LEAVE,           0, "next network, leaving this one") \
+  X(TRC_NEXT_NWK,                 0, "next network, not joined") \
+  X(TRC_RF_SHUTDOWN_COUNT,        1, "RF shutdown count %u") \
+  X(TRC_RF_SHUTDOWN,              0, "RF shutdown") \
+  X(TRC_FINGERPRINT_FAILED,       0, "fingerprinted network failed") \
+  X(TRC_MT_UD_CMD,                1, "MT UD command %02X") \
+  X(TRC_CHECK_NWK_STATUS,         0, "checking the network status") \
+  X(TRC_WAKE_REJOIN,              0, "waking up to attempt a rejoin") \
+  X(TRC_ALREADY_JOINED,           0, "already joined, nothing to do") \
+  X(TRC_JOIN_SLEEP,               0, "join failed, sleeping") \
+  X(TRC_JOIN_RETRY,               2, "join retry in %L ms") \
+  X(TRC_PARENT_LOST,              1, "parent lost, orphan scan %u") \
+  X(TRC_OTA_ABORTED,              0, "OAD fill-in aborted") \
+  X(TRC_ROAM_SEARCH,              0, "roaming, searching") \
+  X(TRC_ROAM_NONE,                0, "roaming, no better network") \
+  X(TRC_ROAM,                     1, "roaming to PAN %04X") \
+  X(TRC_CMD_LQI,                  1, "command received, LQI %u") \
+  X(TRC_INIT_RESP,                0, "init response received") \
+  X(TRC_HOLD,                     1, "hold for %u cycles") \
+  X(TRC_ED_SCAN,                  0, "energy scan") \
+  X(TRC_ACTIVE_SCAN,              0, "active scan") \
+  X(TRC_ED_CHANNELS,              2, "energy scan, channels %L") \
+  X(TRC_ED_CHANNEL,               2, "channel %u energy %u") \
+  X(TRC_SCAN_DONE,                0, "scan confirm") \
+  X(TRC_NWK_FOUND,                0, "network found") \
+  X(TRC_NO_NWK,                   0, "no network") \
+  X(TRC_NWKS_FOUND,               1, "%u networks") \
+  X(TRC_JOIN_TIMER,               0, "gathering network parameters") \
+  X(TRC_INIT_TO,                  1, "init to PAN %04X") \
+  X(TRC_PAN_LIST,                 2, "PAN list index %u of %u") \
+  X(TRC_REJOIN_NEXT,              1, "rejoining the next network, PAN %04X") \
+  X(TRC_RESET_NEXT,               0, "reset to join the next network") \
+  X(TRC_REJOIN_RESET_FAILED,      0, "reset for the rejoin failed") \
+  X(TRC_FINGERPRINT,              2, "fingerprint PAN %04X channel %u") \
+  X(TRC_REJOIN_ASSIGNED,          1, "rejoining the assigned PAN %04X") \
+  X(TRC_PAN_INFO,                 1, "PAN info of %04X") \
+  X(TRC_ASSIGNED_PAN,             1, "assigned PAN %04X") \
+  X(TRC_LEAVE,                    0, "leave request") \
+  X(TRC_SEND_FAILED,              1, "send failed, status %02X") \
+  X(TRC_SEND_NO_MEM,              0, "can't send, no memory") \
+  X(TRC_INTERPAN_TIMEOUT,         1, "init to PAN %04X timed out") \
+  X(TRC_CHANNEL_CHANGE,           1, "channel change, status %02X") \
+  X(TRC_INTERPAN_INIT,            1, "interpan init to PAN %04X")
+
+// Trace sites, the time stamp is taken by ProjectSpecific_Trace()
+#define APP_TRACE(event)                    ProjectSpecific_Trace(event, 0, 0)
+#define APP_TRACE1(event, a)                ProjectSpecific_Trace(event, (uint16)(a), 0)
+#define APP_TRACE2(event, a, b)             ProjectSpecific_Trace(event, (uint16)(a), (uint16)(b))
+#define APP_TRACE32(event, v)               APP_TRACE2(event, (v) & 0xFFFF, (v) >> 16)
+
+#define TRACE_EVENT_ID(event, args, text)   event,
+
+enum
+{
+  TRACE_EVENTS(TRACE_EVENT_ID)
+  TRACE_EVENT_COUNT
+};
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct trace
+{
+  uint8  buf[TRACE_BYTES];
+  uint16 head;          // first byte of the oldest record
+  uint16 count;         // bytes logged
+  uint16 lost;          // records given up since the last read
+} trace_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void Trace_Init( trace_t *t );
+uint8 Trace_Log( trace_t *t, uint8 event, uint16 now, uint16 a, uint16 b, uint8 *rec );
+uint8 Trace_Read( trace_t *t, uint8 *buf, uint8 max );
+uint8 Trace_RecordLen( uint8 event );
+
+#endif
@@ -0,0 +1,154 @@
+/*******************************************************************************
+  Filename:       BaseED_txring.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Transmit ring between the UART writers and the UART
+                  driver, with a drop or overwrite policy when it is full.
+*******************************************************************************/
+
+#include "BaseED_txring.h"
+
+
+/*********************************************************************
+ * PUBLIC FUNCTIONS
+ */
+
+/*********************************************************************
+ * @fn      TxRing_Init
+ *
+ * @brief   Starts an empty ring.
+ *
+ * @param   r      - ring to initialize
+ * @param   policy - TXRING_DROP or TXRING_OVERWRITE
+ *
+ * @return  none
+ */
+void TxRing_Init( txRing_t *r, uint8 policy )
+{
+  r->head = 0;
+  r->count = 0;
+  r->policy = policy;
+  r->highWater = 0;
+  r->dropped = 0;
+  r->overwritten = 0;
+}
+
+/*********************************************************************
+ * @fn      TxRing_Put
+ *
+ * @brief   Queues a write, whole or not at all.
+ *
+ * @param   r   - ring
+ * @param   buf - bytes to send
+ * @param   len - length of buf
+ *
+ * @return  len if the write is queued, 0 if it was dropped
+ */
+uint16 TxRing_Put( txRing_t *r, const uint8 *buf, uint16 len )
+{
+  uint16 tail;
+  uint16 i;
+
+  if (len > TXRING_BYTES || (len > TXRING_BYTES - r->count && r->policy != TXRING_OVERWRITE)) {
+    r->dropped += len;
+    return 0;
+  }
+  if (len > TXRING_BYTES - r->count) {
+    // Make room at the head
+    i = len - (TXRING_BYTES - r->count);
+    r->overwritten += i;
+    TxRing_Consume(r, i);
+  }
+
+  tail = r->head + r->count;
+  if (tail >= TXRING_BYTES) {
+    tail -= TXRING_BYTES;
+  }
+  for (i = 0; i < len; ++i) {
+    r->buf[tail] = buf[i];
+    if (++tail == TXRING_BYTES) {
+      tail = 0;
+    }
+  }
+  r->count += len;
+  if (r->count > r->highWater) {
+    r->highWater = r->count;
+  }
+  return len;
+}
+
+/*********************************************************************
+ * @fn      TxRing_Peek
+ *
+ * @brief   Oldest bytes queued that are contiguous in the ring, to hand
+ *          to the UART driver in one go.
+ *
+ * @param   r   - ring
+ * @param   buf - set to the first of them
+ *
+ * @return  number of bytes at buf, 0 if the ring is empty
+ */
+uint16 TxRing_Peek( txRing_t *r, uint8 **buf )
+{
+  uint16 n = TXRING_BYTES - r->head;
+
+  *buf = r->buf + r->head;
+  return (r->count < n) ? r->count : n;
+}
+
+/*********************************************************************
+ * @fn      TxRing_Consume
+ *
+ * @brief   Drops bytes from the head once the UART driver took them.
+ *
+ * @param   r   - ring
+ * @param   len - bytes taken, up to what is queued
+ *
+ * @return  none
+ */
+void TxRing_Consume( txRing_t *r, uint16 len )
+{
+  if (len > r->count) {
+    len = r->count;
+  }
+  r->head += len;
+  if (r->head >= TXRING_BYTES) {
+    r->head -= TXRING_BYTES;
+  }
+  r->count -= len;
+}
+
+/*********************************************************************
+ * @fn      TxRing_Drain
+ *
+ * @brief   Hands the driver as much of the ring as it takes, at most
+ *          chunk bytes per write. A driver that takes a write whole or
+ *          not at all never gets one larger than its buffer that way.
+ *
+ * @param   r     - ring
+ * @param   write - writes to the driver
+ * @param   chunk - most bytes per write
+ *
+ * @return  bytes the driver took
+ */
+uint16 TxRing_Drain( txRing_t *r, txRingWrite_t write, uint16 chunk )
+{
+  uint8 *buf;
+  uint16 len;
+  uint16 written;
+  uint16 total = 0;
+
+  while ((len = TxRing_Peek(r, &buf)) != 0) {
+    if (len > chunk) {
+      len = chunk;
+    }
+    written = write(buf, len);
+    TxRing_Consume(r, written);
+    total += written;
+    if (written < len) {
+      break;
+    }
+  }
+  return total;
+}
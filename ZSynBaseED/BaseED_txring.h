@@ -0,0 +1,58 @@
+#ifndef BaseED_TXRING_H
+#define BaseED_TXRING_H
+
+#include "BaseED_supportsettings.h"
+
+/*********************************************************************
+Header file for the UART transmit ring. Writes are queued here and
+return at once, the UART driver is fed from the ring as it drains.
+Every write goes in whole or not at all, so a banner or an MT frame is
+never cut short at the tail. When a write doesn't fit, TXRING_DROP
+drops it and TXRING_OVERWRITE drops the oldest bytes queued instead;
+those may be the head of a frame that is partly out already, the host
+resynchronizes on the sync bytes.
+*********************************************************************/
+
+/*********************************************************************
+ * MACROS
+ */
+
+// Bytes the ring holds, up to 0x8000
+#ifndef TXRING_BYTES
+#define TXRING_BYTES                        256
+#endif
+
+// What to give up when a write doesn't fit
+#define TXRING_DROP                         0   // the new write
+#define TXRING_OVERWRITE                    1   // the oldest bytes queued
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+// Hands bytes to the UART driver, returns how many it took
+typedef uint16 (*txRingWrite_t)( uint8 *buf, uint16 len );
+
+typedef struct txRing
+{
+  uint8  buf[TXRING_BYTES];
+  uint16 head;          // next byte to send
+  uint16 count;         // bytes queued
+  uint8  policy;        // TXRING_DROP or TXRING_OVERWRITE
+  // Statistics
+  uint16 highWater;     // most bytes queued at a time
+  uint32 dropped;       // bytes of writes dropped
+  uint32 overwritten;   // queued bytes given up for newer ones
+} txRing_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+void TxRing_Init( txRing_t *r, uint8 policy );
+uint16 TxRing_Put( txRing_t *r, const uint8 *buf, uint16 len );
+uint16 TxRing_Peek( txRing_t *r, uint8 **buf );
+void TxRing_Consume( txRing_t *r, uint16 len );
+uint16 TxRing_Drain( txRing_t *r, txRingWrite_t write, uint16 chunk );
+
+#endif
@@ -0,0 +1,210 @@
+/*******************************************************************************
+  Filename:       bitmap_bench.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side microbenchmark of the OTA bitmap scans. Fills in
+                  the missing blocks of a bitmap the way the OTA fill does:
+                  look for the first missing block, receive it, look again.
+                  Once testing block by block from block 0 like
+                  XNV_GetFirstPacketIndex(), once with BaseED_bitmap.c
+                  receiving a whole run of missing blocks per request.
+                  Then the same with the two level bitmap of
+                  BaseED_sparsebm.c, the flat bitmap standing in for XNV.
+
+  Build:          cc -O2 -I tools/host -I . -o bitmap_bench \
+                     tools/bitmap_bench.c BaseED_bitmap.c BaseED_sparsebm.c
+
+  Usage:          bitmap_bench [-n blocks] [-m missing%] [-r run] [-i iterations]
+
+                  Missing blocks are spread at random in runs of the given
+                  length (default 1), -m 0 leaves only the last block
+                  missing.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "BaseED_bitmap.h"
+#include "BaseED_sparsebm.h"
+
+// Same layout as bitmapfs
+#define BM_MAX_BYTES(n)   (((n) + 7) >> 3)
+#define BM_SET(b, i)      ((b)[(i) >> 3] |= (uint8)(1 << ((i) & 7)))
+#define BM_CLR(b, i)      ((b)[(i) >> 3] &= (uint8)~(1 << ((i) & 7)))
+#define BM_TEST(b, i)     (((b)[(i) >> 3] >> ((i) & 7)) & 1)
+
+static unsigned long tests;
+
+// Backing store of the two level bitmap
+static uint8 *store;
+static unsigned storeBytes;
+
+static void StoreRead( uint16 group, uint8 *leaf )
+{
+  unsigned offset = (unsigned)group * SPARSEBM_LEAF_BYTES;
+  unsigned n = storeBytes - offset;
+  memcpy(leaf, store + offset, n < SPARSEBM_LEAF_BYTES ? n : SPARSEBM_LEAF_BYTES);
+}
+
+static void StoreWrite( uint16 group, uint8 *leaf )
+{
+  unsigned offset = (unsigned)group * SPARSEBM_LEAF_BYTES;
+  unsigned n = storeBytes - offset;
+  memcpy(store + offset, leaf, n < SPARSEBM_LEAF_BYTES ? n : SPARSEBM_LEAF_BYTES);
+}
+
+static uint16 NextClearBitwise( const uint8 *bm, uint16 total, uint16 from )
+{
+  for (; from < total; ++from) {
+    ++tests;
+    if (!BM_TEST(bm, from)) {
+      return from;
+    }
+  }
+  return BITMAP_NONE;
+}
+
+static double Seconds( void )
+{
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+int main( int argc, char **argv )
+{
+  unsigned blocks = 4096;
+  unsigned missingPct = 1;
+  unsigned run = 1;
+  unsigned iterations = 2000;
+  unsigned long requests[3] = { 0, 0, 0 };
+  unsigned long loads = 0;
+  double elapsed[3];
+  sparseBm_t sparse;
+  uint8 *summary;
+  uint8 *bm;
+  uint8 *work;
+  unsigned i, it;
+  int opt;
+
+  for (opt = 1; opt < argc; ++opt) {
+    if (opt + 1 >= argc) {
+      fprintf(stderr, "usage: %s [-n blocks] [-m missing%%] [-r run] [-i iterations]\n", argv[0]);
+      return 2;
+    }
+    if (strcmp(argv[opt], "-n") == 0) {
+      blocks = (unsigned)strtoul(argv[++opt], NULL, 0);
+    }
+    else if (strcmp(argv[opt], "-m") == 0) {
+      missingPct = (unsigned)strtoul(argv[++opt], NULL, 0);
+    }
+    else if (strcmp(argv[opt], "-r") == 0) {
+      run = (unsigned)strtoul(argv[++opt], NULL, 0);
+    }
+    else if (strcmp(argv[opt], "-i") == 0) {
+      iterations = (unsigned)strtoul(argv[++opt], NULL, 0);
+    }
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[opt]);
+      return 2;
+    }
+  }
+  if (blocks == 0 || blocks >= BITMAP_NONE || run == 0) {
+    fprintf(stderr, "blocks must be 1..%u, run at least 1\n", BITMAP_NONE - 1);
+    return 2;
+  }
+
+  bm = malloc(BM_MAX_BYTES(blocks));
+  memset(bm, 0xFF, BM_MAX_BYTES(blocks));
+  srand(1);
+  for (i = 0; i < blocks; i += run) {
+    if ((unsigned)(rand() % 100) < missingPct) {
+      unsigned j;
+      for (j = i; j < i + run && j < blocks; ++j) {
+        BM_CLR(bm, j);
+      }
+    }
+  }
+  BM_CLR(bm, blocks - 1);
+  work = malloc(BM_MAX_BYTES(blocks));
+  printf("missing:  %u of %u blocks\n", Bitmap_CountClear(bm, (uint16)blocks), blocks);
+
+  // Block by block from the start for every request, one block per request
+  tests = 0;
+  elapsed[0] = Seconds();
+  for (it = 0; it < iterations; ++it) {
+    uint16 b;
+    memcpy(work, bm, BM_MAX_BYTES(blocks));
+    while ((b = NextClearBitwise(work, (uint16)blocks, 0)) != BITMAP_NONE) {
+      BM_SET(work, b);
+      ++requests[0];
+    }
+  }
+  elapsed[0] = Seconds() - elapsed[0];
+  printf("bitwise:  %10.2f us/fill  %6lu requests  %8lu tests/request\n",
+         elapsed[0] * 1e6 / iterations, requests[0] / iterations,
+         requests[0] ? tests / requests[0] : 0);
+
+  // Word at a time from where the last request left off, one request per run
+  elapsed[1] = Seconds();
+  for (it = 0; it < iterations; ++it) {
+    uint16 b = 0;
+    memcpy(work, bm, BM_MAX_BYTES(blocks));
+    while ((b = Bitmap_NextClear(work, (uint16)blocks, b)) != BITMAP_NONE) {
+      uint16 n = Bitmap_ClearRun(work, (uint16)blocks, b, 0xFFFF);
+      while (n--) {
+        BM_SET(work, b);
+        ++b;
+      }
+      ++requests[1];
+    }
+    if (Bitmap_CountClear(work, (uint16)blocks) != 0) {
+      printf("MISMATCH: wordwise fill left blocks missing\n");
+      return 1;
+    }
+  }
+  elapsed[1] = Seconds() - elapsed[1];
+  printf("wordwise: %10.2f us/fill  %6lu requests  speedup %.1fx\n",
+         elapsed[1] * 1e6 / iterations, requests[1] / iterations,
+         elapsed[1] > 0 ? elapsed[0] / elapsed[1] : 0.0);
+
+  // Two level, leaves read from and written back to the flat bitmap
+  summary = malloc(2 * SPARSEBM_SUMMARY_BYTES(blocks));
+  store = work;
+  storeBytes = BM_MAX_BYTES(blocks);
+  elapsed[2] = Seconds();
+  for (it = 0; it < iterations; ++it) {
+    uint16 b = 0;
+    memcpy(work, bm, BM_MAX_BYTES(blocks));
+    SparseBm_Init(&sparse, (uint16)blocks, summary, StoreRead, StoreWrite);
+    SparseBm_Load(&sparse);
+    while ((b = SparseBm_NextClear(&sparse, b)) != SPARSEBM_NONE) {
+      uint16 n = SparseBm_ClearRun(&sparse, b, 0xFFFF);
+      while (n--) {
+        SparseBm_Set(&sparse, b);
+        ++b;
+      }
+      ++requests[2];
+    }
+    SparseBm_Flush(&sparse);
+    loads += sparse.loads;
+    if (sparse.missing != 0 || Bitmap_CountClear(work, (uint16)blocks) != 0) {
+      printf("MISMATCH: two level fill left blocks missing\n");
+      return 1;
+    }
+  }
+  elapsed[2] = Seconds() - elapsed[2];
+  printf("twolevel: %10.2f us/fill  %6lu requests  %6lu leaf reads  %u bytes of RAM instead of %u\n",
+         elapsed[2] * 1e6 / iterations, requests[2] / iterations, loads / iterations,
+         (unsigned)(2 * SPARSEBM_SUMMARY_BYTES(blocks) + sizeof(sparse.leaf)), BM_MAX_BYTES(blocks));
+  if (requests[2] != requests[1]) {
+    printf("MISMATCH: two level fill took %lu requests, wordwise %lu\n", requests[2], requests[1]);
+    return 1;
+  }
+
+  free(summary);
+  free(work);
+  free(bm);
+  return 0;
+}
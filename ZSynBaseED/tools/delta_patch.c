@@ -0,0 +1,310 @@
+/*******************************************************************************
+  Filename:       delta_patch.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side generator and applier of delta OTA images.
+                  diff writes the patch that turns the running image into
+                  the new one, in the format BaseED_delta.c applies, then
+                  applies it again through BaseED_delta.c in block sized
+                  pieces, the way the end device gets it, and checks the
+                  result. apply only does the latter and writes the new
+                  image out. The coordinator sends the patch block by
+                  block after APP_MT_OTA_FETCH_START with OTA_FETCH_DELTA
+                  set, the VERSION_NUMBER of the running image and the
+                  length and CRC of the new one; packed
+                  with lzss_pack it goes with OTA_FETCH_COMPRESSED as well.
+
+  Build:          cc -O2 -I tools/host -I . -o delta_patch \
+                     tools/delta_patch.c BaseED_delta.c BaseED_crc.c
+
+  Usage:          delta_patch [-b blocksize] diff running new patch
+                  delta_patch [-b blocksize] apply running patch new
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BaseED_crc.h"
+#include "BaseED_delta.h"
+
+// Shorter matches are cheaper to insert than to copy
+#define MIN_COPY      6
+
+// Hash chains over the running image, of MIN_COPY byte sequences
+#define HASH_SIZE     65536
+#define CHAIN_MAX     256
+#define NIL           (-1L)
+
+// Largest image apply produces, well above any CC2530 image
+#define IMAGE_MAX     (1024L * 1024)
+
+static long head[HASH_SIZE];
+static long *chain;
+
+// Running image, read by the applier through ReadOld()
+static const unsigned char *old;
+static long oldSize;
+
+static unsigned Hash( const unsigned char *p )
+{
+  unsigned h = 0;
+  int i;
+
+  for (i = 0; i < MIN_COPY; ++i) {
+    h = h * 31 + p[i];
+  }
+  return h & (HASH_SIZE - 1);
+}
+
+static unsigned char *ReadFile( const char *name, long *size )
+{
+  FILE *f = fopen(name, "rb");
+  unsigned char *buf;
+
+  if (f == NULL) {
+    perror(name);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(*size ? *size : 1);
+  if (buf == NULL || fread(buf, 1, *size, f) != (size_t)*size) {
+    fprintf(stderr, "%s: read failed\n", name);
+    fclose(f);
+    free(buf);
+    return NULL;
+  }
+  fclose(f);
+  return buf;
+}
+
+static int WriteFile( const char *name, const unsigned char *buf, long size )
+{
+  FILE *f = fopen(name, "wb");
+
+  if (f == NULL || fwrite(buf, 1, size, f) != (size_t)size) {
+    perror(name);
+    return 0;
+  }
+  fclose(f);
+  return 1;
+}
+
+static long MatchLen( const unsigned char *a, long aLeft, const unsigned char *b, long bLeft )
+{
+  long max = (aLeft < bLeft) ? aLeft : bLeft;
+  long len = 0;
+
+  while (len < max && a[len] == b[len]) {
+    ++len;
+  }
+  return len;
+}
+
+static long FlushInsert( const unsigned char *lit, long n, unsigned char *out, long o )
+{
+  while (n > 0) {
+    long chunk = (n > DELTA_INSERT_MAX) ? DELTA_INSERT_MAX : n;
+    out[o++] = (unsigned char)(DELTA_OP_INSERT | (chunk - 1));
+    memcpy(out + o, lit, chunk);
+    o += chunk;
+    lit += chunk;
+    n -= chunk;
+  }
+  return o;
+}
+
+static long Diff( const unsigned char *cur, long size, unsigned char *out )
+{
+  long pos = 0;
+  long o = 0;
+  long litStart = 0;
+  long next = 0;    // where the last copy left off in the running image
+  long i;
+
+  for (i = 0; i < HASH_SIZE; ++i) {
+    head[i] = NIL;
+  }
+  for (i = 0; i + MIN_COPY <= oldSize; ++i) {
+    unsigned h = Hash(old + i);
+    chain[i] = head[h];
+    head[h] = i;
+  }
+
+  while (pos < size) {
+    long bestLen = 0;
+    long bestSrc = 0;
+
+    // Code that didn't move usually carries on right after the last copy
+    if (next < oldSize) {
+      bestLen = MatchLen(old + next, oldSize - next, cur + pos, size - pos);
+      bestSrc = next;
+    }
+    if (size - pos >= MIN_COPY) {
+      long cand;
+      int steps = 0;
+      for (cand = head[Hash(cur + pos)]; cand != NIL && steps < CHAIN_MAX; cand = chain[cand], ++steps) {
+        long len = MatchLen(old + cand, oldSize - cand, cur + pos, size - pos);
+        if (len > bestLen) {
+          bestLen = len;
+          bestSrc = cand;
+        }
+      }
+    }
+
+    if (bestLen < MIN_COPY) {
+      ++pos;
+      continue;
+    }
+    o = FlushInsert(cur + litStart, pos - litStart, out, o);
+    next = bestSrc + bestLen;
+    while (bestLen > 0) {
+      long n = (bestLen > DELTA_COPY_MAX) ? DELTA_COPY_MAX : bestLen;
+      out[o++] = (unsigned char)((n - 1) >> 8);
+      out[o++] = (unsigned char)((n - 1) & 0xFF);
+      out[o++] = (unsigned char)(bestSrc & 0xFF);
+      out[o++] = (unsigned char)((bestSrc >> 8) & 0xFF);
+      out[o++] = (unsigned char)((bestSrc >> 16) & 0xFF);
+      bestSrc += n;
+      pos += n;
+      bestLen -= n;
+    }
+    litStart = pos;
+  }
+  return FlushInsert(cur + litStart, pos - litStart, out, o);
+}
+
+// CRC of a whole image, as APP_MT_OTA_FETCH_START carries it
+static unsigned ImageCrc( const unsigned char *p, long size )
+{
+  uint16 crc = CRC16_INIT;
+
+  while (size > 0) {
+    uint16 n = (uint16)((size > 0x4000) ? 0x4000 : size);
+    crc = Crc16_Update(crc, p, n);
+    p += n;
+    size -= n;
+  }
+  return crc;
+}
+
+static void ReadOld( uint32 offset, uint8 *buf, uint16 len )
+{
+  // Past the end of the running image reads as erased flash
+  while (len--) {
+    *buf++ = ((long)offset < oldSize) ? old[offset] : 0xFF;
+    ++offset;
+  }
+}
+
+// Feeds the patch through the device applier block by block
+static long Apply( const unsigned char *patch, long patchSize, unsigned char *image,
+                   long imageMax, unsigned blockSize )
+{
+  static delta_t d;
+  unsigned char out[32];
+  long in = 0;
+  long o = 0;
+
+  Delta_Init(&d, (uint32)oldSize, (uint32)imageMax);
+  while (in < patchSize) {
+    uint16 len = (uint16)((patchSize - in < (long)blockSize) ? patchSize - in : blockSize);
+    const unsigned char *p = patch + in;
+
+    in += len;
+    do {
+      uint16 used;
+      uint16 n = Delta_Apply(&d, p, len, &used, out, sizeof(out), ReadOld);
+      memcpy(image + o, out, n);
+      o += n;
+      p += used;
+      len -= used;
+      if (n == 0 && used == 0) {
+        break;
+      }
+    } while (len || !Delta_Idle(&d));
+  }
+  if (Delta_Failed(&d)) {
+    fprintf(stderr, "patch copies from outside the running image or produces more than %ld bytes\n", imageMax);
+    return -1;
+  }
+  if (!Delta_Idle(&d)) {
+    fprintf(stderr, "patch ends in the middle of an operation\n");
+    return -1;
+  }
+  return o;
+}
+
+int main( int argc, char **argv )
+{
+  unsigned blockSize = 64;
+  unsigned char *cur;
+  unsigned char *patch;
+  unsigned char *check;
+  long size;
+  long patchSize;
+  long checkSize;
+  int opt = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+    blockSize = (unsigned)strtoul(argv[2], NULL, 0);
+    opt = 3;
+  }
+  if (argc - opt != 4 || blockSize == 0 || blockSize > 255 ||
+      (strcmp(argv[opt], "diff") != 0 && strcmp(argv[opt], "apply") != 0)) {
+    fprintf(stderr, "usage: %s [-b blocksize] diff running new patch\n"
+                    "       %s [-b blocksize] apply running patch new\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  old = ReadFile(argv[opt + 1], &oldSize);
+  if (old == NULL) {
+    return 1;
+  }
+
+  if (strcmp(argv[opt], "apply") == 0) {
+    patch = ReadFile(argv[opt + 2], &patchSize);
+    if (patch == NULL) {
+      return 1;
+    }
+    check = malloc(IMAGE_MAX);
+    checkSize = check ? Apply(patch, patchSize, check, IMAGE_MAX, blockSize) : -1;
+    if (checkSize < 0 || !WriteFile(argv[opt + 3], check, checkSize)) {
+      return 1;
+    }
+    printf("image:  %8ld bytes  CRC %04X\n", checkSize, ImageCrc(check, checkSize));
+    return 0;
+  }
+
+  cur = ReadFile(argv[opt + 2], &size);
+  if (cur == NULL) {
+    return 1;
+  }
+  // Worst case is all inserts
+  patch = malloc(size + size / DELTA_INSERT_MAX + 2);
+  chain = malloc((oldSize ? oldSize : 1) * sizeof(*chain));
+  check = malloc(size ? size : 1);
+  if (patch == NULL || chain == NULL || check == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  patchSize = Diff(cur, size, patch);
+
+  checkSize = Apply(patch, patchSize, check, size, blockSize);
+  if (checkSize != size || memcmp(check, cur, size) != 0) {
+    fprintf(stderr, "MISMATCH: patch doesn't reproduce %s\n", argv[opt + 2]);
+    return 1;
+  }
+  if (!WriteFile(argv[opt + 3], patch, patchSize)) {
+    return 1;
+  }
+
+  printf("image:  %8ld bytes  %6ld blocks of %u  CRC %04X\n", size, (size + blockSize - 1) / blockSize, blockSize,
+         ImageCrc(cur, size));
+  printf("patch:  %8ld bytes  %6ld blocks  %.1f%%\n", patchSize,
+         (patchSize + blockSize - 1) / blockSize, size ? 100.0 * patchSize / size : 0.0);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef SynDefines_H
+#define SynDefines_H
+
+/*********************************************************************
+Host stand-in for the Z-Stack SynDefines.h. It only provides what the
+OSAL-free BaseED modules need so that the tools in ZSynBaseED/tools can
+be built with a native compiler:
+
+  cc -I tools/host -I . -o joinpolicy_eval tools/joinpolicy_eval.c BaseED_joinpolicy.c
+*********************************************************************/
+
+#include <stdint.h>
+
+typedef uint8_t   uint8;
+typedef int8_t    int8;
+typedef uint16_t  uint16;
+typedef int16_t   int16;
+typedef uint32_t  uint32;
+typedef int32_t   int32;
+typedef uint16_t  UINT16;
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define Z_EXTADDR_LEN  8
+
+typedef uint8 OtaStatus_t;
+
+// Only ever used through pointers by the shared headers
+typedef struct afIncomingMSGPacket afIncomingMSGPacket_t;
+
+#endif
@@ -0,0 +1,184 @@
+/*******************************************************************************
+  Filename:       joinpolicy_eval.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side evaluator for the weighted join policy. Replays a
+                  recorded scan table through BaseED_joinpolicy.c and reports
+                  which PAN an end device would pick, and how a number of end
+                  devices joining one after another would spread over the
+                  coordinators.
+
+  Build:          cc -I tools/host -I . -o joinpolicy_eval \
+                     tools/joinpolicy_eval.c BaseED_joinpolicy.c
+
+  Usage:          joinpolicy_eval [-w lqi,rssi,nassoc,drate,chanocc] [-n devices] table
+
+  The scan table has one PAN per line, '#' starts a comment:
+
+                  panid channel rssi lqi nassoc drate [energy]
+
+                  Numbers may be given in decimal or 0x hex, channel is the
+                  channel mask as stored in NWInfo_t (e.g. 0x4000). energy is
+                  the ED scan reading for the channel and defaults to 0.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BaseED_joinpolicy.h"
+
+static int ParseWeights( const char *arg, joinPolicyWeights_t *weights )
+{
+  long v[5];
+  char *end;
+  int i;
+
+  for (i = 0; i < 5; ++i) {
+    v[i] = strtol(arg, &end, 0);
+    if (end == arg || (i < 4 && *end != ',') || (i == 4 && *end != '\0')) {
+      return -1;
+    }
+    arg = end + 1;
+  }
+  weights->lqi = (int16)v[0];
+  weights->rssi = (int16)v[1];
+  weights->nassoc = (int16)v[2];
+  weights->drate = (int16)v[3];
+  weights->chanOcc = (int16)v[4];
+  return 0;
+}
+
+static int LoadTable( const char *path, NWInfo_t *pans, uint8 *count )
+{
+  FILE *fp = fopen(path, "r");
+  char line[256];
+  unsigned lineno = 0;
+
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  *count = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    long v[7] = {0};
+    char *p = line;
+    char *end;
+    int n;
+
+    ++lineno;
+    if ((end = strchr(line, '#')) != NULL) {
+      *end = '\0';
+    }
+    for (n = 0; n < 7; ++n) {
+      v[n] = strtol(p, &end, 0);
+      if (end == p) {
+        break;
+      }
+      p = end;
+    }
+    if (n == 0) {
+      continue;   // blank or comment line
+    }
+    if (n < 6) {
+      fprintf(stderr, "%s:%u: expected 6 or 7 fields, got %d\n", path, lineno, n);
+      fclose(fp);
+      return -1;
+    }
+    if (*count >= MAX_PANS_SCANNED) {
+      fprintf(stderr, "%s:%u: more than %d PANs, the device only keeps %d\n",
+              path, lineno, MAX_PANS_SCANNED, MAX_PANS_SCANNED);
+      break;
+    }
+
+    NWInfo_t *pan = &pans[(*count)++];
+    memset(pan, 0, sizeof(*pan));
+    pan->panID = (uint16)v[0];
+    pan->channel = (uint32)v[1];
+    pan->rssi = (int16)v[2];
+    pan->lqi = (uint16)v[3];
+    pan->nassoc = (uint16)v[4];
+    pan->drate = (uint16)v[5];
+    pan->energy = (uint8)v[6];
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+int main( int argc, char **argv )
+{
+  joinPolicyWeights_t weights = {
+    JOIN_POLICY_WEIGHT_LQI_DEFAULT,
+    JOIN_POLICY_WEIGHT_RSSI_DEFAULT,
+    JOIN_POLICY_WEIGHT_NASSOC_DEFAULT,
+    JOIN_POLICY_WEIGHT_DRATE_DEFAULT,
+    JOIN_POLICY_WEIGHT_CHANOCC_DEFAULT
+  };
+  NWInfo_t pans[MAX_PANS_SCANNED];
+  unsigned joined[MAX_PANS_SCANNED] = {0};
+  unsigned devices = 1;
+  const char *path = NULL;
+  uint8 count;
+  uint8 i;
+  int a;
+
+  for (a = 1; a < argc; ++a) {
+    if (strcmp(argv[a], "-w") == 0 && a + 1 < argc) {
+      if (ParseWeights(argv[++a], &weights) != 0) {
+        fprintf(stderr, "bad weights '%s', expected lqi,rssi,nassoc,drate,chanocc\n", argv[a]);
+        return 2;
+      }
+    } else if (strcmp(argv[a], "-n") == 0 && a + 1 < argc) {
+      devices = (unsigned)strtoul(argv[++a], NULL, 0);
+    } else if (path == NULL && argv[a][0] != '-') {
+      path = argv[a];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s [-w lqi,rssi,nassoc,drate,chanocc] [-n devices] table\n", argv[0]);
+    return 2;
+  }
+  if (LoadTable(path, pans, &count) != 0) {
+    return 1;
+  }
+
+  printf("weights: lqi %d rssi %d nassoc %d drate %d chanocc %d\n",
+         weights.lqi, weights.rssi, weights.nassoc, weights.drate, weights.chanOcc);
+  printf("idx  panid  channel     rssi  lqi  nassoc  drate  energy  chanocc  score\n");
+  for (i = 0; i < count; ++i) {
+    printf("%3u  0x%04X 0x%08lX %5d %4u %7u %6u %7u %8u %6ld\n", i,
+           pans[i].panID, (unsigned long)pans[i].channel, pans[i].rssi,
+           pans[i].lqi, pans[i].nassoc, pans[i].drate, pans[i].energy,
+           JoinPolicy_ChannelOccupancy(pans, count, i),
+           (long)JoinPolicy_Score(&weights, pans, count, i));
+  }
+
+  // Every end device sees the same table except for the association count
+  // of the coordinators picked by the devices that joined before it.
+  for (a = 0; a < (int)devices; ++a) {
+    uint8 best = JoinPolicy_SelectPan(&weights, pans, count);
+    if (best == JOIN_POLICY_NO_PAN) {
+      printf("no usable PAN\n");
+      return 1;
+    }
+    if (devices == 1) {
+      printf("selected: idx %u panid 0x%04X\n", best, pans[best].panID);
+    }
+    ++joined[best];
+    ++pans[best].nassoc;
+  }
+
+  if (devices > 1) {
+    printf("distribution of %u joining devices:\n", devices);
+    for (i = 0; i < count; ++i) {
+      printf("  0x%04X: %u\n", pans[i].panID, joined[i]);
+    }
+  }
+  return 0;
+}
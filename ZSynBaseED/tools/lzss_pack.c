@@ -0,0 +1,244 @@
+/*******************************************************************************
+  Filename:       lzss_pack.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side packer for compressed OTA images. Writes the
+                  LZSS stream BaseED_lzss.c decodes, then decodes it again
+                  through BaseED_lzss.c in block sized pieces, the way the
+                  end device gets it, and checks the result against the
+                  input. The coordinator sends the packed file block by
+                  block after APP_MT_OTA_FETCH_START with
+                  OTA_FETCH_COMPRESSED set and the length and CRC of the
+                  image.
+
+  Build:          cc -O2 -I tools/host -I . -o lzss_pack \
+                     tools/lzss_pack.c BaseED_lzss.c BaseED_crc.c
+
+  Usage:          lzss_pack [-b blocksize] image packed
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BaseED_crc.h"
+#include "BaseED_lzss.h"
+
+// Heads of the hash chains of three byte sequences
+#define HASH_SIZE   4096
+#define NIL         (-1L)
+
+static long head[HASH_SIZE];
+static long *chain;
+
+static unsigned Hash( const unsigned char *p )
+{
+  return ((p[0] << 4) ^ (p[1] << 2) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static unsigned char *ReadFile( const char *name, long *size )
+{
+  FILE *f = fopen(name, "rb");
+  unsigned char *buf;
+
+  if (f == NULL) {
+    perror(name);
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(*size ? *size : 1);
+  if (buf == NULL || fread(buf, 1, *size, f) != (size_t)*size) {
+    fprintf(stderr, "%s: read failed\n", name);
+    fclose(f);
+    free(buf);
+    return NULL;
+  }
+  fclose(f);
+  return buf;
+}
+
+// Longest match for in[pos..] within the window, greedy
+static int FindMatch( const unsigned char *in, long size, long pos, long *dist )
+{
+  long cand;
+  int best = 0;
+  int maxLen = LZSS_MAX_MATCH;
+
+  if (size - pos < LZSS_MIN_MATCH) {
+    return 0;
+  }
+  if (size - pos < maxLen) {
+    maxLen = (int)(size - pos);
+  }
+  for (cand = head[Hash(in + pos)]; cand != NIL && pos - cand <= LZSS_WINDOW; cand = chain[cand]) {
+    int len = 0;
+    while (len < maxLen && in[cand + len] == in[pos + len]) {
+      ++len;
+    }
+    if (len > best) {
+      best = len;
+      *dist = pos - cand;
+      if (len == maxLen) {
+        break;
+      }
+    }
+  }
+  return (best >= LZSS_MIN_MATCH) ? best : 0;
+}
+
+static void Insert( const unsigned char *in, long size, long pos )
+{
+  if (size - pos >= LZSS_MIN_MATCH) {
+    unsigned h = Hash(in + pos);
+    chain[pos] = head[h];
+    head[h] = pos;
+  }
+}
+
+static long Pack( const unsigned char *in, long size, unsigned char *out )
+{
+  long pos = 0;
+  long o = 0;
+  long flagAt = 0;
+  int bit = 8;
+  long i;
+
+  for (i = 0; i < HASH_SIZE; ++i) {
+    head[i] = NIL;
+  }
+
+  while (pos < size) {
+    long dist = 0;
+    int len;
+
+    if (bit == 8) {
+      flagAt = o++;
+      out[flagAt] = 0;
+      bit = 0;
+    }
+    len = FindMatch(in, size, pos, &dist);
+    if (len) {
+      out[o++] = (unsigned char)((dist - 1) & 0xFF);
+      out[o++] = (unsigned char)((((dist - 1) >> 8) << 7) | (len - LZSS_MIN_MATCH));
+      while (len--) {
+        Insert(in, size, pos++);
+      }
+    }
+    else {
+      out[flagAt] |= (unsigned char)(1 << bit);
+      out[o++] = in[pos];
+      Insert(in, size, pos++);
+    }
+    ++bit;
+  }
+  return o;
+}
+
+// Feeds the packed stream through the device decoder block by block
+// CRC of a whole image, as APP_MT_OTA_FETCH_START carries it
+static unsigned ImageCrc( const unsigned char *p, long size )
+{
+  uint16 crc = CRC16_INIT;
+
+  while (size > 0) {
+    uint16 n = (uint16)((size > 0x4000) ? 0x4000 : size);
+    crc = Crc16_Update(crc, p, n);
+    p += n;
+    size -= n;
+  }
+  return crc;
+}
+
+static int Verify( const unsigned char *packed, long packedSize, const unsigned char *image,
+                   long size, unsigned blockSize )
+{
+  static lzss_t z;
+  unsigned char out[32];
+  long in = 0;
+  long o = 0;
+
+  Lzss_Init(&z);
+  while (in < packedSize) {
+    uint16 len = (uint16)((packedSize - in < (long)blockSize) ? packedSize - in : blockSize);
+    const unsigned char *p = packed + in;
+
+    in += len;
+    // One block: decode until it is used up and nothing is left to copy
+    do {
+      uint16 used;
+      uint16 n = Lzss_Decode(&z, p, len, &used, out, sizeof(out));
+      if (o + n > size || memcmp(out, image + o, n) != 0) {
+        fprintf(stderr, "MISMATCH at byte %ld\n", o);
+        return 0;
+      }
+      o += n;
+      p += used;
+      len -= used;
+      if (n == 0 && used == 0) {
+        break;
+      }
+    } while (len || !Lzss_Idle(&z));
+  }
+  if (o != size || !Lzss_Idle(&z)) {
+    fprintf(stderr, "MISMATCH: decoded %ld of %ld bytes\n", o, size);
+    return 0;
+  }
+  return 1;
+}
+
+int main( int argc, char **argv )
+{
+  unsigned blockSize = 64;
+  unsigned char *image;
+  unsigned char *packed;
+  long size;
+  long packedSize;
+  FILE *f;
+  int opt = 1;
+
+  if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+    blockSize = (unsigned)strtoul(argv[2], NULL, 0);
+    opt = 3;
+  }
+  if (argc - opt != 2 || blockSize == 0 || blockSize > 255) {
+    fprintf(stderr, "usage: %s [-b blocksize] image packed\n", argv[0]);
+    return 2;
+  }
+
+  image = ReadFile(argv[opt], &size);
+  if (image == NULL) {
+    return 1;
+  }
+  // Worst case is one flag byte per eight literals
+  packed = malloc(size + size / 8 + 2);
+  chain = malloc((size ? size : 1) * sizeof(*chain));
+  if (packed == NULL || chain == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  packedSize = Pack(image, size, packed);
+
+  if (!Verify(packed, packedSize, image, size, blockSize)) {
+    return 1;
+  }
+
+  f = fopen(argv[opt + 1], "wb");
+  if (f == NULL || fwrite(packed, 1, packedSize, f) != (size_t)packedSize) {
+    perror(argv[opt + 1]);
+    return 1;
+  }
+  fclose(f);
+
+  printf("image:  %8ld bytes  %6ld blocks of %u  CRC %04X\n", size, (size + blockSize - 1) / blockSize, blockSize,
+         ImageCrc(image, size));
+  printf("packed: %8ld bytes  %6ld blocks  %.1f%%\n", packedSize,
+         (packedSize + blockSize - 1) / blockSize, size ? 100.0 * packedSize / size : 0.0);
+
+  free(chain);
+  free(packed);
+  free(image);
+  return 0;
+}
@@ -0,0 +1,338 @@
+/*******************************************************************************
+  Filename:       module_check.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side checks of the OSAL free modules, built from the
+                  same sources as the firmware:
+                    - growth of the OTA fetch window
+                    - replay and keying of the OTA journal
+                    - bounds of a delta patch
+                    - flushing and reloading the two level bitmap
+                    - the UART ring wrapping around into a driver that
+                      takes a write whole or not at all
+
+  Build:          cc -O2 -I tools/host -I . -o module_check \
+                     tools/module_check.c BaseED_otafetch.c BaseED_otajournal.c \
+                     BaseED_delta.c BaseED_sparsebm.c BaseED_bitmap.c BaseED_txring.c
+
+  Usage:          module_check
+
+                  Prints MISMATCH and what didn't hold for every failed
+                  check, and returns 1 if any did.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BaseED_otafetch.h"
+#include "BaseED_otajournal.h"
+#include "BaseED_delta.h"
+#include "BaseED_sparsebm.h"
+#include "BaseED_txring.h"
+
+static unsigned checks;
+static unsigned failed;
+
+static void Check( int ok, const char *what )
+{
+  ++checks;
+  if (!ok) {
+    ++failed;
+    printf("MISMATCH: %s\n", what);
+  }
+}
+
+/*********************************************************************
+ * Fetch window
+ */
+
+#define FETCH_BLOCKS      32
+
+static uint8 fetchHave[FETCH_BLOCKS];
+
+static uint16 FetchNextMissing( uint16 from )
+{
+  for (; from < FETCH_BLOCKS; ++from) {
+    if (!fetchHave[from]) {
+      return from;
+    }
+  }
+  return OTA_FETCH_NONE;
+}
+
+static void CheckFetch( void )
+{
+  otaFetch_t f;
+  uint16 a, b;
+  uint8 count;
+
+  memset(fetchHave, 0, sizeof(fetchHave));
+  OtaFetch_Init(&f, 4, 1000, 0);
+  Check(f.window == 2, "fetch window starts at 2");
+
+  a = OtaFetch_Next(&f, 0, FetchNextMissing, &count);
+  b = OtaFetch_Next(&f, 0, FetchNextMissing, &count);
+  Check(a == 0 && b == 1, "fetch requests blocks 0 and 1");
+  Check(OtaFetch_Next(&f, 0, FetchNextMissing, &count) == OTA_FETCH_NONE,
+        "fetch stops at a full window");
+
+  // Blocks nobody asked for, or asked for once, don't open the window
+  Check(!OtaFetch_Received(&f, 7, 10), "unrequested block is not taken");
+  fetchHave[a] = 1;
+  Check(OtaFetch_Received(&f, a, 10), "requested block is taken");
+  Check(!OtaFetch_Received(&f, a, 10), "duplicate block is not taken");
+  Check(f.window == 2 && f.credit == 1, "duplicates don't grow the window");
+
+  fetchHave[b] = 1;
+  Check(OtaFetch_Received(&f, b, 20), "second requested block is taken");
+  Check(f.window == 3 && f.outstanding == 0, "window grows after a window of blocks");
+}
+
+/*********************************************************************
+ * Journal
+ */
+
+static void CheckJournal( void )
+{
+  otaJournal_t j;
+  otaJournalRecord_t rec;
+  otaJournalNv_t nv, image;
+  uint8 bm[4];
+  uint8 slot;
+
+  OtaJournal_Init(&j, 3);
+  Check(OtaJournal_Add(&j, 5, &rec) == OTA_JOURNAL_NONE, "journal holds a run back");
+  Check(OtaJournal_Add(&j, 6, &rec) == OTA_JOURNAL_NONE, "journal extends a run");
+  slot = OtaJournal_Add(&j, 20, &rec);
+  Check(slot == 0 && rec.first == 5 && rec.count == 2 && rec.session == 3,
+        "journal writes a run when it ends");
+
+  memset(bm, 0, sizeof(bm));
+  Check(OtaJournal_Replay(&rec, 3, bm, 32) && bm[0] == 0x60, "journal replays its session");
+  OtaJournal_Compacted(&j);
+  memset(bm, 0, sizeof(bm));
+  Check(!OtaJournal_Replay(&rec, j.session, bm, 32) && bm[0] == 0,
+        "journal ignores a stale session");
+  rec.first = 31;
+  Check(!OtaJournal_Replay(&rec, 3, bm, 32), "journal rejects a run past the image");
+
+  memset(&nv, 0, sizeof(nv));
+  nv.session = 3;
+  nv.totalpackets = 100;
+  nv.imgarea = 1;
+  nv.imgtype = 2;
+  nv.imageLen = 12345;
+  nv.digest = 0xBEEF;
+  image = nv;
+  image.session = 9;
+  Check(OtaJournal_SameImage(&nv, &image), "journal keys an image, not a session");
+  image.digest = 0xBEEE;
+  Check(!OtaJournal_SameImage(&nv, &image), "journal keys the digest");
+  image = nv;
+  image.imageLen = 12344;
+  Check(!OtaJournal_SameImage(&nv, &image), "journal keys the image length");
+  image = nv;
+  image.imgarea = 0;
+  Check(!OtaJournal_SameImage(&nv, &image), "journal keys the image area");
+  image = nv;
+  nv.totalpackets = image.totalpackets = 0;
+  Check(!OtaJournal_SameImage(&nv, &image), "no journal matches no image");
+}
+
+/*********************************************************************
+ * Delta
+ */
+
+static const uint8 deltaOld[16] = "0123456789abcdef";
+
+static void DeltaReadOld( uint32 offset, uint8 *buf, uint16 len )
+{
+  memcpy(buf, deltaOld + offset, len);
+}
+
+static uint16 DeltaRun( delta_t *d, const uint8 *patch, uint16 len, uint8 *out )
+{
+  uint16 used;
+  uint16 n = 0;
+
+  // A byte at a time, every operation split across pieces
+  while (len && !Delta_Failed(d)) {
+    n += Delta_Apply(d, patch, 1, &used, out + n, 64 - n, DeltaReadOld);
+    patch += used;
+    len -= used;
+    if (used == 0) {
+      break;
+    }
+  }
+  return n;
+}
+
+static void CheckDelta( void )
+{
+  // Copy 4 bytes at 10, insert "xy"
+  static const uint8 patch[] = { 0x00, 0x03, 10, 0, 0, DELTA_OP_INSERT | 1, 'x', 'y' };
+  // Copy 4 bytes at 14, 2 past the running image
+  static const uint8 outside[] = { 0x00, 0x03, 14, 0, 0 };
+  delta_t d;
+  uint8 out[64];
+  uint16 n;
+
+  Delta_Init(&d, sizeof(deltaOld), 6);
+  n = DeltaRun(&d, patch, sizeof(patch), out);
+  Check(n == 6 && memcmp(out, "abcdxy", 6) == 0, "delta produces the new image");
+  Check(Delta_Complete(&d) && !Delta_Failed(&d), "delta completes at the announced size");
+
+  Delta_Init(&d, sizeof(deltaOld), 8);
+  DeltaRun(&d, patch, sizeof(patch), out);
+  Check(!Delta_Complete(&d) && !Delta_Failed(&d), "short delta doesn't complete");
+
+  Delta_Init(&d, sizeof(deltaOld), 5);
+  DeltaRun(&d, patch, sizeof(patch), out);
+  Check(Delta_Failed(&d), "delta past the announced size fails");
+
+  Delta_Init(&d, sizeof(deltaOld), 4);
+  n = DeltaRun(&d, outside, sizeof(outside), out);
+  Check(Delta_Failed(&d) && n == 0, "copy outside the running image fails");
+}
+
+/*********************************************************************
+ * Two level bitmap
+ */
+
+#define SPARSE_UNITS      1000
+
+static uint8 sparseStore[SPARSEBM_GROUPS(SPARSE_UNITS)][SPARSEBM_LEAF_BYTES];
+static uint8 sparseSummary[2 * SPARSEBM_SUMMARY_BYTES(SPARSE_UNITS)];
+
+static void SparseRead( uint16 group, uint8 *leaf )
+{
+  memcpy(leaf, sparseStore[group], SPARSEBM_LEAF_BYTES);
+}
+
+static void SparseWrite( uint16 group, uint8 *leaf )
+{
+  memcpy(sparseStore[group], leaf, SPARSEBM_LEAF_BYTES);
+}
+
+static void CheckSparse( void )
+{
+  sparseBm_t s;
+  uint16 unit;
+  uint16 set = 0;
+  uint8 same = TRUE;
+
+  memset(sparseStore, 0, sizeof(sparseStore));
+  SparseBm_Init(&s, SPARSE_UNITS, sparseSummary, SparseRead, SparseWrite);
+  SparseBm_Load(&s);
+  Check(s.missing == SPARSE_UNITS, "empty bitmap misses every unit");
+
+  // More groups than leaves in RAM, so leaves are given up on the way
+  for (unit = 0; unit < SPARSE_UNITS; unit += 7) {
+    SparseBm_Set(&s, unit);
+    ++set;
+  }
+  for (unit = 0; unit < SPARSEBM_GROUP_UNITS; ++unit) {
+    SparseBm_Set(&s, unit);
+  }
+  set += SPARSEBM_GROUP_UNITS - (SPARSEBM_GROUP_UNITS + 6) / 7;
+  Check(s.missing == SPARSE_UNITS - set, "bitmap counts the units set");
+  SparseBm_Flush(&s);
+
+  SparseBm_Init(&s, SPARSE_UNITS, sparseSummary, SparseRead, SparseWrite);
+  SparseBm_Load(&s);
+  Check(s.missing == SPARSE_UNITS - set, "reloaded bitmap has the same count");
+  for (unit = 0; unit < SPARSE_UNITS; ++unit) {
+    if (SparseBm_Test(&s, unit) != (unit < SPARSEBM_GROUP_UNITS || unit % 7 == 0)) {
+      same = FALSE;
+    }
+  }
+  Check(same, "reloaded bitmap has the same units");
+  Check(SparseBm_NextClear(&s, 0) == SPARSEBM_GROUP_UNITS, "first missing unit after the full group");
+}
+
+/*********************************************************************
+ * UART ring
+ */
+
+#define DRIVER_BYTES      128
+#define UART_CHUNK        32
+
+static uint8 driverOut[4096];
+static uint16 driverSent;
+static uint16 driverQueued;
+static uint16 driverLargest;
+
+// Like HalUARTWrite(), all of a write or nothing
+static uint16 DriverWrite( uint8 *buf, uint16 len )
+{
+  if (len > driverLargest) {
+    driverLargest = len;
+  }
+  if (len > DRIVER_BYTES - driverQueued) {
+    return 0;
+  }
+  memcpy(driverOut + driverSent, buf, len);
+  driverSent += len;
+  driverQueued += len;
+  return len;
+}
+
+static void CheckRing( void )
+{
+  static txRing_t r;
+  uint8 msg[50];
+  uint16 put = 0;
+  uint16 head;
+  uint16 wraps = 0;
+  uint16 i;
+  uint8 inOrder = TRUE;
+
+  TxRing_Init(&r, TXRING_DROP);
+  driverSent = driverQueued = driverLargest = 0;
+
+  // Writes of 50 bytes wrap the ring many times over while the driver
+  // only gets its buffer back now and then
+  while (put + sizeof(msg) <= sizeof(driverOut)) {
+    for (i = 0; i < sizeof(msg); ++i) {
+      msg[i] = (uint8)(put + i);
+    }
+    if (TxRing_Put(&r, msg, sizeof(msg)) == sizeof(msg)) {
+      put += sizeof(msg);
+    }
+    head = r.head;
+    TxRing_Drain(&r, DriverWrite, UART_CHUNK);
+    if (r.head < head) {
+      ++wraps;
+    }
+    if ((put / sizeof(msg)) % 3 == 0) {
+      driverQueued = 0;
+    }
+  }
+  while (r.count) {
+    driverQueued = 0;
+    TxRing_Drain(&r, DriverWrite, UART_CHUNK);
+  }
+
+  for (i = 0; i < driverSent; ++i) {
+    if (driverOut[i] != (uint8)i) {
+      inOrder = FALSE;
+    }
+  }
+  Check(wraps > 1 && r.dropped != 0, "ring wraps and fills up");
+  Check(driverSent == put, "every byte put reaches the driver");
+  Check(inOrder, "bytes reach the driver in order");
+  Check(driverLargest <= UART_CHUNK, "no write larger than a chunk");
+}
+
+int main( void )
+{
+  CheckFetch();
+  CheckJournal();
+  CheckDelta();
+  CheckSparse();
+  CheckRing();
+
+  printf("%u checks, %u failed\n", checks, failed);
+  return failed ? 1 : 0;
+}
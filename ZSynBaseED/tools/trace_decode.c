@@ -0,0 +1,238 @@
+/*******************************************************************************
+  Filename:       trace_decode.c
+  Revised:        $Date$
+  Revision:       $Revision$
+
+  Description -   Host side decoder of the tokenized trace. Turns the binary
+                  records of BaseED_trace.c back into text, taking the text
+                  of every event from the TRACE_EVENTS list the firmware is
+                  built with.
+
+  Build:          cc -O2 -I tools/host -I . -o trace_decode \
+                     tools/trace_decode.c BaseED_trace.c
+
+  Usage:          trace_decode [-m | -s] [file]
+
+                  Without an option the input is records as hex text,
+                  whitespace anywhere. With -m every line is the payload of
+                  an APP_MT_TRACE_READ response, the count of records lost
+                  first. With -s the input is a binary capture of the serial
+                  port of a debug build, the records are picked out behind
+                  TRACE_SYNC and everything else is skipped.
+*******************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BaseED_trace.h"
+
+typedef struct traceText
+{
+  const char *name;
+  const char *text;
+} traceText_t;
+
+#define TRACE_EVENT_TEXT(event, args, text)   { #event, text },
+
+static const traceText_t traceText[TRACE_EVENT_COUNT] = { TRACE_EVENTS(TRACE_EVENT_TEXT) };
+
+// Time of the last record, the records only carry the low 16 bits of it
+static unsigned long clockMs;
+static int clockSet;
+
+static unsigned Arg( const uint8 *rec, int n )
+{
+  return rec[3 + 2 * n] | (rec[4 + 2 * n] << 8);
+}
+
+static void Print( const uint8 *rec )
+{
+  const char *p = traceText[rec[0]].text;
+  unsigned now = rec[1] | (rec[2] << 8);
+  unsigned args = (Trace_RecordLen(rec[0]) - 3) / 2;
+  unsigned next = 0;
+  char spec[16];
+  size_t n;
+
+  if (!clockSet) {
+    clockMs = now;
+    clockSet = 1;
+  }
+  else {
+    clockMs += (now - clockMs) & 0xFFFF;
+  }
+  printf("%10lu  %-26s ", clockMs, traceText[rec[0]].name);
+
+  while (*p) {
+    if (*p != '%') {
+      putchar(*p++);
+      continue;
+    }
+    // Flags and width, then the conversion
+    n = 0;
+    spec[n++] = *p++;
+    while ((*p == '0' || *p == '-' || isdigit((unsigned char)*p)) && n < sizeof(spec) - 3) {
+      spec[n++] = *p++;
+    }
+    if (*p == 'L') {
+      unsigned long v = 0;
+      if (next + 2 <= args) {
+        v = Arg(rec, next) | ((unsigned long)Arg(rec, next + 1) << 16);
+      }
+      next += 2;
+      spec[n++] = 'l';
+      spec[n++] = 'u';
+      spec[n] = '\0';
+      printf(spec, v);
+    }
+    else if (*p == 'u' || *p == 'd' || *p == 'x' || *p == 'X') {
+      unsigned v = (next < args) ? Arg(rec, next) : 0;
+      ++next;
+      spec[n++] = *p;
+      spec[n] = '\0';
+      if (*p == 'd') {
+        printf(spec, (int)(short)v);
+      }
+      else {
+        printf(spec, v);
+      }
+    }
+    else if (*p == '%') {
+      putchar('%');
+    }
+    if (*p) {
+      ++p;
+    }
+  }
+  putchar('\n');
+}
+
+// Decodes the records in buf, returns the bytes used up
+static size_t Decode( const uint8 *buf, size_t len )
+{
+  size_t used = 0;
+  size_t n;
+
+  while (used < len) {
+    if (buf[used] >= TRACE_EVENT_COUNT) {
+      printf("unknown event %u, rest of the records skipped\n", buf[used]);
+      return len;
+    }
+    n = Trace_RecordLen(buf[used]);
+    if (n > len - used) {
+      break;
+    }
+    Print(buf + used);
+    used += n;
+  }
+  return used;
+}
+
+// Reads the hex digits of a line into buf, returns the bytes read
+static size_t ParseHex( const char *line, uint8 *buf, size_t max )
+{
+  size_t n = 0;
+  int half = -1;
+  int v;
+
+  for (; *line && n < max; ++line) {
+    if (!isxdigit((unsigned char)*line)) {
+      continue;
+    }
+    v = isdigit((unsigned char)*line) ? *line - '0' : (tolower((unsigned char)*line) - 'a' + 10);
+    if (half < 0) {
+      half = v;
+    }
+    else {
+      buf[n++] = (uint8)((half << 4) | v);
+      half = -1;
+    }
+  }
+  return n;
+}
+
+int main( int argc, char **argv )
+{
+  FILE *in = stdin;
+  int mt = 0;
+  int serial = 0;
+  char line[1024];
+  uint8 buf[512];
+  size_t len = 0;
+  int opt;
+  int c;
+
+  for (opt = 1; opt < argc && argv[opt][0] == '-' && argv[opt][1]; ++opt) {
+    if (strcmp(argv[opt], "-m") == 0) {
+      mt = 1;
+    }
+    else if (strcmp(argv[opt], "-s") == 0) {
+      serial = 1;
+    }
+    else {
+      fprintf(stderr, "usage: %s [-m | -s] [file]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (opt < argc) {
+    in = fopen(argv[opt], serial ? "rb" : "r");
+    if (in == NULL) {
+      perror(argv[opt]);
+      return 1;
+    }
+  }
+
+  if (serial) {
+    // A record follows every sync byte, whatever else is on the port
+    while ((c = fgetc(in)) != EOF) {
+      uint8 rec[TRACE_RECORD_MAX];
+      size_t i, n;
+      if (c != TRACE_SYNC) {
+        continue;
+      }
+      if ((c = fgetc(in)) == EOF) {
+        break;
+      }
+      if (c >= TRACE_EVENT_COUNT) {
+        continue;
+      }
+      rec[0] = (uint8)c;
+      n = Trace_RecordLen(rec[0]);
+      for (i = 1; i < n && (c = fgetc(in)) != EOF; ++i) {
+        rec[i] = (uint8)c;
+      }
+      if (i == n) {
+        Print(rec);
+      }
+    }
+  }
+  else {
+    while (fgets(line, sizeof(line), in)) {
+      size_t n = ParseHex(line, buf + len, sizeof(buf) - len);
+      if (mt) {
+        if (n >= 2 && (buf[0] | buf[1])) {
+          printf("%u records lost\n", buf[0] | (buf[1] << 8));
+        }
+        if (n > 2) {
+          Decode(buf + 2, n - 2);
+        }
+        continue;
+      }
+      // Records may run on into the next line
+      len += n;
+      n = Decode(buf, len);
+      memmove(buf, buf + n, len - n);
+      len -= n;
+    }
+    if (len) {
+      printf("%u bytes left over\n", (unsigned)len);
+    }
+  }
+
+  if (in != stdin) {
+    fclose(in);
+  }
+  return 0;
+}